@@ -304,6 +304,23 @@ void SystemClock_Config(void)
 	HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_5);
 }
 
+/**
+ * @brief  Prescaler of an APB1 timer (TIM2..7, TIM12..14) for a counter clock.
+ *         APB1 timers run at twice PCLK1 as long as the APB1 prescaler is not 1.
+ * @param  tickHz: counter clock in Hz
+ * @retval value for TIM_Base_InitTypeDef.Prescaler
+ */
+uint32_t APB1_TimerPrescaler(uint32_t tickHz)
+{
+	uint32_t timerClock = HAL_RCC_GetPCLK1Freq();
+
+	if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1)
+	{
+		timerClock *= 2;
+	}
+	return timerClock / tickHz - 1;
+}
+
 #if defined (DATA_IN_ExtSRAM) && defined (DATA_IN_ExtSDRAM)
 #if defined(STM32F427xx) || defined(STM32F437xx) || defined(STM32F429xx) || defined(STM32F439xx)\
  || defined(STM32F469xx) || defined(STM32F479xx)
@@ -66,6 +66,26 @@
         function or a complete string line using LCD_DisplayStringAtLine() function.
       o Display a string line on the specified position (x,y in pixel) and align mode
         using LCD_DisplayStringAtLine() function.          
+      o Characters are drawn by the DMA2D, one blend per character from a glyph
+        atlas that LCD_SetFont() builds for the selected font. L8 layers copy
+        the glyph from the atlas with the CPU, row by row.
+      o printf() after LCD_SetPrintPosition() only updates a character grid,
+        LCD_FlushText() draws the cells that changed. Call it once per frame.
+      o LCD_SetDoubleBuffer() gives a layer a second frame buffer: drawing goes
+        to the back buffer, LCD_Present() swaps the buffers at the next vertical
+        blanking. Drawing functions wait while a present is pending, what
+        they draw is copied into the other buffer after the swap. The text
+        grid keeps both buffers itself. LCD_GetPresentStats() reports shown
+        and dropped frames and the present latency.
+      o The DMA2D works through a queue: fills, copies, conversions and glyph
+        blends return once queued and the transfer complete interrupt starts
+        the next one. LCD_GetFence() numbers the last one queued, LCD_WaitFence()
+        waits for it. Pixel access by the CPU and LCD_Present() wait by themselves.
+      o LCD_LayerInit() sets up a layer as ARGB8888, RGB565 or L8. Colors stay
+        ARGB8888 in all functions, they are converted once per primitive or
+        pixel. L8 uses a fixed CLUT, a 6x6x6 color cube and the LCD_COLOR_xxx
+        colors, and is drawn by the CPU, the DMA2D has no 8 bit output.
+        LCD_Init() sets up layer 0 as RGB565.
       o Draw and fill a basic shapes (dot, line, rectangle, circle, ellipse, .. bitmap) 
         on LCD using the available set of functions     
  
@@ -73,6 +93,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include <stdio.h>
+#include <string.h>
 
 #include "stm32f429i_discovery_lcd.h"
 #include "../../../Utilities/Fonts/fonts.h"
@@ -98,6 +119,51 @@
 /** @defgroup STM32F429I_DISCOVERY_LCD_Private_TypesDefinitions STM32F429I DISCOVERY LCD Private TypesDefinitions
   * @{
   */ 
+typedef struct
+{
+  uint8_t Ascii;
+  uint8_t Font;                 /* index in GridFont */
+  uint8_t Colors;               /* index in GridColor, text << 4 | back */
+  uint8_t Dirty;
+} LCD_CellTypeDef;
+
+/* One queued DMA2D operation, the register values to load */
+typedef struct
+{
+  uint32_t CR;                  /* mode, the interrupt enables are added */
+  uint32_t FGMAR;
+  uint32_t FGOR;
+  uint32_t FGPFCCR;
+  uint32_t FGCOLR;
+  uint32_t BGMAR;
+  uint32_t BGOR;
+  uint32_t BGPFCCR;
+  uint32_t OPFCCR;
+  uint32_t OCOLR;
+  uint32_t OMAR;
+  uint32_t OOR;
+  uint32_t NLR;
+} LCD_Dma2dOpTypeDef;
+
+/* Pixel access of one frame buffer format, selected per layer by
+   LCD_LayerInit(), so no function tests the format per pixel */
+typedef struct
+{
+  uint32_t BytesPerPixel;
+  uint32_t Dma2dMode;           /* DMA2D output color mode, PIXEL_NO_DMA2D if there is none */
+  uint32_t (*ToPixel)(uint32_t Color);                  /* ARGB8888 to the pixel value */
+  void     (*DrawPixel)(uint32_t Address, uint32_t Color);
+  uint32_t (*ReadPixel)(uint32_t Address);              /* the pixel value */
+} LCD_PixelOpsTypeDef;
+
+/* Area drawn into a frame buffer, X1 and Y1 exclusive, empty if X0 >= X1 */
+typedef struct
+{
+  uint16_t X0;
+  uint16_t Y0;
+  uint16_t X1;
+  uint16_t Y1;
+} LCD_DamageTypeDef;
 /**
   * @}
   */ 
@@ -107,6 +173,39 @@
   */
 #define POLY_X(Z)              ((int32_t)((Points + Z)->X))
 #define POLY_Y(Z)              ((int32_t)((Points + Z)->Y))
+
+/* Glyph atlas: characters 0x20..0x7E, sized for the largest font (Font24) */
+#define GLYPH_FIRST            ' '
+#define GLYPH_LAST             '~'
+#define GLYPH_COUNT            (GLYPH_LAST - GLYPH_FIRST + 1)
+#define GLYPH_MAX_WIDTH        17
+#define GLYPH_MAX_HEIGHT       24
+
+/* Text grid of printf(), sized for the smallest font (Font8, 5x8 pixels) */
+#define GRID_LINES             (320 / 8)
+#define GRID_COLUMNS           (240 / 5)
+#define GRID_COLORS            16
+#define GRID_FONTS             8
+#define GRID_UNKNOWN           0        /* cell content not known, the next write draws it */
+
+/* Line interrupt in the vertical blanking, after the reload at its start */
+#define VBLANK_LINE            (LtdcHandler.Init.AccumulatedActiveH + 2)
+
+/* DMA2D queue, a power of 2. A printf() line is well below, a bitmap
+   queues one conversion per line and waits for free entries */
+#define DMA2D_QUEUE_SIZE       32
+#define DMA2D_CR_IT            (DMA2D_CR_TCIE | DMA2D_CR_TEIE | DMA2D_CR_CEIE)
+#define DMA2D_ISR_DONE         (DMA2D_ISR_TCIF | DMA2D_ISR_TEIF | DMA2D_ISR_CEIF)
+
+/* Swap states of double buffering */
+#define SWAP_IDLE              0
+#define SWAP_RENDERING         1        /* presented, the DMA2D still draws the back buffer */
+#define SWAP_VBLANK            2        /* reload requested, waiting for the vertical blanking */
+
+/* Frame buffer formats */
+#define PIXEL_NO_DMA2D         0xFFFFFFFF
+#define CLUT_SIZE              256
+#define CLUT_CUBE_SIZE         (6 * 6 * 6)
 /**
   * @}
   */ 
@@ -115,6 +214,8 @@
   * @{
   */
 #define ABS(X)  ((X) > 0 ? (X) : -(X))
+/* Address of a pixel in the frame buffer drawn to */
+#define PIXEL_ADDRESS(L, X, Y)  (BackAddress(L) + PixelOps[(L)]->BytesPerPixel * ((Y) * LCD_GetXSize() + (X)))
 /**
   * @}
   */ 
@@ -123,13 +224,67 @@
   * @{
   */ 
 LTDC_HandleTypeDef  LtdcHandler;
-static DMA2D_HandleTypeDef Dma2dHandler;
 static RCC_PeriphCLKInitTypeDef  PeriphClkInitStruct;
 
 /* Default LCD configuration with LCD Layer 1 */
 static uint32_t ActiveLayer = 0;
 static LCD_DrawPropTypeDef DrawProp[MAX_LAYER_NUMBER];
 LCD_DrvTypeDef  *LcdDrv;
+
+/* Glyphs of one font as A8, one alpha byte per pixel, glyph after glyph.
+   Only one font at a time, LCD_SetFont() rebuilds it when the font changes */
+static uint8_t  GlyphAtlas[GLYPH_COUNT * GLYPH_MAX_WIDTH * GLYPH_MAX_HEIGHT];
+static sFONT    *GlyphAtlasFont = NULL;
+/* Background input of the glyph blend, filled with the back color */
+static uint32_t GlyphBack[GLYPH_MAX_WIDTH * GLYPH_MAX_HEIGHT];
+static uint32_t GlyphBackColor;
+static uint8_t  GlyphBackValid = 0;
+static uint32_t GlyphFence = 0;                 /* last blend reading the atlas and GlyphBack */
+
+/* Retained text of printf(), cells in the line/column raster of their font.
+   Colors and fonts are kept in small tables, a cell holds their indexes */
+static LCD_CellTypeDef Grid[GRID_LINES][GRID_COLUMNS];
+static uint8_t  GridLineDirty[GRID_LINES];
+static uint32_t GridColor[GRID_COLORS];
+static uint8_t  GridColorCount = 0;
+static sFONT    *GridFont[GRID_FONTS];
+static uint8_t  GridFontCount = 0;
+
+/* Frame buffer the drawing functions write to, the back buffer of a
+   double buffered layer */
+static uint32_t DrawAddress[MAX_LAYER_NUMBER];
+/* Double buffering, see LCD_SetDoubleBuffer(). A grid cell has one dirty
+   bit per buffer, so a change is drawn into both of them. Other drawing
+   is recorded as damage and copied into the other buffer after the swap */
+static uint8_t  DoubleBuffered = 0;
+static uint32_t DoubleBufferLayer;
+static uint32_t FrameBuffers[2];
+static volatile uint8_t FrontBuffer = 0;        /* index in FrameBuffers of the buffer shown */
+static volatile uint8_t SwapState = SWAP_IDLE;
+static volatile uint8_t FrameDrawn = 0;         /* back buffer changed since the last present */
+static uint32_t PresentCycles;                  /* DWT cycle counter at LCD_Present() */
+static uint32_t PresentFence;                   /* last DMA2D operation of the presented frame */
+static LCD_PresentStatsTypeDef PresentStats;
+static LCD_DamageTypeDef FrameDamage;           /* drawn into the back buffer since the last present */
+static LCD_DamageTypeDef CopyDamage;            /* drawn into the frame shown, missing in the back buffer */
+static uint8_t  TrackDamage = 1;                /* 0 while LCD_FlushText() draws */
+
+/* DMA2D queue. Fences count the operations: the one of fence n is in
+   entry n % DMA2D_QUEUE_SIZE, Dma2dCompleted - Dma2dSubmitted are queued */
+static LCD_Dma2dOpTypeDef Dma2dQueue[DMA2D_QUEUE_SIZE];
+static volatile uint32_t Dma2dSubmitted = 0;
+static volatile uint32_t Dma2dCompleted = 0;
+static volatile uint8_t  Dma2dRunning = 0;
+
+/* CLUT of L8 layers: the color cube, then the LCD_COLOR_xxx colors not in it */
+static uint32_t LcdClut[CLUT_SIZE];
+static const uint32_t ClutNamed[] =
+{
+  LCD_COLOR_LIGHTBLUE, LCD_COLOR_LIGHTGREEN, LCD_COLOR_LIGHTRED, LCD_COLOR_LIGHTCYAN,
+  LCD_COLOR_LIGHTMAGENTA, LCD_COLOR_LIGHTYELLOW, LCD_COLOR_DARKBLUE, LCD_COLOR_DARKGREEN,
+  LCD_COLOR_DARKRED, LCD_COLOR_DARKCYAN, LCD_COLOR_DARKMAGENTA, LCD_COLOR_DARKYELLOW,
+  LCD_COLOR_LIGHTGRAY, LCD_COLOR_GRAY, LCD_COLOR_DARKGRAY, LCD_COLOR_BROWN, LCD_COLOR_ORANGE
+};
 /**
   * @}
   */ 
@@ -138,8 +293,47 @@ LCD_DrvTypeDef  *LcdDrv;
   * @{
   */ 
 static void DrawChar(uint16_t Xpos, uint16_t Ypos, const uint8_t *c);
+static uint8_t BuildGlyphAtlas(sFONT *pFont);
+static void BlitGlyph(uint16_t Xpos, uint16_t Ypos, uint8_t Ascii);
+static int  GridColorIndex(uint32_t Color);
+static int  GridFontIndex(sFONT *pFont);
+static void GridPutChar(uint32_t Ln, uint32_t Col, uint8_t Ascii);
+static void CopyBuffer(uint32_t LayerIndex, void *pSrc, void *pDst, uint32_t xSize, uint32_t ySize, uint32_t OffLine);
+static uint32_t BackAddress(uint32_t LayerIndex);
+static void UpdateBackBuffer(void);
+static void MarkDrawn(uint32_t LayerIndex, uint32_t Xpos, uint32_t Ypos, uint32_t Width, uint32_t Height);
+static void MarkDrawnAt(uint32_t LayerIndex, uint32_t Address, uint32_t Width, uint32_t Height);
 static void FillBuffer(uint32_t LayerIndex, void *pDst, uint32_t xSize, uint32_t ySize, uint32_t OffLine, uint32_t ColorIndex);
-static void ConvertLineToARGB8888(void *pSrc, void *pDst, uint32_t xSize, uint32_t ColorMode);
+static void ConvertLine(void *pSrc, void *pDst, uint32_t xSize, uint32_t ColorMode);
+static void ConvertLineCpu(const uint8_t *pSrc, uint32_t Address, uint32_t xSize, uint32_t ColorMode);
+static uint32_t Dma2dSubmit(const LCD_Dma2dOpTypeDef *Op);
+static void Dma2dStart(uint32_t Fence);
+static void StartSwap(void);
+static void BuildClut(void);
+static uint32_t ToPixelARGB8888(uint32_t Color);
+static uint32_t ToPixelRGB565(uint32_t Color);
+static uint32_t ToPixelL8(uint32_t Color);
+static void DrawPixelARGB8888(uint32_t Address, uint32_t Color);
+static void DrawPixelRGB565(uint32_t Address, uint32_t Color);
+static void DrawPixelL8(uint32_t Address, uint32_t Color);
+static uint32_t ReadPixelARGB8888(uint32_t Address);
+static uint32_t ReadPixelRGB565(uint32_t Address);
+static uint32_t ReadPixelL8(uint32_t Address);
+
+/* Pixel access per frame buffer format, see LCD_LayerInit() */
+static const LCD_PixelOpsTypeDef PixelOpsARGB8888 =
+{
+  4, DMA2D_OUTPUT_ARGB8888, ToPixelARGB8888, DrawPixelARGB8888, ReadPixelARGB8888
+};
+static const LCD_PixelOpsTypeDef PixelOpsRGB565 =
+{
+  2, DMA2D_OUTPUT_RGB565, ToPixelRGB565, DrawPixelRGB565, ReadPixelRGB565
+};
+static const LCD_PixelOpsTypeDef PixelOpsL8 =
+{
+  1, PIXEL_NO_DMA2D, ToPixelL8, DrawPixelL8, ReadPixelL8
+};
+static const LCD_PixelOpsTypeDef *PixelOps[MAX_LAYER_NUMBER] = {&PixelOpsARGB8888, &PixelOpsARGB8888};
 /**
   * @}
   */ 
@@ -161,6 +355,10 @@ uint8_t LCD_Init(void)
 
     /* LTDC Configuration ----------------------------------------------------*/
     LtdcHandler.Instance = LTDC;
+
+    /* DMA2D queue, the transfer complete interrupt starts the next operation */
+    HAL_NVIC_SetPriority(DMA2D_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(DMA2D_IRQn);
     
     /* Timing configuration  (Typical configuration from ILI9341 datasheet)
           HSYNC=10 (9+1)
@@ -236,8 +434,8 @@ uint8_t LCD_Init(void)
 	LCD_SetColorKeying(1, LCD_COLOR_WHITE);
 	LCD_SetLayerVisible(1, DISABLE);
 
-	/* Layer1 Init */
-	LCD_LayerDefaultInit(0, LCD_FRAME_BUFFER_LAYER0);
+	/* Layer1 Init, RGB565 halves the SDRAM accesses of ARGB8888 */
+	LCD_LayerInit(0, LCD_FRAME_BUFFER_LAYER0, LTDC_PIXEL_FORMAT_RGB565);
 
 	/* Set Foreground Layer */
 	LCD_SelectLayer(0);
@@ -275,15 +473,47 @@ uint32_t LCD_GetYSize(void)
   * @param  FB_Address: the layer frame buffer.
   */
 void LCD_LayerDefaultInit(uint16_t LayerIndex, uint32_t FB_Address)
+{     
+  LCD_LayerInit(LayerIndex, FB_Address, LTDC_PIXEL_FORMAT_ARGB8888);
+}
+
+/**
+  * @brief  Initializes a LCD layer with a frame buffer format.
+  * @param  LayerIndex: the layer foreground or background. 
+  * @param  FB_Address: the layer frame buffer, 4, 2 or 1 bytes per pixel.
+  * @param  PixelFormat: LTDC_PIXEL_FORMAT_ARGB8888, LTDC_PIXEL_FORMAT_RGB565
+  *         or LTDC_PIXEL_FORMAT_L8
+  * @retval LCD_OK, LCD_ERROR for other formats
+  */
+uint8_t LCD_LayerInit(uint16_t LayerIndex, uint32_t FB_Address, uint32_t PixelFormat)
 {     
   LCD_LayerCfgTypeDef   Layercfg;
+  const LCD_PixelOpsTypeDef *ops;
+
+  switch(PixelFormat)
+  {
+  case LTDC_PIXEL_FORMAT_ARGB8888:
+    ops = &PixelOpsARGB8888;
+    break;
+  case LTDC_PIXEL_FORMAT_RGB565:
+    ops = &PixelOpsRGB565;
+    break;
+  case LTDC_PIXEL_FORMAT_L8:
+    ops = &PixelOpsL8;
+    break;
+  default:
+    return LCD_ERROR;
+  }
+
+  /* Queued operations still use the old format */
+  LCD_WaitFence(Dma2dSubmitted);
 
  /* Layer Init */
   Layercfg.WindowX0 = 0;
   Layercfg.WindowX1 = LCD_GetXSize();
   Layercfg.WindowY0 = 0;
   Layercfg.WindowY1 = LCD_GetYSize(); 
-  Layercfg.PixelFormat = LTDC_PIXEL_FORMAT_ARGB8888;
+  Layercfg.PixelFormat = PixelFormat;
   Layercfg.FBStartAdress = FB_Address;
   Layercfg.Alpha = 255;
   Layercfg.Alpha0 = 0;
@@ -296,6 +526,14 @@ void LCD_LayerDefaultInit(uint16_t LayerIndex, uint32_t FB_Address)
   Layercfg.ImageHeight = LCD_GetYSize();
   
   HAL_LTDC_ConfigLayer(&LtdcHandler, &Layercfg, LayerIndex); 
+  if(PixelFormat == LTDC_PIXEL_FORMAT_L8)
+  {
+    BuildClut();
+    HAL_LTDC_ConfigCLUT(&LtdcHandler, LcdClut, CLUT_SIZE, LayerIndex);
+    HAL_LTDC_EnableCLUT(&LtdcHandler, LayerIndex);
+  }
+  PixelOps[LayerIndex] = ops;
+  DrawAddress[LayerIndex] = FB_Address;
 
   DrawProp[LayerIndex].BackColor = LCD_COLOR_WHITE;
   DrawProp[LayerIndex].pFont     = &Font24;
@@ -303,6 +541,8 @@ void LCD_LayerDefaultInit(uint16_t LayerIndex, uint32_t FB_Address)
 
   /* Dithering activation */
   HAL_LTDC_EnableDither(&LtdcHandler);
+
+  return LCD_OK;
 }
 
 /**
@@ -386,6 +626,10 @@ void LCD_SetTransparency_NoReload(uint32_t LayerIndex, uint8_t Transparency)
 void LCD_SetLayerAddress(uint32_t LayerIndex, uint32_t Address)
 {     
   HAL_LTDC_SetAddress(&LtdcHandler, Address, LayerIndex);
+  if(!DoubleBuffered || (LayerIndex != DoubleBufferLayer))
+  {
+    DrawAddress[LayerIndex] = Address;
+  }
 }
 
 /**
@@ -397,6 +641,11 @@ void LCD_SetLayerAddress(uint32_t LayerIndex, uint32_t Address)
 void LCD_SetLayerAddress_NoReload(uint32_t LayerIndex, uint32_t Address)
 {
   HAL_LTDC_SetAddress_NoReload(&LtdcHandler, Address, LayerIndex);
+  /* The back buffer of a double buffered layer stays the drawing target */
+  if(!DoubleBuffered || (LayerIndex != DoubleBufferLayer))
+  {
+    DrawAddress[LayerIndex] = Address;
+  }
 }
 
 /**
@@ -535,6 +784,9 @@ void LCD_SetBackColor(uint32_t Color)
 void LCD_SetFont(sFONT *pFonts)
 {
   DrawProp[ActiveLayer].pFont = pFonts;
+
+  /* Expand the glyphs here once, not for every character */
+  BuildGlyphAtlas(pFonts);
 }
 
 /**
@@ -550,40 +802,21 @@ sFONT *LCD_GetFont(void)
   * @brief  Reads Pixel.
   * @param  Xpos: the X position
   * @param  Ypos: the Y position 
-  * @retval RGB pixel color
+  * @retval Pixel value in the format of the layer, the CLUT index for L8
   */
 uint32_t LCD_ReadPixel(uint16_t Xpos, uint16_t Ypos)
 {
-  uint32_t ret = 0;
-  
-  if (Xpos > LCD_GetXSize() || Ypos > LCD_GetYSize()) {
-	return 0;
-  }
+  uint32_t address;
 
-  if(LtdcHandler.LayerCfg[ActiveLayer].PixelFormat == LTDC_PIXEL_FORMAT_ARGB8888)
-  {
-    /* Read data value from SDRAM memory */
-    ret = *(__IO uint32_t*) (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress + (4*(Ypos*LCD_GetXSize() + Xpos)));
-  }
-  else if(LtdcHandler.LayerCfg[ActiveLayer].PixelFormat == LTDC_PIXEL_FORMAT_RGB888)
-  {
-    /* Read data value from SDRAM memory */
-    ret = (*(__IO uint32_t*) (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress + (4*(Ypos*LCD_GetXSize() + Xpos))) & 0x00FFFFFF);
-  }
-  else if((LtdcHandler.LayerCfg[ActiveLayer].PixelFormat == LTDC_PIXEL_FORMAT_RGB565) || \
-          (LtdcHandler.LayerCfg[ActiveLayer].PixelFormat == LTDC_PIXEL_FORMAT_ARGB4444) || \
-          (LtdcHandler.LayerCfg[ActiveLayer].PixelFormat == LTDC_PIXEL_FORMAT_AL88))  
-  {
-    /* Read data value from SDRAM memory */
-    ret = *(__IO uint16_t*) (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress + (2*(Ypos*LCD_GetXSize() + Xpos)));    
-  }
-  else
-  {
-    /* Read data value from SDRAM memory */
-    ret = *(__IO uint8_t*) (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress + (2*(Ypos*LCD_GetXSize() + Xpos)));    
+  if (Xpos >= LCD_GetXSize() || Ypos >= LCD_GetYSize()) {
+	return 0;
   }
+  address = PIXEL_ADDRESS(ActiveLayer, Xpos, Ypos);
+  /* Queued DMA2D operations first */
+  LCD_WaitFence(Dma2dSubmitted);
 
-  return ret;
+  /* Read data value from SDRAM memory */
+  return PixelOps[ActiveLayer]->ReadPixel(address);
 }
 
 /**
@@ -592,8 +825,30 @@ uint32_t LCD_ReadPixel(uint16_t Xpos, uint16_t Ypos)
   */
 void LCD_Clear(uint32_t Color)
 { 
-  /* Clear the LCD */ 
-  FillBuffer(ActiveLayer, (uint32_t *)(LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress), LCD_GetXSize(), LCD_GetYSize(), 0, Color);
+  if(DoubleBuffered && (ActiveLayer == DoubleBufferLayer))
+  {
+    /* Both buffers, the grid below is emptied for both of them. The swap
+       must not exchange them in between */
+    while(SwapState != SWAP_IDLE)
+    {
+    }
+    FillBuffer(ActiveLayer, (uint32_t *)FrameBuffers[0], LCD_GetXSize(), LCD_GetYSize(), 0, Color);
+    FillBuffer(ActiveLayer, (uint32_t *)FrameBuffers[1], LCD_GetXSize(), LCD_GetYSize(), 0, Color);
+    /* Both are equal now */
+    memset(&FrameDamage, 0, sizeof(FrameDamage));
+    memset(&CopyDamage, 0, sizeof(CopyDamage));
+  }
+  else
+  {
+    /* Clear the LCD */ 
+    FillBuffer(ActiveLayer, (uint32_t *)(DrawAddress[ActiveLayer]), LCD_GetXSize(), LCD_GetYSize(), 0, Color);
+  }
+
+  /* Nothing printed is left on the screen */
+  memset(Grid, 0, sizeof(Grid));
+  memset(GridLineDirty, 0, sizeof(GridLineDirty));
+  GridColorCount = 0;
+  GridFontCount = 0;
 }
 
 /**
@@ -610,6 +865,37 @@ void LCD_ClearStringLine(uint32_t Line)
   
   DrawProp[ActiveLayer].TextColor = colorbackup;
   LCD_SetTextColor(DrawProp[ActiveLayer].TextColor);  
+
+  /* Printed cells of this line and font are spaces now, in all buffers */
+  if(Line < GRID_LINES)
+  {
+    int font = GridFontIndex(DrawProp[ActiveLayer].pFont);
+    int back = GridColorIndex(DrawProp[ActiveLayer].BackColor);
+    LCD_CellTypeDef *cell;
+    uint32_t col;
+
+    for(col = 0; col < GRID_COLUMNS; col++)
+    {
+      cell = &Grid[Line][col];
+      if(cell->Font != font)
+      {
+        continue;
+      }
+      if(back < 0)
+      {
+        /* Color table full, the next write draws the cell */
+        cell->Ascii = GRID_UNKNOWN;
+        cell->Dirty = 0;
+      }
+      else
+      {
+        cell->Ascii = ' ';
+        cell->Colors = (back << 4) | back;
+        cell->Dirty = DoubleBuffered ? 0x03 : 0x01;
+        GridLineDirty[Line] |= cell->Dirty;
+      }
+    }
+  }
 }
 
 /**
@@ -620,8 +906,16 @@ void LCD_ClearStringLine(uint32_t Line)
   */
 void LCD_DisplayChar(uint16_t Xpos, uint16_t Ypos, uint8_t Ascii)
 {
-  DrawChar(Xpos, Ypos, &DrawProp[ActiveLayer].pFont->table[(Ascii-' ') *\
-              DrawProp[ActiveLayer].pFont->Height * ((DrawProp[ActiveLayer].pFont->Width + 7) / 8)]);
+  if(BuildGlyphAtlas(DrawProp[ActiveLayer].pFont))
+  {
+    BlitGlyph(Xpos, Ypos, Ascii);
+  }
+  else
+  {
+    /* Font larger than the atlas, draw pixel by pixel */
+    DrawChar(Xpos, Ypos, &DrawProp[ActiveLayer].pFont->table[(Ascii-' ') *\
+                DrawProp[ActiveLayer].pFont->Height * ((DrawProp[ActiveLayer].pFont->Width + 7) / 8)]);
+  }
 }
 
 /**
@@ -714,7 +1008,7 @@ void LCD_DrawHLine(uint16_t Xpos, uint16_t Ypos, uint16_t Length)
 {
   uint32_t xaddress = 0;
 
-  if (Xpos > LCD_GetXSize() || Ypos > LCD_GetYSize()) {
+  if (Xpos >= LCD_GetXSize() || Ypos >= LCD_GetYSize()) {
 	return;
   }
   if (Xpos + Length > LCD_GetXSize()) {
@@ -722,7 +1016,7 @@ void LCD_DrawHLine(uint16_t Xpos, uint16_t Ypos, uint16_t Length)
   }
   
   /* Get the line address */
-  xaddress = (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress) + 4*(LCD_GetXSize()*Ypos + Xpos);
+  xaddress = PIXEL_ADDRESS(ActiveLayer, Xpos, Ypos);
 
   /* Write line */
   FillBuffer(ActiveLayer, (uint32_t *)xaddress, Length, 1, 0, DrawProp[ActiveLayer].TextColor);
@@ -738,14 +1032,14 @@ void LCD_DrawVLine(uint16_t Xpos, uint16_t Ypos, uint16_t Length)
 {
   uint32_t xaddress = 0;
   
-  if (Xpos > LCD_GetXSize() || Ypos > LCD_GetYSize()) {
+  if (Xpos >= LCD_GetXSize() || Ypos >= LCD_GetYSize()) {
 	return;
   }
   if (Ypos + Length > LCD_GetYSize()) {
 	  Length = LCD_GetYSize() - Ypos;
   }
   /* Get the line address */
-  xaddress = (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress) + 4*(LCD_GetXSize()*Ypos + Xpos);
+  xaddress = PIXEL_ADDRESS(ActiveLayer, Xpos, Ypos);
   
   /* Write line */
   FillBuffer(ActiveLayer, (uint32_t *)xaddress, 1, Length, (LCD_GetXSize() - 1), DrawProp[ActiveLayer].TextColor);
@@ -945,7 +1239,8 @@ void LCD_DrawEllipse(int Xpos, int Ypos, int XRadius, int YRadius)
   * @brief  Displays a bitmap picture loaded in the internal Flash (32 bpp).
   * @param  X: the bmp x position in the LCD
   * @param  Y: the bmp Y position in the LCD
-  * @param  pBmp: Bmp picture address in the internal Flash
+  * @param  pBmp: Bmp picture address in the internal Flash, read by the
+  *         DMA2D until LCD_GetFence() after the call is done
   */
 void LCD_DrawBitmap(uint32_t X, uint32_t Y, uint8_t *pBmp)
 {
@@ -966,7 +1261,7 @@ void LCD_DrawBitmap(uint32_t X, uint32_t Y, uint8_t *pBmp)
   bitpixel = pBmp[28] + (pBmp[29] << 8);   
  
   /* Set Address */
-  address = LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress + (((LCD_GetXSize()*Y) + X)*(4));
+  address = PIXEL_ADDRESS(ActiveLayer, X, Y);
 
   /* Get the Layer pixel format */    
   if ((bitpixel/8) == 4)
@@ -985,14 +1280,14 @@ void LCD_DrawBitmap(uint32_t X, uint32_t Y, uint8_t *pBmp)
   /* bypass the bitmap header */
   pBmp += (index + (width * (height - 1) * (bitpixel/8)));
 
-  /* Convert picture to ARGB8888 pixel format */
+  /* Convert picture to the pixel format of the layer */
   for(index=0; index < height; index++)
   {
   /* Pixel format conversion */
-  ConvertLineToARGB8888((uint32_t *)pBmp, (uint32_t *)address, width, inputcolormode);
+  ConvertLine((uint32_t *)pBmp, (uint32_t *)address, width, inputcolormode);
 
   /* Increment the source and destination buffers */
-  address+=  ((LCD_GetXSize() - width + width)*4);
+  address+=  LCD_GetXSize() * PixelOps[ActiveLayer]->BytesPerPixel;
   pBmp -= width*(bitpixel/8);
   }
 }
@@ -1008,7 +1303,7 @@ void LCD_FillRect(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
 {
   uint32_t xaddress = 0;
 
-  if (Xpos > LCD_GetXSize() || Ypos > LCD_GetYSize()) {
+  if (Xpos >= LCD_GetXSize() || Ypos >= LCD_GetYSize()) {
 	return;
   }
   if (Xpos + Width > LCD_GetXSize()) {
@@ -1021,7 +1316,7 @@ void LCD_FillRect(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height)
   LCD_SetTextColor(DrawProp[ActiveLayer].TextColor);
 
   /* Get the rectangle start address */
-  xaddress = (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress) + 4*(LCD_GetXSize()*Ypos + Xpos);
+  xaddress = PIXEL_ADDRESS(ActiveLayer, Xpos, Ypos);
 
   /* Fill the rectangle */
   FillBuffer(ActiveLayer, (uint32_t *)xaddress, Width, Height, (LCD_GetXSize() - Width), DrawProp[ActiveLayer].TextColor);
@@ -1365,11 +1660,123 @@ __weak void LCD_MspInit(void)
   */
 void LCD_DrawPixel(uint16_t Xpos, uint16_t Ypos, uint32_t RGB_Code)
 {
-	if (Xpos > LCD_GetXSize() || Ypos > LCD_GetYSize()) {
+  uint32_t address;
+
+	if (Xpos >= LCD_GetXSize() || Ypos >= LCD_GetYSize()) {
 		return;
 	}
+  /* First, it may queue the copy of the last frame */
+  address = PIXEL_ADDRESS(ActiveLayer, Xpos, Ypos);
+  /* Queued DMA2D operations first, they could overwrite the pixel */
+  if(Dma2dCompleted != Dma2dSubmitted)
+  {
+    LCD_WaitFence(Dma2dSubmitted);
+  }
   /* Write data value to all SDRAM memory */
-  *(__IO uint32_t*) (LtdcHandler.LayerCfg[ActiveLayer].FBStartAdress + (4*(Ypos*LCD_GetXSize() + Xpos))) = RGB_Code;
+  PixelOps[ActiveLayer]->DrawPixel(address, RGB_Code);
+  MarkDrawn(ActiveLayer, Xpos, Ypos, 1, 1);
+}
+
+/**
+  * @brief  Pixel access of ARGB8888 frame buffers.
+  */
+static uint32_t ToPixelARGB8888(uint32_t Color)
+{
+  return Color;
+}
+
+static void DrawPixelARGB8888(uint32_t Address, uint32_t Color)
+{
+  *(__IO uint32_t*) Address = Color;
+}
+
+static uint32_t ReadPixelARGB8888(uint32_t Address)
+{
+  return *(__IO uint32_t*) Address;
+}
+
+/**
+  * @brief  Pixel access of RGB565 frame buffers, alpha is dropped.
+  */
+static uint32_t ToPixelRGB565(uint32_t Color)
+{
+  return ((Color >> 8) & 0xF800) | ((Color >> 5) & 0x07E0) | ((Color >> 3) & 0x001F);
+}
+
+static void DrawPixelRGB565(uint32_t Address, uint32_t Color)
+{
+  *(__IO uint16_t*) Address = (uint16_t)ToPixelRGB565(Color);
+}
+
+static uint32_t ReadPixelRGB565(uint32_t Address)
+{
+  return *(__IO uint16_t*) Address;
+}
+
+/**
+  * @brief  Pixel access of L8 frame buffers. A color is its entry among the
+  *         LCD_COLOR_xxx colors or the nearest of the color cube, alpha is
+  *         dropped. The last color is kept, drawing repeats it per pixel.
+  */
+static uint32_t ToPixelL8(uint32_t Color)
+{
+  static uint32_t lastcolor = 0;
+  static uint32_t lastindex = 0;
+  uint32_t rgb = Color & 0x00FFFFFF;
+  uint32_t i;
+
+  if(rgb == lastcolor)
+  {
+    return lastindex;
+  }
+  lastcolor = rgb;
+
+  for(i = 0; i < sizeof(ClutNamed) / sizeof(ClutNamed[0]); i++)
+  {
+    if((ClutNamed[i] & 0x00FFFFFF) == rgb)
+    {
+      lastindex = CLUT_CUBE_SIZE + i;
+      return lastindex;
+    }
+  }
+  /* Cube levels 0x00, 0x33, .. 0xFF */
+  lastindex = ((((rgb >> 16) & 0xFF) + 25) / 51) * 36 +
+              ((((rgb >> 8) & 0xFF) + 25) / 51) * 6 +
+              (((rgb & 0xFF) + 25) / 51);
+  return lastindex;
+}
+
+static void DrawPixelL8(uint32_t Address, uint32_t Color)
+{
+  *(__IO uint8_t*) Address = (uint8_t)ToPixelL8(Color);
+}
+
+static uint32_t ReadPixelL8(uint32_t Address)
+{
+  return *(__IO uint8_t*) Address;
+}
+
+/**
+  * @brief  Fills the CLUT of L8 layers, see ToPixelL8().
+  */
+static void BuildClut(void)
+{
+  uint32_t r, g, b, i = 0;
+
+  for(r = 0; r < 6; r++)
+  {
+    for(g = 0; g < 6; g++)
+    {
+      for(b = 0; b < 6; b++)
+      {
+        LcdClut[i++] = ((r * 51) << 16) | ((g * 51) << 8) | (b * 51);
+      }
+    }
+  }
+  for(r = 0; r < sizeof(ClutNamed) / sizeof(ClutNamed[0]); r++)
+  {
+    LcdClut[i++] = ClutNamed[r] & 0x00FFFFFF;
+  }
 }
 
 /**
@@ -1426,9 +1833,153 @@ static void DrawChar(uint16_t Xpos, uint16_t Ypos, const uint8_t *c)
   }
 }
 
+/**
+  * @brief  Expands a font into the glyph atlas, nothing to do if the atlas
+  *         already holds this font.
+  * @param  pFont: font to expand
+  * @retval 1 if the atlas holds the font, 0 if the font is too large for it
+  */
+static uint8_t BuildGlyphAtlas(sFONT *pFont)
+{
+  uint32_t c, i, j, line;
+  uint16_t bytes;
+  const uint8_t *pchar;
+  uint8_t *pglyph = GlyphAtlas;
+
+  if(pFont == GlyphAtlasFont)
+  {
+    return 1;
+  }
+  if((pFont->Width > GLYPH_MAX_WIDTH) || (pFont->Height > GLYPH_MAX_HEIGHT))
+  {
+    return 0;
+  }
+
+  /* Queued blends still read the old glyphs */
+  LCD_WaitFence(GlyphFence);
+
+  /* Same bit order as DrawChar(), MSB of the first byte is the left pixel */
+  bytes = (pFont->Width + 7) / 8;
+  pchar = pFont->table;
+  for(c = 0; c < GLYPH_COUNT; c++)
+  {
+    for(i = 0; i < pFont->Height; i++)
+    {
+      line = 0;
+      for(j = 0; j < bytes; j++)
+      {
+        line = (line << 8) | *pchar++;
+      }
+      for(j = 0; j < pFont->Width; j++)
+      {
+        *pglyph++ = (line & (1 << (8 * bytes - j - 1))) ? 0xFF : 0x00;
+      }
+    }
+  }
+  GlyphAtlasFont = pFont;
+
+  return 1;
+}
+
+/**
+  * @brief  Draws a character of the glyph atlas with one DMA2D transfer.
+  *         The A8 glyph is the foreground with the text color, the
+  *         background is a buffer filled with the back color, so the
+  *         DMA2D writes both colors and never reads the frame buffer.
+  *         L8 layers have no DMA2D output: the CPU writes the text or the
+  *         back CLUT index per glyph byte, both are looked up once.
+  * @param  Xpos: start column address
+  * @param  Ypos: the Line where to display the character shape
+  * @param  Ascii: character ascii code, others than 0x20..0x7E are drawn as space
+  */
+static void BlitGlyph(uint16_t Xpos, uint16_t Ypos, uint8_t Ascii)
+{
+  uint32_t xsize = LCD_GetXSize();
+  uint32_t ysize = LCD_GetYSize();
+  uint32_t width = GlyphAtlasFont->Width;
+  uint32_t height = GlyphAtlasFont->Height;
+  uint32_t textcolor = DrawProp[ActiveLayer].TextColor;
+  uint32_t i, j;
+  uint8_t textindex, backindex;
+  const uint8_t *pglyph;
+  __IO uint8_t *pdst;
+  LCD_Dma2dOpTypeDef op;
+  const LCD_PixelOpsTypeDef *ops = PixelOps[ActiveLayer];
+
+  if((Xpos >= xsize) || (Ypos >= ysize))
+  {
+    return;
+  }
+  /* Clip at the right and bottom border, the glyph lines keep their pitch */
+  if(Xpos + width > xsize)
+  {
+    width = xsize - Xpos;
+  }
+  if(Ypos + height > ysize)
+  {
+    height = ysize - Ypos;
+  }
+  if((Ascii < GLYPH_FIRST) || (Ascii > GLYPH_LAST))
+  {
+    Ascii = ' ';
+  }
+  pglyph = &GlyphAtlas[(Ascii - GLYPH_FIRST) * GlyphAtlasFont->Width * GlyphAtlasFont->Height];
+
+  if(ops->Dma2dMode == PIXEL_NO_DMA2D)
+  {
+    textindex = (uint8_t)ops->ToPixel(textcolor);
+    backindex = (uint8_t)ops->ToPixel(DrawProp[ActiveLayer].BackColor);
+    /* First, it may queue the copy of the last frame */
+    pdst = (__IO uint8_t *)PIXEL_ADDRESS(ActiveLayer, Xpos, Ypos);
+    /* Queued DMA2D operations first, they could overwrite the glyph */
+    LCD_WaitFence(Dma2dSubmitted);
+    /* The atlas only holds 0x00 and 0xFF */
+    for(i = 0; i < height; i++)
+    {
+      for(j = 0; j < width; j++)
+      {
+        pdst[j] = pglyph[j] ? textindex : backindex;
+      }
+      pglyph += GlyphAtlasFont->Width;
+      pdst += xsize;
+    }
+    MarkDrawn(ActiveLayer, Xpos, Ypos, width, height);
+    return;
+  }
+
+  if(!GlyphBackValid || (GlyphBackColor != DrawProp[ActiveLayer].BackColor))
+  {
+    /* Queued blends still read the old back color */
+    LCD_WaitFence(GlyphFence);
+    GlyphBackColor = DrawProp[ActiveLayer].BackColor;
+    for(i = 0; i < GLYPH_MAX_WIDTH * GLYPH_MAX_HEIGHT; i++)
+    {
+      GlyphBack[i] = GlyphBackColor;
+    }
+    GlyphBackValid = 1;
+  }
+
+  /* Blend A8 glyph, text alpha combined with the glyph alpha */
+  op.CR      = DMA2D_M2M_BLEND;
+  op.FGMAR   = (uint32_t)pglyph;
+  op.FGOR    = GlyphAtlasFont->Width - width;
+  op.FGPFCCR = DMA2D_INPUT_A8 | (DMA2D_COMBINE_ALPHA << DMA2D_FGPFCCR_AM_Pos) | (textcolor & DMA2D_FGPFCCR_ALPHA);
+  op.FGCOLR  = textcolor & 0x00FFFFFF;
+  op.BGMAR   = (uint32_t)GlyphBack;
+  op.BGOR    = GlyphAtlasFont->Width - width;
+  op.BGPFCCR = DMA2D_INPUT_ARGB8888;
+  op.OPFCCR  = ops->Dma2dMode;
+  op.OCOLR   = 0;
+  op.OMAR    = PIXEL_ADDRESS(ActiveLayer, Xpos, Ypos);
+  op.OOR     = xsize - width;
+  op.NLR     = (width << DMA2D_NLR_PL_Pos) | height;
+  GlyphFence = Dma2dSubmit(&op);
+  MarkDrawn(ActiveLayer, Xpos, Ypos, width, height);
+}
+
 /**
   * @brief  Fills buffer.
-  * @param  LayerIndex: layer index
+  * @param  LayerIndex: layer index, gives the pixel format
   * @param  pDst: output color
   * @param  xSize: buffer width
   * @param  ySize: buffer height
@@ -1437,62 +1988,391 @@ static void DrawChar(uint16_t Xpos, uint16_t Ypos, const uint8_t *c)
   */
 static void FillBuffer(uint32_t LayerIndex, void * pDst, uint32_t xSize, uint32_t ySize, uint32_t OffLine, uint32_t ColorIndex) 
 {
-  
-  /* Register to memory mode with ARGB8888 as color Mode */ 
-  Dma2dHandler.Init.Mode         = DMA2D_R2M;
-  Dma2dHandler.Init.ColorMode    = DMA2D_ARGB8888;
-  Dma2dHandler.Init.OutputOffset = OffLine;      
-  
-  Dma2dHandler.Instance = DMA2D; 
-  
-  /* DMA2D Initialization */
-  if(HAL_DMA2D_Init(&Dma2dHandler) == HAL_OK) 
+  const LCD_PixelOpsTypeDef *ops = PixelOps[LayerIndex];
+  LCD_Dma2dOpTypeDef op = {0};
+  uint8_t *pline = pDst;
+  uint32_t pixel = ops->ToPixel(ColorIndex);
+  uint32_t y;
+
+  MarkDrawnAt(LayerIndex, (uint32_t)pDst, xSize, ySize);
+
+  if(ops->Dma2dMode == PIXEL_NO_DMA2D)
   {
-    if(HAL_DMA2D_ConfigLayer(&Dma2dHandler, LayerIndex) == HAL_OK) 
+    /* L8, one byte per pixel, by the CPU behind the queued operations */
+    LCD_WaitFence(Dma2dSubmitted);
+    for(y = 0; y < ySize; y++)
     {
-      if (HAL_DMA2D_Start(&Dma2dHandler, ColorIndex, (uint32_t)pDst, xSize, ySize) == HAL_OK)
-      {
-        /* Polling For DMA transfer */  
-        HAL_DMA2D_PollForTransfer(&Dma2dHandler, 10);
-      }
+      memset(pline, pixel, xSize);
+      pline += xSize + OffLine;
     }
-  } 
+    return;
+  }
+
+  /* Register to memory mode, the color in the output format */ 
+  op.CR     = DMA2D_R2M;
+  op.OPFCCR = ops->Dma2dMode;
+  op.OCOLR  = pixel;
+  op.OMAR   = (uint32_t)pDst;
+  op.OOR    = OffLine;
+  op.NLR    = (xSize << DMA2D_NLR_PL_Pos) | ySize;
+  Dma2dSubmit(&op);
 }
 
 /**
-  * @brief  Converts Line to ARGB8888 pixel format.
+  * @brief  Converts Line to the pixel format of the active layer.
   * @param  pSrc: pointer to source buffer
   * @param  pDst: output color
   * @param  xSize: buffer width
   * @param  ColorMode: input color mode   
   */
-static void ConvertLineToARGB8888(void * pSrc, void * pDst, uint32_t xSize, uint32_t ColorMode)
+static void ConvertLine(void * pSrc, void * pDst, uint32_t xSize, uint32_t ColorMode)
 {    
-  /* Configure the DMA2D Mode, Color Mode and output offset */
-  Dma2dHandler.Init.Mode         = DMA2D_M2M_PFC;
-  Dma2dHandler.Init.ColorMode    = DMA2D_ARGB8888;
-  Dma2dHandler.Init.OutputOffset = 0;     
-  
-  /* Foreground Configuration */
-  Dma2dHandler.LayerCfg[1].AlphaMode = DMA2D_NO_MODIF_ALPHA;
-  Dma2dHandler.LayerCfg[1].InputAlpha = 0xFF;
-  Dma2dHandler.LayerCfg[1].InputColorMode = ColorMode;
-  Dma2dHandler.LayerCfg[1].InputOffset = 0;
-  
-  Dma2dHandler.Instance = DMA2D; 
-  
-  /* DMA2D Initialization */
-  if(HAL_DMA2D_Init(&Dma2dHandler) == HAL_OK) 
+  LCD_Dma2dOpTypeDef op = {0};
+
+  MarkDrawnAt(ActiveLayer, (uint32_t)pDst, xSize, 1);
+
+  if(PixelOps[ActiveLayer]->Dma2dMode == PIXEL_NO_DMA2D)
   {
-    if(HAL_DMA2D_ConfigLayer(&Dma2dHandler, 1) == HAL_OK) 
+    ConvertLineCpu(pSrc, (uint32_t)pDst, xSize, ColorMode);
+    return;
+  }
+
+  /* Memory to memory with pixel format conversion, source alpha kept */
+  op.CR      = DMA2D_M2M_PFC;
+  op.FGMAR   = (uint32_t)pSrc;
+  op.FGPFCCR = ColorMode | (DMA2D_NO_MODIF_ALPHA << DMA2D_FGPFCCR_AM_Pos) | DMA2D_FGPFCCR_ALPHA;
+  op.OPFCCR  = PixelOps[ActiveLayer]->Dma2dMode;
+  op.OMAR    = (uint32_t)pDst;
+  op.NLR     = (xSize << DMA2D_NLR_PL_Pos) | 1;
+  Dma2dSubmit(&op);
+}
+
+/**
+  * @brief  Converts Line by the CPU, for formats the DMA2D cannot write.
+  *         One loop per input format.
+  * @param  pSrc: pointer to source buffer
+  * @param  Address: address of the first output pixel
+  * @param  xSize: buffer width
+  * @param  ColorMode: input color mode, CM_ARGB8888, CM_RGB565 or CM_RGB888
+  */
+static void ConvertLineCpu(const uint8_t *pSrc, uint32_t Address, uint32_t xSize, uint32_t ColorMode)
+{
+  const LCD_PixelOpsTypeDef *ops = PixelOps[ActiveLayer];
+  uint32_t x, c;
+
+  LCD_WaitFence(Dma2dSubmitted);
+  switch(ColorMode)
+  {
+  case CM_ARGB8888:
+    for(x = 0; x < xSize; x++, pSrc += 4, Address += ops->BytesPerPixel)
     {
-      if (HAL_DMA2D_Start(&Dma2dHandler, (uint32_t)pSrc, (uint32_t)pDst, xSize, 1) == HAL_OK)
-      {
-        /* Polling For DMA transfer */  
-        HAL_DMA2D_PollForTransfer(&Dma2dHandler, 10);
-      }
+      ops->DrawPixel(Address, pSrc[0] | (pSrc[1] << 8) | (pSrc[2] << 16) | ((uint32_t)pSrc[3] << 24));
     }
-  } 
+    break;
+
+  case CM_RGB565:
+    for(x = 0; x < xSize; x++, pSrc += 2, Address += ops->BytesPerPixel)
+    {
+      c = pSrc[0] | (pSrc[1] << 8);
+      ops->DrawPixel(Address, 0xFF000000 | ((c & 0xF800) << 8) | ((c & 0x07E0) << 5) | ((c & 0x001F) << 3));
+    }
+    break;
+
+  default:
+    for(x = 0; x < xSize; x++, pSrc += 3, Address += ops->BytesPerPixel)
+    {
+      ops->DrawPixel(Address, 0xFF000000 | (pSrc[2] << 16) | (pSrc[1] << 8) | pSrc[0]);
+    }
+    break;
+  }
+}
+
+/**
+  * @brief  Copies an area between two frame buffers of a layer.
+  * @param  LayerIndex: layer index, gives the pixel format
+  * @param  pSrc: pointer to source buffer
+  * @param  pDst: output buffer
+  * @param  xSize: area width
+  * @param  ySize: area height
+  * @param  OffLine: pixels from the end of one area line to the next one
+  */
+static void CopyBuffer(uint32_t LayerIndex, void *pSrc, void *pDst, uint32_t xSize, uint32_t ySize, uint32_t OffLine)
+{
+  const LCD_PixelOpsTypeDef *ops = PixelOps[LayerIndex];
+  LCD_Dma2dOpTypeDef op = {0};
+  uint8_t *psrc = pSrc;
+  uint8_t *pdst = pDst;
+  uint32_t pitch = (xSize + OffLine) * ops->BytesPerPixel;
+  uint32_t y;
+
+  if(ops->Dma2dMode == PIXEL_NO_DMA2D)
+  {
+    /* L8, by the CPU behind the queued operations */
+    LCD_WaitFence(Dma2dSubmitted);
+    for(y = 0; y < ySize; y++, psrc += pitch, pdst += pitch)
+    {
+      memcpy(pdst, psrc, xSize * ops->BytesPerPixel);
+    }
+    return;
+  }
+
+  /* Memory to memory, same color mode on both sides. The input and output
+     codes of ARGB8888 and RGB565 are equal */
+  op.CR      = DMA2D_M2M;
+  op.FGMAR   = (uint32_t)pSrc;
+  op.FGOR    = OffLine;
+  op.FGPFCCR = ops->Dma2dMode;
+  op.OPFCCR  = ops->Dma2dMode;
+  op.OMAR    = (uint32_t)pDst;
+  op.OOR     = OffLine;
+  op.NLR     = (xSize << DMA2D_NLR_PL_Pos) | ySize;
+  Dma2dSubmit(&op);
+}
+
+/**
+  * @brief  Gets the frame buffer to draw to. For the double buffered layer
+  *         it waits while a present is pending, the buffer is shown after
+  *         it, and brings the back buffer up to date with the frame shown.
+  *         Every address of a drawing function comes from here.
+  * @param  LayerIndex: layer index
+  * @retval Frame buffer address
+  */
+static uint32_t BackAddress(uint32_t LayerIndex)
+{
+  if(DoubleBuffered && (LayerIndex == DoubleBufferLayer))
+  {
+    while(SwapState != SWAP_IDLE)
+    {
+    }
+    if(CopyDamage.X0 < CopyDamage.X1)
+    {
+      UpdateBackBuffer();
+    }
+  }
+  return DrawAddress[LayerIndex];
+}
+
+/**
+  * @brief  Copies what the frame shown got drawn into the back buffer. It
+  *         is queued before the drawing that follows.
+  * @retval None
+  */
+static void UpdateBackBuffer(void)
+{
+  uint32_t xsize = LCD_GetXSize();
+  uint32_t width = CopyDamage.X1 - CopyDamage.X0;
+  uint32_t offset = PixelOps[DoubleBufferLayer]->BytesPerPixel * (CopyDamage.Y0 * xsize + CopyDamage.X0);
+
+  CopyBuffer(DoubleBufferLayer, (void *)(FrameBuffers[FrontBuffer] + offset), (void *)(FrameBuffers[FrontBuffer ^ 1] + offset),
+             width, CopyDamage.Y1 - CopyDamage.Y0, xsize - width);
+  memset(&CopyDamage, 0, sizeof(CopyDamage));
+}
+
+/**
+  * @brief  Records drawing for the present and the copy into the other buffer.
+  * @param  LayerIndex: layer drawn to
+  * @param  Xpos: the X position
+  * @param  Ypos: the Y position
+  * @param  Width: area width
+  * @param  Height: area height
+  * @retval None
+  */
+static void MarkDrawn(uint32_t LayerIndex, uint32_t Xpos, uint32_t Ypos, uint32_t Width, uint32_t Height)
+{
+  uint32_t xsize = LCD_GetXSize();
+  uint32_t ysize = LCD_GetYSize();
+
+  FrameDrawn = 1;
+  if(!DoubleBuffered || (LayerIndex != DoubleBufferLayer) || !TrackDamage)
+  {
+    return;
+  }
+  /* The damage is copied with a line offset of xsize - width, it must not
+     reach past the screen */
+  if((Xpos >= xsize) || (Ypos >= ysize) || (Width == 0) || (Height == 0))
+  {
+    return;
+  }
+  if(Width > xsize - Xpos)
+  {
+    Width = xsize - Xpos;
+  }
+  if(Height > ysize - Ypos)
+  {
+    Height = ysize - Ypos;
+  }
+
+  if(FrameDamage.X0 >= FrameDamage.X1)
+  {
+    FrameDamage.X0 = Xpos;
+    FrameDamage.Y0 = Ypos;
+    FrameDamage.X1 = Xpos + Width;
+    FrameDamage.Y1 = Ypos + Height;
+    return;
+  }
+  if(Xpos < FrameDamage.X0)
+  {
+    FrameDamage.X0 = Xpos;
+  }
+  if(Ypos < FrameDamage.Y0)
+  {
+    FrameDamage.Y0 = Ypos;
+  }
+  if(Xpos + Width > FrameDamage.X1)
+  {
+    FrameDamage.X1 = Xpos + Width;
+  }
+  if(Ypos + Height > FrameDamage.Y1)
+  {
+    FrameDamage.Y1 = Ypos + Height;
+  }
+}
+
+/**
+  * @brief  MarkDrawn() for an address, only drawing into the back buffer is
+  *         recorded as damage.
+  * @param  LayerIndex: layer drawn to
+  * @param  Address: address of the first pixel
+  * @param  Width: area width
+  * @param  Height: area height
+  * @retval None
+  */
+static void MarkDrawnAt(uint32_t LayerIndex, uint32_t Address, uint32_t Width, uint32_t Height)
+{
+  uint32_t back, offset;
+
+  if(DoubleBuffered && (LayerIndex == DoubleBufferLayer))
+  {
+    back = FrameBuffers[FrontBuffer ^ 1];
+    offset = (Address - back) / PixelOps[LayerIndex]->BytesPerPixel;
+    if((Address < back) || (offset >= LCD_GetXSize() * LCD_GetYSize()))
+    {
+      FrameDrawn = 1;
+      return;
+    }
+    MarkDrawn(LayerIndex, offset % LCD_GetXSize(), offset / LCD_GetXSize(), Width, Height);
+    return;
+  }
+  FrameDrawn = 1;
+}
+
+/**
+  * @brief  Queues a DMA2D operation, started at once if the DMA2D is idle.
+  *         Waits while the queue is full. Called from thread context only.
+  * @param  Op: register values of the operation
+  * @retval Fence of the operation
+  */
+static uint32_t Dma2dSubmit(const LCD_Dma2dOpTypeDef *Op)
+{
+  uint32_t fence, primask;
+
+  while((Dma2dSubmitted - Dma2dCompleted) >= DMA2D_QUEUE_SIZE)
+  {
+  }
+  fence = Dma2dSubmitted + 1;
+  Dma2dQueue[fence % DMA2D_QUEUE_SIZE] = *Op;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  Dma2dSubmitted = fence;
+  if(!Dma2dRunning)
+  {
+    Dma2dStart(fence);
+  }
+  __set_PRIMASK(primask);
+
+  return fence;
+}
+
+/**
+  * @brief  Loads a queued operation into the DMA2D and starts it.
+  * @param  Fence: fence of the operation
+  * @retval None
+  */
+static void Dma2dStart(uint32_t Fence)
+{
+  const LCD_Dma2dOpTypeDef *op = &Dma2dQueue[Fence % DMA2D_QUEUE_SIZE];
+
+  DMA2D->CR      = op->CR;
+  DMA2D->FGMAR   = op->FGMAR;
+  DMA2D->FGOR    = op->FGOR;
+  DMA2D->FGPFCCR = op->FGPFCCR;
+  DMA2D->FGCOLR  = op->FGCOLR;
+  DMA2D->BGMAR   = op->BGMAR;
+  DMA2D->BGOR    = op->BGOR;
+  DMA2D->BGPFCCR = op->BGPFCCR;
+  DMA2D->OPFCCR  = op->OPFCCR;
+  DMA2D->OCOLR   = op->OCOLR;
+  DMA2D->OMAR    = op->OMAR;
+  DMA2D->OOR     = op->OOR;
+  DMA2D->NLR     = op->NLR;
+  Dma2dRunning = 1;
+  DMA2D->CR      = op->CR | DMA2D_CR_IT | DMA2D_CR_START;
+}
+
+/**
+  * @brief  Gets the fence of the last DMA2D operation queued. Everything
+  *         drawn so far is in the frame buffer once it is done.
+  * @retval Fence
+  */
+uint32_t LCD_GetFence(void)
+{
+  return Dma2dSubmitted;
+}
+
+/**
+  * @brief  Checks if a DMA2D operation and all queued before it are done.
+  * @param  Fence: fence of LCD_GetFence()
+  * @retval 1 if done
+  */
+uint8_t LCD_IsFenceDone(uint32_t Fence)
+{
+  /* Difference instead of compare, the counters wrap around */
+  return ((int32_t)(Dma2dCompleted - Fence) >= 0) ? 1 : 0;
+}
+
+/**
+  * @brief  Waits for a DMA2D operation and all queued before it.
+  * @param  Fence: fence of LCD_GetFence()
+  * @retval None
+  */
+void LCD_WaitFence(uint32_t Fence)
+{
+  while(!LCD_IsFenceDone(Fence))
+  {
+  }
+}
+
+/**
+  * @brief  DMA2D interrupt, an operation is done. Starts the next one and
+  *         a present waiting for the frame. An operation with a transfer or
+  *         configuration error is dropped, the queue goes on.
+  * @retval None
+  */
+void DMA2D_IRQHandler(void)
+{
+  uint32_t isr = DMA2D->ISR;
+
+  DMA2D->IFCR = isr;
+  if(!(isr & DMA2D_ISR_DONE))
+  {
+    return;
+  }
+
+  Dma2dCompleted++;
+  if(Dma2dCompleted != Dma2dSubmitted)
+  {
+    Dma2dStart(Dma2dCompleted + 1);
+  }
+  else
+  {
+    Dma2dRunning = 0;
+  }
+
+  if((SwapState == SWAP_RENDERING) && LCD_IsFenceDone(PresentFence))
+  {
+    StartSwap();
+  }
 }
 
 /**
@@ -1555,7 +2435,7 @@ int fputc(int ch, FILE *f)
 	}
 
 
-	LCD_DisplayChar(COLUMN(Column), LINE(Line), ch);
+	GridPutChar(Line, Column, ch);
 
 
 	if( Column >= MAX_COLUMN &&	Line < MAX_LINE )
@@ -1571,6 +2451,378 @@ int fputc(int ch, FILE *f)
 	return (0);
 }
 
+/**
+  * @brief  Draws the cells of the text grid that changed since the last call.
+  *         Cells are drawn font by font, so the glyph atlas is built at most
+  *         once per font and call. With double buffering a change is drawn
+  *         into each buffer once, nothing is drawn while a present is pending.
+  * @retval number of cells drawn
+  */
+uint32_t LCD_FlushText(void)
+{
+  sFONT *font = DrawProp[ActiveLayer].pFont;
+  uint32_t textcolor = DrawProp[ActiveLayer].TextColor;
+  uint32_t backcolor = DrawProp[ActiveLayer].BackColor;
+  LCD_CellTypeDef *cell;
+  uint32_t f, ln, col, drawn = 0;
+  uint8_t back;
+
+  /* The back buffer is still drawn or waits for the vertical blanking, draw next time */
+  if(SwapState != SWAP_IDLE)
+  {
+    return 0;
+  }
+  back = 1 << (DoubleBuffered ? (FrontBuffer ^ 1) : 0);
+  /* Each buffer gets its cells from its dirty bit, no copy */
+  TrackDamage = 0;
+
+  for(f = 0; f < GridFontCount; f++)
+  {
+    DrawProp[ActiveLayer].pFont = GridFont[f];
+    for(ln = 0; ln < GRID_LINES; ln++)
+    {
+      if(!(GridLineDirty[ln] & back))
+      {
+        continue;
+      }
+      for(col = 0; col < GRID_COLUMNS; col++)
+      {
+        cell = &Grid[ln][col];
+        if((cell->Dirty & back) && (cell->Font == f))
+        {
+          DrawProp[ActiveLayer].TextColor = GridColor[cell->Colors >> 4];
+          DrawProp[ActiveLayer].BackColor = GridColor[cell->Colors & 0x0F];
+          LCD_DisplayChar(col * GridFont[f]->Width, ln * GridFont[f]->Height, cell->Ascii);
+          cell->Dirty &= ~back;
+          drawn++;
+        }
+      }
+    }
+  }
+  for(ln = 0; ln < GRID_LINES; ln++)
+  {
+    GridLineDirty[ln] &= ~back;
+  }
+
+  DrawProp[ActiveLayer].pFont = font;
+  DrawProp[ActiveLayer].TextColor = textcolor;
+  DrawProp[ActiveLayer].BackColor = backcolor;
+  TrackDamage = 1;
+
+  return drawn;
+}
+
+/**
+  * @brief  Index of a color in the grid color table, added if new.
+  * @retval index, -1 if the table is full
+  */
+static int GridColorIndex(uint32_t Color)
+{
+  int i;
+
+  for(i = 0; i < GridColorCount; i++)
+  {
+    if(GridColor[i] == Color)
+    {
+      return i;
+    }
+  }
+  if(GridColorCount == GRID_COLORS)
+  {
+    return -1;
+  }
+  GridColor[GridColorCount] = Color;
+  return GridColorCount++;
+}
+
+/**
+  * @brief  Index of a font in the grid font table, added if new.
+  * @retval index, -1 if the table is full
+  */
+static int GridFontIndex(sFONT *pFont)
+{
+  int i;
+
+  for(i = 0; i < GridFontCount; i++)
+  {
+    if(GridFont[i] == pFont)
+    {
+      return i;
+    }
+  }
+  if(GridFontCount == GRID_FONTS)
+  {
+    return -1;
+  }
+  GridFont[GridFontCount] = pFont;
+  return GridFontCount++;
+}
+
+/**
+  * @brief  Stores a printed character in the text grid, the cell is only
+  *         marked dirty if character, font or colors differ.
+  * @param  Ln: line in the raster of the current font
+  * @param  Col: column in the raster of the current font
+  * @param  Ascii: character ascii code
+  */
+static void GridPutChar(uint32_t Ln, uint32_t Col, uint8_t Ascii)
+{
+  LCD_CellTypeDef *cell;
+  int font, text, back;
+  uint8_t colors;
+
+  if((Ln >= GRID_LINES) || (Col >= GRID_COLUMNS))
+  {
+    LCD_DisplayChar(COLUMN(Col), LINE(Ln), Ascii);
+    return;
+  }
+
+  cell = &Grid[Ln][Col];
+  font = GridFontIndex(DrawProp[ActiveLayer].pFont);
+  text = GridColorIndex(DrawProp[ActiveLayer].TextColor);
+  back = GridColorIndex(DrawProp[ActiveLayer].BackColor);
+  if((font < 0) || (text < 0) || (back < 0))
+  {
+    /* Out of table space, draw now and forget the cell */
+    LCD_DisplayChar(COLUMN(Col), LINE(Ln), Ascii);
+    cell->Ascii = GRID_UNKNOWN;
+    cell->Dirty = 0;
+    return;
+  }
+
+  colors = (uint8_t)((text << 4) | back);
+  if((cell->Ascii == Ascii) && (cell->Font == font) && (cell->Colors == colors))
+  {
+    return;
+  }
+  cell->Ascii = Ascii;
+  cell->Font = (uint8_t)font;
+  cell->Colors = colors;
+  cell->Dirty = DoubleBuffered ? 0x03 : 0x01;
+  GridLineDirty[Ln] |= cell->Dirty;
+}
+
+/**
+  * @brief  Enables or disables double buffering of a layer. The drawing
+  *         functions then write to the back buffer, LCD_Present() shows it
+  *         at the next vertical blanking. The back buffer starts as a copy
+  *         of the frame buffer shown.
+  * @param  LayerIndex: the layer foreground or background
+  * @param  BackBuffer: address of the second frame buffer, 0 to disable
+  * @retval None
+  */
+void LCD_SetDoubleBuffer(uint32_t LayerIndex, uint32_t BackBuffer)
+{
+  uint32_t ln, col;
+  uint8_t front;
+
+  /* The buffers must not change under a pending swap */
+  while(SwapState != SWAP_IDLE)
+  {
+  }
+
+  if(DoubleBuffered)
+  {
+    __HAL_LTDC_DISABLE_IT(&LtdcHandler, LTDC_IT_LI);
+    HAL_NVIC_DisableIRQ(LTDC_IRQn);
+    DrawAddress[DoubleBufferLayer] = FrameBuffers[FrontBuffer];
+    DoubleBuffered = 0;
+
+    /* Keep what is still to draw into the buffer shown, as bit 0 */
+    front = 1 << FrontBuffer;
+    for(ln = 0; ln < GRID_LINES; ln++)
+    {
+      for(col = 0; col < GRID_COLUMNS; col++)
+      {
+        Grid[ln][col].Dirty = (Grid[ln][col].Dirty & front) ? 0x01 : 0x00;
+      }
+      GridLineDirty[ln] = (GridLineDirty[ln] & front) ? 0x01 : 0x00;
+    }
+    FrontBuffer = 0;
+  }
+  if(BackBuffer == 0)
+  {
+    return;
+  }
+
+  DoubleBufferLayer = LayerIndex;
+  FrameBuffers[0] = LtdcHandler.LayerCfg[LayerIndex].FBStartAdress;
+  FrameBuffers[1] = BackBuffer;
+  FrontBuffer = 0;
+  CopyBuffer(LayerIndex, (void *)FrameBuffers[0], (void *)FrameBuffers[1], LCD_GetXSize(), LCD_GetYSize(), 0);
+  DrawAddress[LayerIndex] = BackBuffer;
+  memset(&FrameDamage, 0, sizeof(FrameDamage));
+  memset(&CopyDamage, 0, sizeof(CopyDamage));
+
+  /* Cells not drawn yet are missing in both buffers */
+  for(ln = 0; ln < GRID_LINES; ln++)
+  {
+    for(col = 0; col < GRID_COLUMNS; col++)
+    {
+      if(Grid[ln][col].Dirty)
+      {
+        Grid[ln][col].Dirty = 0x03;
+      }
+    }
+    if(GridLineDirty[ln])
+    {
+      GridLineDirty[ln] = 0x03;
+    }
+  }
+  memset(&PresentStats, 0, sizeof(PresentStats));
+  FrameDrawn = 0;
+  DoubleBuffered = 1;
+
+  /* Cycle counter for the present latency */
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  /* One line interrupt per frame, in the vertical blanking */
+  HAL_LTDC_ProgramLineEvent(&LtdcHandler, VBLANK_LINE);
+  HAL_NVIC_SetPriority(LTDC_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(LTDC_IRQn);
+}
+
+/**
+  * @brief  Shows the back buffer from the next vertical blanking on. Nothing
+  *         to do if nothing has been drawn since the last present. Does not
+  *         wait for the DMA2D, the swap is requested when the operations
+  *         queued so far are done.
+  * @retval LCD_OK, LCD_ERROR if the last present is still pending
+  */
+uint8_t LCD_Present(void)
+{
+  uint32_t primask;
+
+  if(!DoubleBuffered || !FrameDrawn)
+  {
+    return LCD_OK;
+  }
+  if(SwapState != SWAP_IDLE)
+  {
+    return LCD_ERROR;
+  }
+  /* Normally done by the first drawing after the last swap */
+  if(CopyDamage.X0 < CopyDamage.X1)
+  {
+    UpdateBackBuffer();
+  }
+  /* The new back buffer misses what has been drawn into this frame */
+  CopyDamage = FrameDamage;
+  memset(&FrameDamage, 0, sizeof(FrameDamage));
+
+  FrameDrawn = 0;
+  PresentCycles = DWT->CYCCNT;
+  PresentFence = Dma2dSubmitted;
+
+  /* The DMA2D interrupt must not finish the frame in between */
+  primask = __get_PRIMASK();
+  __disable_irq();
+  if(LCD_IsFenceDone(PresentFence))
+  {
+    StartSwap();
+  }
+  else
+  {
+    SwapState = SWAP_RENDERING;
+  }
+  __set_PRIMASK(primask);
+
+  return LCD_OK;
+}
+
+/**
+  * @brief  Requests the reload of the back buffer address at the next
+  *         vertical blanking.
+  * @retval None
+  */
+static void StartSwap(void)
+{
+  uint32_t address = FrameBuffers[FrontBuffer ^ 1];
+
+  /* Registers instead of LCD_SetLayerAddress_NoReload(), this runs in the
+     DMA2D interrupt as well where the HAL lock may be taken */
+  LTDC_LAYER(&LtdcHandler, DoubleBufferLayer)->CFBAR = address;
+  LtdcHandler.LayerCfg[DoubleBufferLayer].FBStartAdress = address;
+  /* Not LCD_Relaod(), that enables the reload interrupt as well */
+  LtdcHandler.Instance->SRCR = LTDC_RELOAD_VERTICAL_BLANKING;
+  SwapState = SWAP_VBLANK;
+}
+
+/**
+  * @brief  Checks for a present waiting for the vertical blanking, the
+  *         back buffer must not be drawn to until it is done.
+  * @retval 1 if pending
+  */
+uint8_t LCD_IsPresentPending(void)
+{
+  return (SwapState != SWAP_IDLE) ? 1 : 0;
+}
+
+/**
+  * @brief  Gets the frame statistics of double buffering.
+  * @param  Stats: filled with the counters since LCD_SetDoubleBuffer()
+  * @retval None
+  */
+void LCD_GetPresentStats(LCD_PresentStatsTypeDef *Stats)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  *Stats = PresentStats;
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief  LTDC interrupt, the line event is the vertical blanking.
+  * @retval None
+  */
+void LTDC_IRQHandler(void)
+{
+  HAL_LTDC_IRQHandler(&LtdcHandler);
+}
+
+/**
+  * @brief  Line event, once per frame in the vertical blanking. The reload
+  *         requested by LCD_Present() happens at the start of the blanking,
+  *         the swap is done when the LTDC has cleared the request.
+  * @param  hltdc: LTDC handle
+  * @retval None
+  */
+void HAL_LTDC_LineEventCallback(LTDC_HandleTypeDef *hltdc)
+{
+  uint32_t latency;
+
+  PresentStats.Vblanks++;
+  if(SwapState == SWAP_VBLANK)
+  {
+    if(!(hltdc->Instance->SRCR & LTDC_SRCR_VBR))
+    {
+      /* The old front buffer is the new back buffer */
+      FrontBuffer ^= 1;
+      DrawAddress[DoubleBufferLayer] = FrameBuffers[FrontBuffer ^ 1];
+      SwapState = SWAP_IDLE;
+
+      latency = (DWT->CYCCNT - PresentCycles) / (SystemCoreClock / 1000000);
+      PresentStats.Presented++;
+      PresentStats.LatencyUs = latency;
+      if(latency > PresentStats.LatencyMaxUs)
+      {
+        PresentStats.LatencyMaxUs = latency;
+      }
+    }
+  }
+  else if((SwapState == SWAP_RENDERING) || FrameDrawn)
+  {
+    /* A newer frame has been drawn but not presented or not finished by
+       the DMA2D, the old one is shown again */
+    PresentStats.Dropped++;
+  }
+
+  /* The HAL disables the line interrupt after every event */
+  __HAL_LTDC_ENABLE_IT(hltdc, LTDC_IT_LI);
+}
+
 
 /**
   * @}
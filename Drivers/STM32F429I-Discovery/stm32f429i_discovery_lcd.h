@@ -94,6 +94,18 @@ typedef enum
   RIGHT_MODE              = 0x02,    /* right mode  */     
   LEFT_MODE               = 0x03,    /* left mode   */                                                                               
 }Text_AlignModeTypdef;
+
+/** 
+  * @brief  Frame statistics of double buffering, see LCD_GetPresentStats()
+  */ 
+typedef struct
+{
+  uint32_t Vblanks;        /* vertical blanking periods */
+  uint32_t Presented;      /* frames swapped in */
+  uint32_t Dropped;        /* blankings that showed the old frame while a newer one was drawn */
+  uint32_t LatencyUs;      /* LCD_Present() to the swap, last frame */
+  uint32_t LatencyMaxUs;
+}LCD_PresentStatsTypeDef;
 /**
   * @}
   */ 
@@ -112,6 +124,7 @@ typedef enum
 #define LCD_FRAME_BUFFER_LAYER0                  (LCD_FRAME_BUFFER+0x130000)
 #define LCD_FRAME_BUFFER_LAYER1                  LCD_FRAME_BUFFER
 #define CONVERTED_FRAME_BUFFER                   (LCD_FRAME_BUFFER+0x260000)
+#define LCD_BACK_BUFFER_LAYER0                   (LCD_FRAME_BUFFER+0x390000)
 
 
 /** 
@@ -191,6 +204,7 @@ uint32_t LCD_GetYSize(void);
 
 /* functions using the LTDC controller */
 void     LCD_LayerDefaultInit(uint16_t LayerIndex, uint32_t FrameBuffer);
+uint8_t  LCD_LayerInit(uint16_t LayerIndex, uint32_t FrameBuffer, uint32_t PixelFormat);
 void     LCD_SetTransparency(uint32_t LayerIndex, uint8_t Transparency);
 void     LCD_SetTransparency_NoReload(uint32_t LayerIndex, uint8_t Transparency);
 void     LCD_SetLayerAddress(uint32_t LayerIndex, uint32_t Address);
@@ -246,6 +260,16 @@ void    LCD_MspInit(void);
 
 void LCD_SetColors(uint32_t TextColor, uint32_t BackColor);
 void LCD_SetPrintPosition(unsigned int ln, unsigned int col);
+uint32_t LCD_FlushText(void);
+
+void     LCD_SetDoubleBuffer(uint32_t LayerIndex, uint32_t BackBuffer);
+uint8_t  LCD_Present(void);
+uint8_t  LCD_IsPresentPending(void);
+void     LCD_GetPresentStats(LCD_PresentStatsTypeDef *Stats);
+
+uint32_t LCD_GetFence(void);
+uint8_t  LCD_IsFenceDone(uint32_t Fence);
+void     LCD_WaitFence(uint32_t Fence);
 
 /**
   * @}
@@ -0,0 +1,61 @@
+#ifndef CANVBUS_H
+#define CANVBUS_H
+
+#include <stdint.h>
+
+#include "can.h"
+#include "canring.h"
+#include "cantransport.h"
+#include "cantxqueue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_VBUS_MAX_NODES	8
+
+typedef struct CanVBus CanVBus;
+
+/**
+ * Node on the virtual bus, the transport member has to stay first so a
+ * node can be passed wherever a CanTransport is expected
+ */
+typedef struct {
+	CanTransport  transport;
+	CanVBus      *bus;
+	CanOpMode     mode;
+	CanTxQueue    txQueue;
+	CanRing       rxRing;
+	CanTxCallback txCallback;
+	uint32_t      txFrames;			// frames that won arbitration and were sent
+	uint32_t      rxFrames;			// frames stored in rxRing
+	uint32_t      arbitrationLost;	// times a pending frame lost against another node
+	uint32_t      ackErrors;		// frames nobody acknowledged (retransmitted)
+} CanVBusNode;
+
+/**
+ * In-process CAN bus with virtual time
+ */
+struct CanVBus {
+	uint64_t     nowNs;
+	uint64_t     busyUntilNs;
+	uint32_t     bitrate;
+	uint32_t     idleStepNs;		// virtual time that passes per idle() call of a node
+	CanVBusNode *nodes[CAN_VBUS_MAX_NODES];
+	uint32_t     numNodes;
+	int          busy;
+	CanMsg       current;			// frame on the wire while busy
+	CanVBusNode *sender;
+	uint64_t     busyNs;			// total time the bus carried frames
+};
+
+void canVBusInit(CanVBus *bus, uint32_t bitrate);
+int canVBusAttach(CanVBus *bus, CanVBusNode *node, CanOpMode mode);
+void canVBusRun(CanVBus *bus, uint32_t us);
+uint32_t canVBusTimeUs(const CanVBus *bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANVBUS_H
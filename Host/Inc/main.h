@@ -0,0 +1,13 @@
+#ifndef MAIN_H
+#define MAIN_H
+
+/*
+ * Host replacement of main.h for the 1-Wire simulator, the drivers only
+ * need the device header and the timer prescaler of owsim.cpp.
+ */
+
+#include "stm32f4xx.h"
+
+extern "C" uint32_t APB1_TimerPrescaler(uint32_t tickHz);
+
+#endif // MAIN_H
@@ -0,0 +1,79 @@
+#ifndef OWSIM_H
+#define OWSIM_H
+
+#include <stdint.h>
+
+#include "stm32f4xx.h"
+
+#define OWSIM_MAX_LINES		5
+#define OWSIM_MAX_DEVICES	16		// per line
+
+/**
+ * Timing of a simulated device, all times in ns. The datasheet allows
+ * a range for each of them, see owSimDeviceTiming().
+ */
+typedef struct {
+	uint32_t presenceDelayNs;	// release after reset to presence pulse, 15..60 us
+	uint32_t presenceLowNs;		// presence pulse, 60..240 us
+	uint32_t sampleNs;			// falling edge to sample point of a write slot, 15..60 us
+	uint32_t holdNs;			// low time of a 0 bit sent by the device, 15..60 us
+} OwSimTiming;
+
+/**
+ * Simulated DS18B20 on a 1-Wire line
+ */
+typedef struct {
+	uint8_t  rom[8];			// family, serial, CRC
+	int16_t  temperature;		// 1/16 °C, result of the next conversion
+	OwSimTiming timing;
+
+	uint8_t  scratchpad[9];
+	uint8_t  eeprom[3];			// TH, TL, configuration
+	uint8_t  mode;				// see owsim.cpp
+	uint8_t  command;
+	uint8_t  io[9];				// bytes received or to send
+	uint16_t ioBits;			// bits to transfer
+	uint16_t ioPos;				// bits transferred
+	uint8_t  searchStep;
+	uint8_t  conversionPending;
+	uint64_t busyUntilNs;		// conversion or EEPROM copy
+	uint64_t sampleAtNs;		// pending sample point of a write slot, 0 = none
+	uint64_t lowFromNs;			// the device pulls the line low in [lowFromNs, lowUntilNs)
+	uint64_t lowUntilNs;
+} OwSimDevice;
+
+/**
+ * Violations of the datasheet timing seen on one line. The margins are
+ * the smallest distance to the limit seen, negative = violated.
+ */
+typedef struct {
+	uint32_t resets;
+	uint32_t slots;
+	uint32_t resetShort;		// reset pulse < 480 us
+	uint32_t lowTooShort;		// slot low time < 1 us
+	uint32_t lowAmbiguous;		// slot low time 15..60 us, neither 1 nor 0
+	uint32_t low0TooLong;		// 0 slot low time > 120 us
+	uint32_t slotTooShort;		// falling edge to falling edge < 60 us
+	uint32_t recoveryTooShort;	// release to next falling edge < 1 us
+	uint32_t sampleLate;		// read slot sampled more than 15 us after the falling edge
+	uint32_t presenceOutside;	// presence sampled outside of 60..75 us after release
+	int32_t  resetMarginNs;
+	int32_t  low1MarginNs;		// to 15 us
+	int32_t  low0MarginNs;		// to 60 us and 120 us
+	int32_t  slotMarginNs;
+	int32_t  recoveryMarginNs;
+	int32_t  sampleMarginNs;	// to 15 us
+	int32_t  presenceMarginNs;	// to 60 us and 75 us
+} OwSimReport;
+
+void owSimInit(uint32_t accessNs, uint32_t irqLatencyNs);
+int owSimAddLine(GPIO_TypeDef *port, uint16_t pin);
+void owSimDeviceInit(OwSimDevice *dev, uint8_t family, uint32_t serial, int16_t temperature);
+void owSimDeviceTiming(OwSimDevice *dev, int worstCase);
+int owSimAttach(int line, OwSimDevice *dev);
+uint64_t owSimTimeNs(void);
+void owSimGetReport(int line, OwSimReport *report);
+void owSimClearReport(void);
+uint32_t owSimViolations(const OwSimReport *report);
+
+#endif // OWSIM_H
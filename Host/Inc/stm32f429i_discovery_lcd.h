@@ -0,0 +1,19 @@
+#ifndef STM32F429I_DISCOVERY_LCD_H
+#define STM32F429I_DISCOVERY_LCD_H
+
+/*
+ * Host replacement of the display driver header. Text output of the
+ * shared code goes to stdout, positioning is ignored.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void LCD_SetPrintPosition(unsigned int ln, unsigned int col);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STM32F429I_DISCOVERY_LCD_H
@@ -0,0 +1,168 @@
+#ifndef STM32F4XX_H
+#define STM32F4XX_H
+
+/*
+ * Host replacement of the device header for the 1-Wire simulator
+ * (owsim.h). Only the parts used by the 1-Wire drivers exist.
+ *
+ * The registers are objects: every access is passed to the simulator,
+ * which advances the virtual time, updates the lines and runs the TIM3
+ * and TIM4 interrupts when they are due. The driver sources are compiled as C++ for
+ * that, they are not changed.
+ */
+
+#ifndef __cplusplus
+#error "the 1-Wire simulator needs the driver sources compiled as C++"
+#endif
+
+#include <stdint.h>
+
+enum OwSimRegister {
+	OWSIM_GPIO_IDR,
+	OWSIM_GPIO_ODR,
+	OWSIM_GPIO_BSRR,
+	OWSIM_TIM_CNT,
+	OWSIM_TIM_CCR1,
+	OWSIM_TIM_SR,
+	OWSIM_TIM_DIER
+};
+
+extern "C" uint32_t owSimRead(const void *reg, int id);
+extern "C" void owSimWrite(void *reg, int id, uint32_t value);
+
+/**
+ * Peripheral register, reads and writes go to the simulator
+ */
+template <int ID>
+class OwSimReg {
+public:
+	operator uint32_t() const {
+		return owSimRead(this, ID);
+	}
+	OwSimReg &operator=(uint32_t v) {
+		owSimWrite(this, ID, v);
+		return *this;
+	}
+	OwSimReg &operator|=(uint32_t v) {
+		return *this = (uint32_t)*this | v;
+	}
+	OwSimReg &operator&=(uint32_t v) {
+		return *this = (uint32_t)*this & v;
+	}
+
+	uint32_t value;		// register content, kept by the simulator
+};
+
+typedef struct {
+	OwSimReg<OWSIM_GPIO_IDR>  IDR;
+	OwSimReg<OWSIM_GPIO_ODR>  ODR;
+	OwSimReg<OWSIM_GPIO_BSRR> BSRR;
+} GPIO_TypeDef;
+
+typedef struct {
+	OwSimReg<OWSIM_TIM_CNT>  CNT;
+	OwSimReg<OWSIM_TIM_CCR1> CCR1;
+	OwSimReg<OWSIM_TIM_SR>   SR;
+	OwSimReg<OWSIM_TIM_DIER> DIER;
+	uint32_t prescaler;		// set by HAL_TIM_Base_Init
+} TIM_TypeDef;
+
+extern GPIO_TypeDef owSimGpio[11];
+extern TIM_TypeDef owSimTim3;
+extern TIM_TypeDef owSimTim4;
+
+#define GPIOA	(&owSimGpio[0])
+#define GPIOB	(&owSimGpio[1])
+#define GPIOC	(&owSimGpio[2])
+#define GPIOD	(&owSimGpio[3])
+#define GPIOE	(&owSimGpio[4])
+#define GPIOF	(&owSimGpio[5])
+#define GPIOG	(&owSimGpio[6])
+#define GPIOH	(&owSimGpio[7])
+#define GPIOI	(&owSimGpio[8])
+#define GPIOJ	(&owSimGpio[9])
+#define GPIOK	(&owSimGpio[10])
+#define TIM3	(&owSimTim3)
+#define TIM4	(&owSimTim4)
+
+#define TIM_SR_CC1IF		0x0002u
+#define TIM_DIER_CC1IE		0x0002u
+
+typedef enum {
+	TIM3_IRQn = 29,
+	TIM4_IRQn = 30
+} IRQn_Type;
+
+/* HAL subset ----------------------------------------------------------------*/
+typedef enum {
+	HAL_OK,
+	HAL_ERROR
+} HAL_StatusTypeDef;
+
+typedef struct {
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Pull;
+	uint32_t Speed;
+	uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+typedef struct {
+	uint32_t Prescaler;
+	uint32_t CounterMode;
+	uint32_t Period;
+	uint32_t ClockDivision;
+	uint32_t RepetitionCounter;
+	uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct {
+	TIM_TypeDef *Instance;
+	TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+#define GPIO_PIN_0		0x0001u
+#define GPIO_PIN_1		0x0002u
+#define GPIO_PIN_2		0x0004u
+#define GPIO_PIN_3		0x0008u
+#define GPIO_PIN_4		0x0010u
+#define GPIO_PIN_5		0x0020u
+#define GPIO_PIN_6		0x0040u
+#define GPIO_PIN_7		0x0080u
+#define GPIO_PIN_8		0x0100u
+#define GPIO_PIN_9		0x0200u
+#define GPIO_PIN_10		0x0400u
+#define GPIO_PIN_11		0x0800u
+#define GPIO_PIN_12		0x1000u
+#define GPIO_PIN_13		0x2000u
+#define GPIO_PIN_14		0x4000u
+#define GPIO_PIN_15		0x8000u
+
+#define GPIO_MODE_OUTPUT_OD				0x11u
+#define GPIO_PULLUP						0x01u
+#define GPIO_SPEED_FREQ_VERY_HIGH		0x03u
+#define TIM_AUTORELOAD_PRELOAD_DISABLE	0x00u
+#define TIM_CLOCKDIVISION_DIV1			0x00u
+#define TIM_COUNTERMODE_UP				0x00u
+
+#define __HAL_RCC_GPIOG_CLK_ENABLE()	do { } while (0)
+#define __HAL_RCC_TIM3_CLK_ENABLE()		do { } while (0)
+#define __HAL_RCC_TIM4_CLK_ENABLE()		do { } while (0)
+
+extern "C" {
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub);
+void HAL_NVIC_EnableIRQ(IRQn_Type irq);
+uint32_t HAL_GetTick(void);
+
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __disable_irq(void);
+void __enable_irq(void);
+void __WFI(void);
+}
+
+#endif // STM32F4XX_H
@@ -0,0 +1,31 @@
+/**
+ ******************************************************************************
+ * @file           : canhost.c
+ * @brief          : Host implementations of target functions
+ ******************************************************************************
+ * Functions the shared CAN code calls that are implemented by can.c and
+ * the display driver on the target.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+
+#include "can.h"
+#include "cantransport.h"
+#include "stm32f429i_discovery_lcd.h"
+
+/**
+ * CAN timebase, taken from the default transport
+ */
+uint32_t canGetTimeUs(void) {
+	CanTransport *t = canTransportGet();
+
+	return (t != NULL) ? t->timeUs(t) : 0;
+}
+
+/**
+ * There is no display, output goes to stdout as is
+ */
+void LCD_SetPrintPosition(unsigned int ln, unsigned int col) {
+}
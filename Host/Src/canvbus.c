@@ -0,0 +1,251 @@
+/**
+ ******************************************************************************
+ * @file           : canvbus.c
+ * @brief          : Host side virtual CAN bus
+ ******************************************************************************
+ * Any number of nodes in one process share a bus with virtual time.
+ * Whenever the bus is idle, the pending frames of all nodes arbitrate and
+ * the lowest arbitration key wins, just like on the wire. A frame occupies
+ * the bus for its exact stuffed length at the configured bitrate, then it
+ * is delivered to the other nodes (and to the sender in loopback modes)
+ * with the end-of-frame time as timestamp.
+ *
+ * Simplifications: every node has an unlimited number of "mailboxes"
+ * (its whole TX queue arbitrates), there are no error frames, and silent
+ * nodes do not acknowledge. A frame without acknowledge is retransmitted.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <string.h>
+
+#include "canvbus.h"
+#include "canbittiming.h"
+
+/* Private define ------------------------------------------------------------*/
+#define DEFAULT_IDLE_STEP_NS	1000
+
+/* Private function prototypes -----------------------------------------------*/
+static void advanceTo(CanVBus *bus, uint64_t targetNs);
+static void startFrame(CanVBus *bus);
+static void completeFrame(CanVBus *bus);
+static int isLoopback(CanOpMode mode);
+static int isSilent(CanOpMode mode);
+static int nodeTransmit(CanTransport *self, const CanMsg *msg);
+static int nodeReceive(CanTransport *self, CanMsg *msg);
+static uint32_t nodeTxFree(CanTransport *self);
+static uint32_t nodeTimeUs(CanTransport *self);
+static void nodeIdle(CanTransport *self);
+static uint32_t nodeBitrate(CanTransport *self);
+static int nodeSetMode(CanTransport *self, CanOpMode mode);
+static CanOpMode nodeGetMode(CanTransport *self);
+static void nodeSetTxCallback(CanTransport *self, CanTxCallback callback);
+
+/**
+ * Initialize an empty bus
+ * @param bus bus to initialize
+ * @param bitrate bitrate in bit/s used for the frame timing
+ */
+void canVBusInit(CanVBus *bus, uint32_t bitrate) {
+	memset(bus, 0, sizeof(*bus));
+	bus->bitrate = bitrate;
+	bus->idleStepNs = DEFAULT_IDLE_STEP_NS;
+}
+
+/**
+ * Connect a node to the bus
+ * @param bus target bus
+ * @param node node to initialize and attach
+ * @param mode initial operating mode
+ * @return 1 on success, 0 if the bus is full
+ */
+int canVBusAttach(CanVBus *bus, CanVBusNode *node, CanOpMode mode) {
+	if (bus->numNodes >= CAN_VBUS_MAX_NODES) {
+		return 0;
+	}
+	memset(node, 0, sizeof(*node));
+	node->transport.transmit = nodeTransmit;
+	node->transport.receive = nodeReceive;
+	node->transport.txFree = nodeTxFree;
+	node->transport.timeUs = nodeTimeUs;
+	node->transport.idle = nodeIdle;
+	node->transport.bitrate = nodeBitrate;
+	node->transport.setMode = nodeSetMode;
+	node->transport.getMode = nodeGetMode;
+	node->transport.setTxCallback = nodeSetTxCallback;
+	node->bus = bus;
+	node->mode = mode;
+	canTxQueueInit(&node->txQueue);
+	canRingInit(&node->rxRing);
+	bus->nodes[bus->numNodes++] = node;
+	return 1;
+}
+
+/**
+ * Let virtual time pass, frames are arbitrated, sent and delivered
+ * @param bus bus to run
+ * @param us time to advance
+ */
+void canVBusRun(CanVBus *bus, uint32_t us) {
+	advanceTo(bus, bus->nowNs + (uint64_t)us * 1000);
+}
+
+/**
+ * Current virtual time
+ */
+uint32_t canVBusTimeUs(const CanVBus *bus) {
+	return (uint32_t)(bus->nowNs / 1000);
+}
+
+/**
+ * Process all bus events up to targetNs
+ */
+static void advanceTo(CanVBus *bus, uint64_t targetNs) {
+	for (;;) {
+		if (bus->busy) {
+			if (bus->busyUntilNs > targetNs) {
+				break;
+			}
+			bus->nowNs = bus->busyUntilNs;
+			completeFrame(bus);
+		} else {
+			startFrame(bus);
+			if (!bus->busy) {
+				break;
+			}
+		}
+	}
+	bus->nowNs = targetNs;
+}
+
+/**
+ * Arbitration: the pending frame with the lowest key takes the bus
+ */
+static void startFrame(CanVBus *bus) {
+	CanVBusNode *winner = NULL;
+	uint32_t i;
+	uint32_t bits;
+
+	for (i = 0; i < bus->numNodes; i++) {
+		CanVBusNode *n = bus->nodes[i];
+
+		if (n->txQueue.count == 0) {
+			continue;
+		}
+		if (winner == NULL || n->txQueue.heap[0].key < winner->txQueue.heap[0].key) {
+			if (winner != NULL) {
+				winner->arbitrationLost++;
+			}
+			winner = n;
+		} else {
+			n->arbitrationLost++;
+		}
+	}
+	if (winner == NULL) {
+		return;
+	}
+
+	canTxQueuePop(&winner->txQueue, &bus->current);
+	bits = canFrameBits(bus->current.id, bus->current.ide, bus->current.rtr, bus->current.dlc, bus->current.data);
+	bus->sender = winner;
+	bus->busy = 1;
+	bus->busyUntilNs = bus->nowNs + ((uint64_t)bits * 1000000000ull) / bus->bitrate;
+	bus->busyNs += bus->busyUntilNs - bus->nowNs;
+}
+
+/**
+ * End of frame: acknowledge, deliver, notify sender
+ */
+static void completeFrame(CanVBus *bus) {
+	CanVBusNode *sender = bus->sender;
+	CanMsg msg = bus->current;
+	uint32_t timeUs = (uint32_t)(bus->nowNs / 1000);
+	int acked = isLoopback(sender->mode);
+	uint32_t i;
+
+	bus->busy = 0;
+
+	// silent loopback frames never reach the wire
+	for (i = 0; i < bus->numNodes && sender->mode != CAN_OPMODE_SILENT_LOOPBACK; i++) {
+		if (bus->nodes[i] != sender && !isSilent(bus->nodes[i]->mode)) {
+			acked = 1;
+		}
+	}
+	if (!acked) {
+		sender->ackErrors++;
+		canTxQueuePush(&sender->txQueue, &msg);		// automatic retransmission
+		return;
+	}
+
+	sender->txFrames++;
+	if (sender->txCallback != NULL) {
+		sender->txCallback(&msg, timeUs);
+	}
+
+	msg.timestamp = timeUs;
+	for (i = 0; i < bus->numNodes; i++) {
+		CanVBusNode *n = bus->nodes[i];
+
+		if (n == sender ? !isLoopback(n->mode) : sender->mode == CAN_OPMODE_SILENT_LOOPBACK) {
+			continue;
+		}
+		if (canRingPush(&n->rxRing, &msg)) {
+			n->rxFrames++;
+		}
+	}
+}
+
+static int isLoopback(CanOpMode mode) {
+	return mode == CAN_OPMODE_LOOPBACK || mode == CAN_OPMODE_SILENT_LOOPBACK;
+}
+
+static int isSilent(CanOpMode mode) {
+	return mode == CAN_OPMODE_SILENT || mode == CAN_OPMODE_SILENT_LOOPBACK;
+}
+
+/*
+ * Transport interface of a node
+ */
+static int nodeTransmit(CanTransport *self, const CanMsg *msg) {
+	CanVBusNode *node = (CanVBusNode *)self;
+	CanMsg txMsg = *msg;
+
+	txMsg.timestamp = canVBusTimeUs(node->bus);		// enqueue time
+	return canTxQueuePush(&node->txQueue, &txMsg);
+}
+
+static int nodeReceive(CanTransport *self, CanMsg *msg) {
+	return canRingPop(&((CanVBusNode *)self)->rxRing, msg);
+}
+
+static uint32_t nodeTxFree(CanTransport *self) {
+	return CAN_TX_QUEUE_SIZE - ((CanVBusNode *)self)->txQueue.count;
+}
+
+static uint32_t nodeTimeUs(CanTransport *self) {
+	return canVBusTimeUs(((CanVBusNode *)self)->bus);
+}
+
+static void nodeIdle(CanTransport *self) {
+	CanVBus *bus = ((CanVBusNode *)self)->bus;
+
+	advanceTo(bus, bus->nowNs + bus->idleStepNs);
+}
+
+static uint32_t nodeBitrate(CanTransport *self) {
+	return ((CanVBusNode *)self)->bus->bitrate;
+}
+
+static int nodeSetMode(CanTransport *self, CanOpMode mode) {
+	((CanVBusNode *)self)->mode = mode;
+	return 1;
+}
+
+static CanOpMode nodeGetMode(CanTransport *self) {
+	return ((CanVBusNode *)self)->mode;
+}
+
+static void nodeSetTxCallback(CanTransport *self, CanTxCallback callback) {
+	((CanVBusNode *)self)->txCallback = callback;
+}
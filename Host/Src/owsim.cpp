@@ -0,0 +1,912 @@
+/**
+ ******************************************************************************
+ * @file           : owsim.cpp
+ * @brief          : Host side 1-Wire lines, TIM3, TIM4 and DS18B20 simulation
+ ******************************************************************************
+ * The registers of the host stm32f4xx.h call owSimRead() and owSimWrite().
+ * Every access costs accessNs of virtual time, TIM3 and TIM4 count the
+ * virtual time with the prescaler set by the driver and set CC1IF on a
+ * compare match. The interrupt of a timer runs irqLatencyNs after its
+ * flag is set, at the next register access or __WFI(), unless PRIMASK is
+ * set. Both interrupts have the same priority, they do not nest.
+ *
+ * A line is low while its master pin is low or one of its devices pulls
+ * it low. Several lines may share a port, one BSRR write or IDR read
+ * then drives or samples all of them. Devices react to the falling edges
+ * of the master like a DS18B20: they sample write slots sampleNs after
+ * the edge, send a 0 by holding the line for holdNs, and answer a reset
+ * with a presence pulse. ROM commands (Read, Match, Skip, Search ROM) and
+ * the function commands Convert T, Read/Write/Copy Scratchpad, Recall E2
+ * and Read Power Supply are implemented, conversions take the time set
+ * by the resolution.
+ *
+ * Every master low phase and every line sample of the master is checked
+ * against the datasheet limits, see OwSimReport.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <string.h>
+
+#include "owsim.h"
+#include "onewire.h"
+#include "onewiretim.h"
+#include "onewirepar.h"
+
+/* Private define ------------------------------------------------------------*/
+#define US						1000ull
+#define PCLK1_HZ				45000000u
+
+#define RESET_DETECT_NS			(240 * US)		// longer low phases are resets
+#define RESET_MIN_NS			(480 * US)
+#define LOW1_MIN_NS				(1 * US)
+#define LOW1_MAX_NS				(15 * US)
+#define LOW0_MIN_NS				(60 * US)
+#define LOW0_MAX_NS				(120 * US)
+#define SLOT_MIN_NS				(60 * US)
+#define RECOVERY_MIN_NS			(1 * US)
+#define SAMPLE_MAX_NS			(15 * US)		// tRDV
+#define PRESENCE_FROM_NS		(60 * US)		// latest start of the presence pulse
+#define PRESENCE_UNTIL_NS		(75 * US)		// earliest end of the presence pulse
+#define COPY_NS					(10000 * US)
+#define CONVERSION_9BIT_NS		93750000ull
+
+#define NUM_TIMERS				2
+
+#define CMD_READ_ROM			0x33
+#define CMD_MATCH_ROM			0x55
+#define CMD_SKIP_ROM			0xCC
+#define CMD_SEARCH_ROM			0xF0
+#define CMD_CONVERT_T			0x44
+#define CMD_READ_SCRATCHPAD		0xBE
+#define CMD_WRITE_SCRATCHPAD	0x4E
+#define CMD_COPY_SCRATCHPAD		0x48
+#define CMD_RECALL_E2			0xB8
+#define CMD_READ_POWER			0xB4
+
+/* Private typedef -----------------------------------------------------------*/
+enum {
+	DEV_IDLE,			// waits for a reset
+	DEV_ROM,			// receives the ROM command
+	DEV_MATCH,			// receives the ROM code of Match ROM
+	DEV_SEARCH,			// Search ROM triplets
+	DEV_FUNCTION,		// receives the function command
+	DEV_RX,				// receives Write Scratchpad data
+	DEV_TX,				// sends io
+	DEV_POLL			// sends 0 while busy, then 1
+};
+
+/**
+ * One 1-Wire line: master pin, devices and the timing checks
+ */
+typedef struct {
+	GPIO_TypeDef *port;
+	uint16_t pin;
+	OwSimDevice *devices[OWSIM_MAX_DEVICES];
+	uint32_t numDevices;
+
+	uint8_t  masterLow;
+	uint64_t masterFallNs;
+	uint64_t masterRiseNs;
+	uint64_t slotFallNs;			// falling edge of the last slot, 0 = none since the reset
+	uint8_t  lastWasReset;
+	uint8_t  slotIsShort;			// last slot was a 1 / read slot
+	uint8_t  sampleChecked;
+	uint8_t  presenceChecked;
+	OwSimReport report;
+} SimLine;
+
+/**
+ * Counter and compare channel 1 of a timer
+ */
+typedef struct {
+	TIM_TypeDef *regs;
+	void (*handler)(void);
+	uint8_t  running;
+	uint64_t startNs;
+	uint64_t tickNs;
+	uint64_t matchNs;
+} SimTimer;
+
+/* Private variables ---------------------------------------------------------*/
+GPIO_TypeDef owSimGpio[11];
+TIM_TypeDef owSimTim3;
+TIM_TypeDef owSimTim4;
+
+static SimLine lines[OWSIM_MAX_LINES];
+static uint32_t numLines;
+static SimTimer timers[NUM_TIMERS] = {
+	{ &owSimTim3, TIM3_IRQHandler, 0, 0, 0, 0 },
+	{ &owSimTim4, TIM4_IRQHandler, 0, 0, 0, 0 }
+};
+static uint64_t nowNs;
+static uint32_t accessCostNs;
+static uint32_t irqLatencyNs;
+static uint32_t primask;
+static uint8_t  inIsr;
+
+/* Private function prototypes -----------------------------------------------*/
+static void access(void);
+static void advance(uint64_t targetNs);
+static void checkIrq(void);
+static SimTimer *pendingTimer(void);
+static SimTimer *timerOf(const void *reg, size_t offset);
+static void updateMatch(SimTimer *timer);
+static int lineLow(const SimLine *line, uint64_t t);
+static void portWritten(const GPIO_TypeDef *port);
+static void masterEdge(SimLine *line);
+static void checkSample(SimLine *line);
+static void clearReport(OwSimReport *report);
+static void minMargin(int32_t *margin, int64_t value);
+static void deviceReset(OwSimDevice *dev);
+static void deviceFall(OwSimDevice *dev);
+static void deviceSample(OwSimDevice *dev, uint8_t bit);
+static void deviceReceived(OwSimDevice *dev);
+static void deviceExpect(OwSimDevice *dev, uint8_t mode, uint16_t bits);
+static void deviceDrive(OwSimDevice *dev);
+static void deviceConversionResult(OwSimDevice *dev);
+static void deviceUpdateCrc(OwSimDevice *dev);
+static uint8_t deviceResolution(const OwSimDevice *dev);
+
+/**
+ * Reset the simulation, there are no lines afterwards
+ * @param accessNs virtual time of one register access
+ * @param irqLatency time from the compare match to the first instruction of the ISR
+ */
+void owSimInit(uint32_t accessNs, uint32_t irqLatency) {
+	uint32_t i;
+
+	memset(owSimGpio, 0, sizeof(owSimGpio));
+	memset(lines, 0, sizeof(lines));
+	numLines = 0;
+	for (i = 0; i < NUM_TIMERS; i++) {
+		timers[i].running = 0;
+	}
+	nowNs = 0;
+	accessCostNs = accessNs;
+	irqLatencyNs = irqLatency;
+	primask = 0;
+	inIsr = 0;
+	owSimClearReport();
+}
+
+/**
+ * Add a 1-Wire line with a pull-up
+ * @param port, pin master pin of the line
+ * @return line number for owSimAttach() and owSimGetReport(), -1 if
+ *         there are too many lines
+ */
+int owSimAddLine(GPIO_TypeDef *port, uint16_t pin) {
+	SimLine *line;
+
+	if (numLines >= OWSIM_MAX_LINES) {
+		return -1;
+	}
+	line = &lines[numLines];
+	line->port = port;
+	line->pin = pin;
+	port->ODR.value |= pin;		// released
+	clearReport(&line->report);
+	return numLines++;
+}
+
+/**
+ * Power-on state of a DS18B20
+ * @param serial 48 bit serial number, lower 32 bit
+ * @param temperature 1/16 °C
+ */
+void owSimDeviceInit(OwSimDevice *dev, uint8_t family, uint32_t serial, int16_t temperature) {
+	static const uint8_t powerOn[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+
+	memset(dev, 0, sizeof(*dev));
+	dev->rom[0] = family;
+	dev->rom[1] = serial;
+	dev->rom[2] = serial >> 8;
+	dev->rom[3] = serial >> 16;
+	dev->rom[4] = serial >> 24;
+	dev->rom[7] = owCrc8(dev->rom, 7);
+	dev->temperature = temperature;
+	memcpy(dev->scratchpad, powerOn, 8);
+	memcpy(dev->eeprom, &powerOn[2], 3);
+	deviceUpdateCrc(dev);
+	dev->mode = DEV_IDLE;
+	owSimDeviceTiming(dev, 0);
+}
+
+/**
+ * @param worstCase 0 = typical timing, 1 = the datasheet limits that are
+ *        hardest for the master: late and short presence pulse, late
+ *        sample point, short 0 bits
+ */
+void owSimDeviceTiming(OwSimDevice *dev, int worstCase) {
+	dev->timing.presenceDelayNs = worstCase ? 60 * US : 30 * US;
+	dev->timing.presenceLowNs = worstCase ? 60 * US : 120 * US;
+	dev->timing.sampleNs = worstCase ? 60 * US : 30 * US;
+	dev->timing.holdNs = worstCase ? 15 * US : 30 * US;
+}
+
+/**
+ * Connect a device to a line
+ * @param line see owSimAddLine()
+ * @return 0 if the line does not exist or has too many devices
+ */
+int owSimAttach(int line, OwSimDevice *dev) {
+	if (line < 0 || (uint32_t)line >= numLines || lines[line].numDevices >= OWSIM_MAX_DEVICES) {
+		return 0;
+	}
+	lines[line].devices[lines[line].numDevices++] = dev;
+	return 1;
+}
+
+uint64_t owSimTimeNs(void) {
+	return nowNs;
+}
+
+void owSimGetReport(int line, OwSimReport *result) {
+	*result = lines[line].report;
+}
+
+/**
+ * Clear the timing checks of all lines
+ */
+void owSimClearReport(void) {
+	uint32_t i;
+
+	for (i = 0; i < numLines; i++) {
+		clearReport(&lines[i].report);
+	}
+}
+
+uint32_t owSimViolations(const OwSimReport *r) {
+	return r->resetShort + r->lowTooShort + r->lowAmbiguous + r->low0TooLong
+			+ r->slotTooShort + r->recoveryTooShort + r->sampleLate + r->presenceOutside;
+}
+
+/**
+ * Register read of the driver
+ */
+extern "C" uint32_t owSimRead(const void *reg, int id) {
+	const GPIO_TypeDef *port;
+	uint32_t value, i;
+
+	access();
+	switch (id) {
+	case OWSIM_GPIO_IDR:
+		port = (const GPIO_TypeDef *)((const uint8_t *)reg - offsetof(GPIO_TypeDef, IDR));
+		value = port->ODR.value;
+		for (i = 0; i < numLines; i++) {
+			if (lines[i].port != port) {
+				continue;
+			}
+			checkSample(&lines[i]);
+			if (lineLow(&lines[i], nowNs)) {
+				value &= ~lines[i].pin;
+			}
+		}
+		return value;
+	case OWSIM_GPIO_ODR:
+		port = (const GPIO_TypeDef *)((const uint8_t *)reg - offsetof(GPIO_TypeDef, ODR));
+		return port->ODR.value;
+	case OWSIM_TIM_CNT: {
+		const SimTimer *timer = timerOf(reg, offsetof(TIM_TypeDef, CNT));
+
+		return timer->running ? ((nowNs - timer->startNs) / timer->tickNs) & 0xFFFF : 0;
+	}
+	case OWSIM_TIM_CCR1:
+		return timerOf(reg, offsetof(TIM_TypeDef, CCR1))->regs->CCR1.value;
+	case OWSIM_TIM_SR:
+		return timerOf(reg, offsetof(TIM_TypeDef, SR))->regs->SR.value;
+	case OWSIM_TIM_DIER:
+		return timerOf(reg, offsetof(TIM_TypeDef, DIER))->regs->DIER.value;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Register write of the driver
+ */
+extern "C" void owSimWrite(void *reg, int id, uint32_t value) {
+	GPIO_TypeDef *port;
+	SimTimer *timer;
+
+	access();
+	switch (id) {
+	case OWSIM_GPIO_BSRR:
+		port = (GPIO_TypeDef *)((uint8_t *)reg - offsetof(GPIO_TypeDef, BSRR));
+		port->ODR.value = (port->ODR.value & ~(value >> 16)) | (value & 0xFFFF);
+		portWritten(port);
+		break;
+	case OWSIM_GPIO_ODR:
+		port = (GPIO_TypeDef *)((uint8_t *)reg - offsetof(GPIO_TypeDef, ODR));
+		port->ODR.value = value;
+		portWritten(port);
+		break;
+	case OWSIM_TIM_SR:
+		timerOf(reg, offsetof(TIM_TypeDef, SR))->regs->SR.value &= value;		// rc_w0
+		break;
+	case OWSIM_TIM_CCR1:
+		timer = timerOf(reg, offsetof(TIM_TypeDef, CCR1));
+		timer->regs->CCR1.value = value & 0xFFFF;
+		updateMatch(timer);
+		break;
+	case OWSIM_TIM_DIER:
+		timerOf(reg, offsetof(TIM_TypeDef, DIER))->regs->DIER.value = value;
+		break;
+	default:
+		break;
+	}
+	checkIrq();
+}
+
+/* HAL and CMSIS functions used by the drivers -------------------------------*/
+extern "C" void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init) {
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim) {
+	htim->Instance->prescaler = htim->Init.Prescaler;
+	return HAL_OK;
+}
+
+extern "C" HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim) {
+	SimTimer *timer = timerOf(htim->Instance, 0);
+
+	// APB1 timer clock is 2 * PCLK1
+	timer->tickNs = (uint64_t)(htim->Instance->prescaler + 1) * 1000000000ull / (2ull * PCLK1_HZ);
+	timer->startNs = nowNs;
+	timer->running = 1;
+	updateMatch(timer);
+	return HAL_OK;
+}
+
+extern "C" uint32_t HAL_RCC_GetPCLK1Freq(void) {
+	return PCLK1_HZ;
+}
+
+extern "C" uint32_t APB1_TimerPrescaler(uint32_t tickHz) {
+	return 2 * PCLK1_HZ / tickHz - 1;
+}
+
+extern "C" void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub) {
+}
+
+extern "C" void HAL_NVIC_EnableIRQ(IRQn_Type irq) {
+}
+
+extern "C" uint32_t HAL_GetTick(void) {
+	return nowNs / 1000000;
+}
+
+extern "C" uint32_t __get_PRIMASK(void) {
+	return primask;
+}
+
+extern "C" void __set_PRIMASK(uint32_t value) {
+	primask = value;
+	checkIrq();
+}
+
+extern "C" void __disable_irq(void) {
+	primask = 1;
+}
+
+extern "C" void __enable_irq(void) {
+	primask = 0;
+	checkIrq();
+}
+
+/**
+ * Sleep until the next compare match with its interrupt on, or 1 ms
+ * (SysTick) if no compare interrupt is on
+ */
+extern "C" void __WFI(void) {
+	uint64_t wakeNs = nowNs + 1000 * US;
+	uint8_t compareOn = 0;
+	uint32_t i;
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		const SimTimer *timer = &timers[i];
+
+		if (!timer->running || !(timer->regs->DIER.value & TIM_DIER_CC1IE)) {
+			continue;
+		}
+		if (timer->regs->SR.value & TIM_SR_CC1IF) {
+			wakeNs = nowNs;		// already pending
+		} else if (!compareOn || timer->matchNs < wakeNs) {
+			wakeNs = timer->matchNs;
+		}
+		compareOn = 1;
+	}
+	advance(wakeNs);
+	checkIrq();
+}
+
+/* Private functions ---------------------------------------------------------*/
+static void access(void) {
+	advance(nowNs + accessCostNs);
+}
+
+/**
+ * Let the time pass, compare matches and device sample points are
+ * handled in time order
+ */
+static void advance(uint64_t targetNs) {
+	for (;;) {
+		uint64_t next = targetNs;
+		OwSimDevice *dev = NULL;
+		SimLine *devLine = NULL;
+		SimTimer *timer = NULL;
+		uint32_t i, j;
+
+		for (i = 0; i < numLines; i++) {
+			for (j = 0; j < lines[i].numDevices; j++) {
+				OwSimDevice *d = lines[i].devices[j];
+
+				if (d->sampleAtNs != 0 && d->sampleAtNs <= next) {
+					next = d->sampleAtNs;
+					dev = d;
+					devLine = &lines[i];
+				}
+			}
+		}
+		for (i = 0; i < NUM_TIMERS; i++) {
+			if (timers[i].running && timers[i].matchNs <= next) {
+				next = timers[i].matchNs;
+				timer = &timers[i];
+			}
+		}
+		if (timer != NULL) {
+			nowNs = timer->matchNs;
+			timer->regs->SR.value |= TIM_SR_CC1IF;
+			timer->matchNs += 65536 * timer->tickNs;
+			continue;
+		}
+		if (dev == NULL) {
+			break;
+		}
+		nowNs = next;
+		dev->sampleAtNs = 0;
+		deviceSample(dev, !lineLow(devLine, nowNs));
+	}
+	if (targetNs > nowNs) {
+		nowNs = targetNs;
+	}
+}
+
+/**
+ * Run the ISR of a timer whose interrupt is pending and enabled
+ */
+static void checkIrq(void) {
+	SimTimer *timer;
+
+	while (!inIsr && !primask && (timer = pendingTimer()) != NULL) {
+		inIsr = 1;
+		advance(nowNs + irqLatencyNs);
+		timer->handler();
+		inIsr = 0;
+	}
+}
+
+/**
+ * @return first timer with the compare interrupt pending and enabled, NULL if none
+ */
+static SimTimer *pendingTimer(void) {
+	uint32_t i;
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		const TIM_TypeDef *regs = timers[i].regs;
+
+		if ((regs->SR.value & TIM_SR_CC1IF) && (regs->DIER.value & TIM_DIER_CC1IE)) {
+			return &timers[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Timer of a register
+ * @param offset offset of the register in TIM_TypeDef
+ */
+static SimTimer *timerOf(const void *reg, size_t offset) {
+	const TIM_TypeDef *regs = (const TIM_TypeDef *)((const uint8_t *)reg - offset);
+	uint32_t i;
+
+	for (i = 0; i < NUM_TIMERS - 1; i++) {
+		if (timers[i].regs == regs) {
+			break;
+		}
+	}
+	return &timers[i];
+}
+
+/**
+ * Time of the next match of CNT and CCR1
+ */
+static void updateMatch(SimTimer *timer) {
+	uint64_t ticks, delta;
+
+	if (!timer->running) {
+		return;
+	}
+	ticks = (nowNs - timer->startNs) / timer->tickNs;
+	delta = (timer->regs->CCR1.value - ticks) & 0xFFFF;
+	if (delta == 0) {
+		delta = 65536;
+	}
+	timer->matchNs = timer->startNs + (ticks + delta) * timer->tickNs;
+}
+
+static int lineLow(const SimLine *line, uint64_t t) {
+	uint32_t i;
+
+	if (line->masterLow) {
+		return 1;
+	}
+	for (i = 0; i < line->numDevices; i++) {
+		if (t >= line->devices[i]->lowFromNs && t < line->devices[i]->lowUntilNs) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * The output register of a port has been written: check the master pins
+ * of all lines on it
+ */
+static void portWritten(const GPIO_TypeDef *port) {
+	uint32_t i;
+
+	for (i = 0; i < numLines; i++) {
+		if (lines[i].port == port) {
+			masterEdge(&lines[i]);
+		}
+	}
+}
+
+/**
+ * The master pin may have changed: falling edges start slots, the low
+ * time decides between reset, 0 slot and 1 / read slot
+ */
+static void masterEdge(SimLine *line) {
+	uint8_t low = (line->port->ODR.value & line->pin) == 0;
+	OwSimReport *report = &line->report;
+	uint64_t duration;
+	uint32_t i;
+
+	if (low == line->masterLow) {
+		return;
+	}
+
+	if (low) {
+		uint8_t wasLow = lineLow(line, nowNs);
+
+		line->masterLow = 1;
+		line->masterFallNs = nowNs;
+		if (!line->lastWasReset && line->slotFallNs != 0) {
+			minMargin(&report->slotMarginNs, (int64_t)(nowNs - line->slotFallNs) - SLOT_MIN_NS);
+			if (nowNs - line->slotFallNs < SLOT_MIN_NS) {
+				report->slotTooShort++;
+			}
+		}
+		minMargin(&report->recoveryMarginNs, (int64_t)(nowNs - line->masterRiseNs) - RECOVERY_MIN_NS);
+		if (nowNs - line->masterRiseNs < RECOVERY_MIN_NS) {
+			report->recoveryTooShort++;
+		}
+		if (!wasLow) {
+			for (i = 0; i < line->numDevices; i++) {
+				deviceFall(line->devices[i]);
+			}
+		}
+		return;
+	}
+
+	line->masterLow = 0;
+	line->masterRiseNs = nowNs;
+	duration = nowNs - line->masterFallNs;
+	if (duration >= RESET_DETECT_NS) {
+		report->resets++;
+		minMargin(&report->resetMarginNs, (int64_t)duration - RESET_MIN_NS);
+		if (duration < RESET_MIN_NS) {
+			report->resetShort++;
+		}
+		line->lastWasReset = 1;
+		line->presenceChecked = 0;
+		line->slotFallNs = 0;
+		for (i = 0; i < line->numDevices; i++) {
+			deviceReset(line->devices[i]);
+		}
+		return;
+	}
+
+	report->slots++;
+	line->lastWasReset = 0;
+	line->slotFallNs = line->masterFallNs;
+	line->slotIsShort = duration < LOW1_MAX_NS;
+	line->sampleChecked = 0;
+	if (duration < LOW1_MAX_NS) {
+		minMargin(&report->low1MarginNs, (int64_t)LOW1_MAX_NS - duration);
+		if (duration < LOW1_MIN_NS) {
+			report->lowTooShort++;
+		}
+	} else {
+		int64_t margin = (int64_t)duration - LOW0_MIN_NS;
+
+		if ((int64_t)LOW0_MAX_NS - (int64_t)duration < margin) {
+			margin = (int64_t)LOW0_MAX_NS - (int64_t)duration;
+		}
+		minMargin(&report->low0MarginNs, margin);
+		if (duration < LOW0_MIN_NS) {
+			report->lowAmbiguous++;
+		} else if (duration > LOW0_MAX_NS) {
+			report->low0TooLong++;
+		}
+	}
+}
+
+/**
+ * The master reads the line: the first read after a reset is the
+ * presence sample, the first one in a 1 / read slot the data sample
+ */
+static void checkSample(SimLine *line) {
+	OwSimReport *report = &line->report;
+	int64_t t, margin;
+
+	if (line->masterLow) {
+		return;
+	}
+	if (line->lastWasReset) {
+		t = nowNs - line->masterRiseNs;
+		if (line->presenceChecked || t >= (int64_t)RESET_DETECT_NS) {
+			return;
+		}
+		line->presenceChecked = 1;
+		margin = t - PRESENCE_FROM_NS;
+		if ((int64_t)PRESENCE_UNTIL_NS - t < margin) {
+			margin = (int64_t)PRESENCE_UNTIL_NS - t;
+		}
+		minMargin(&report->presenceMarginNs, margin);
+		if (margin < 0) {
+			report->presenceOutside++;
+		}
+		return;
+	}
+	if (!line->slotIsShort || line->sampleChecked || line->slotFallNs == 0) {
+		return;
+	}
+	t = nowNs - line->slotFallNs;
+	if (t >= (int64_t)SLOT_MIN_NS) {
+		return;
+	}
+	line->sampleChecked = 1;
+	minMargin(&report->sampleMarginNs, (int64_t)SAMPLE_MAX_NS - t);
+	if (t > (int64_t)SAMPLE_MAX_NS) {
+		report->sampleLate++;
+	}
+}
+
+static void clearReport(OwSimReport *report) {
+	memset(report, 0, sizeof(*report));
+	report->resetMarginNs = INT32_MAX;
+	report->low1MarginNs = INT32_MAX;
+	report->low0MarginNs = INT32_MAX;
+	report->slotMarginNs = INT32_MAX;
+	report->recoveryMarginNs = INT32_MAX;
+	report->sampleMarginNs = INT32_MAX;
+	report->presenceMarginNs = INT32_MAX;
+}
+
+static void minMargin(int32_t *margin, int64_t value) {
+	if (value < *margin) {
+		*margin = (int32_t)value;
+	}
+}
+
+/* DS18B20 model -------------------------------------------------------------*/
+static void deviceReset(OwSimDevice *dev) {
+	dev->lowFromNs = nowNs + dev->timing.presenceDelayNs;
+	dev->lowUntilNs = dev->lowFromNs + dev->timing.presenceLowNs;
+	dev->sampleAtNs = 0;
+	deviceExpect(dev, DEV_ROM, 8);
+}
+
+/**
+ * Falling edge of the master: send the next bit or schedule the sample
+ */
+static void deviceFall(OwSimDevice *dev) {
+	uint8_t bit;
+
+	switch (dev->mode) {
+	case DEV_IDLE:
+		break;
+
+	case DEV_POLL:
+		if (nowNs < dev->busyUntilNs) {
+			deviceDrive(dev);
+		}
+		break;
+
+	case DEV_TX:
+		bit = (dev->io[dev->ioPos >> 3] >> (dev->ioPos & 7)) & 1;
+		if (!bit) {
+			deviceDrive(dev);
+		}
+		if (++dev->ioPos == dev->ioBits) {
+			if (dev->command == CMD_READ_ROM) {
+				deviceExpect(dev, DEV_FUNCTION, 8);
+			} else {
+				dev->mode = DEV_IDLE;
+			}
+		}
+		break;
+
+	case DEV_SEARCH:
+		bit = (dev->rom[dev->ioPos >> 3] >> (dev->ioPos & 7)) & 1;
+		if (dev->searchStep == 0 && !bit) {
+			deviceDrive(dev);
+		} else if (dev->searchStep == 1 && bit) {
+			deviceDrive(dev);		// complement
+		} else if (dev->searchStep == 2) {
+			dev->sampleAtNs = nowNs + dev->timing.sampleNs;
+		}
+		if (dev->searchStep < 2) {
+			dev->searchStep++;
+		}
+		break;
+
+	default:
+		dev->sampleAtNs = nowNs + dev->timing.sampleNs;
+		break;
+	}
+}
+
+/**
+ * Sample point of a write slot
+ */
+static void deviceSample(OwSimDevice *dev, uint8_t bit) {
+	if (dev->mode == DEV_SEARCH) {
+		if (bit != ((dev->rom[dev->ioPos >> 3] >> (dev->ioPos & 7)) & 1)) {
+			dev->mode = DEV_IDLE;		// lost, waits for the next reset
+			return;
+		}
+		dev->searchStep = 0;
+		if (++dev->ioPos == 64) {
+			deviceExpect(dev, DEV_FUNCTION, 8);
+		}
+		return;
+	}
+
+	if (bit) {
+		dev->io[dev->ioPos >> 3] |= 1 << (dev->ioPos & 7);
+	}
+	if (++dev->ioPos == dev->ioBits) {
+		deviceReceived(dev);
+	}
+}
+
+/**
+ * All expected bits have been received
+ */
+static void deviceReceived(OwSimDevice *dev) {
+	switch (dev->mode) {
+	case DEV_ROM:
+		dev->command = dev->io[0];
+		switch (dev->command) {
+		case CMD_READ_ROM:
+			deviceExpect(dev, DEV_TX, 64);
+			memcpy(dev->io, dev->rom, 8);
+			break;
+		case CMD_MATCH_ROM:
+			deviceExpect(dev, DEV_MATCH, 64);
+			break;
+		case CMD_SKIP_ROM:
+			deviceExpect(dev, DEV_FUNCTION, 8);
+			break;
+		case CMD_SEARCH_ROM:
+			deviceExpect(dev, DEV_SEARCH, 64);
+			dev->searchStep = 0;
+			break;
+		default:
+			dev->mode = DEV_IDLE;
+			break;
+		}
+		break;
+
+	case DEV_MATCH:
+		if (memcmp(dev->io, dev->rom, 8) == 0) {
+			deviceExpect(dev, DEV_FUNCTION, 8);
+		} else {
+			dev->mode = DEV_IDLE;
+		}
+		break;
+
+	case DEV_FUNCTION:
+		dev->command = dev->io[0];
+		switch (dev->command) {
+		case CMD_CONVERT_T:
+			dev->busyUntilNs = nowNs + (CONVERSION_9BIT_NS << (deviceResolution(dev) - 9));
+			dev->conversionPending = 1;
+			dev->mode = DEV_POLL;
+			break;
+		case CMD_READ_SCRATCHPAD:
+			deviceConversionResult(dev);
+			deviceExpect(dev, DEV_TX, 72);
+			memcpy(dev->io, dev->scratchpad, 9);
+			break;
+		case CMD_WRITE_SCRATCHPAD:
+			deviceExpect(dev, DEV_RX, 24);
+			break;
+		case CMD_COPY_SCRATCHPAD:
+			memcpy(dev->eeprom, &dev->scratchpad[2], 3);
+			dev->busyUntilNs = nowNs + COPY_NS;
+			dev->mode = DEV_POLL;
+			break;
+		case CMD_RECALL_E2:
+			memcpy(&dev->scratchpad[2], dev->eeprom, 3);
+			deviceUpdateCrc(dev);
+			dev->busyUntilNs = nowNs;
+			dev->mode = DEV_POLL;
+			break;
+		case CMD_READ_POWER:
+			deviceExpect(dev, DEV_TX, 1);
+			dev->io[0] = 1;		// externally powered
+			break;
+		default:
+			dev->mode = DEV_IDLE;
+			break;
+		}
+		break;
+
+	case DEV_RX:
+		dev->scratchpad[2] = dev->io[0];
+		dev->scratchpad[3] = dev->io[1];
+		dev->scratchpad[4] = (dev->io[2] & 0x60) | 0x1F;
+		deviceUpdateCrc(dev);
+		dev->mode = DEV_IDLE;
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void deviceExpect(OwSimDevice *dev, uint8_t mode, uint16_t bits) {
+	dev->mode = mode;
+	dev->ioBits = bits;
+	dev->ioPos = 0;
+	memset(dev->io, 0, sizeof(dev->io));
+}
+
+/**
+ * Send a 0: hold the line low from the falling edge of the master
+ */
+static void deviceDrive(OwSimDevice *dev) {
+	dev->lowFromNs = nowNs;
+	dev->lowUntilNs = nowNs + dev->timing.holdNs;
+}
+
+/**
+ * A finished conversion updates the scratchpad, the undefined low bits
+ * are 0
+ */
+static void deviceConversionResult(OwSimDevice *dev) {
+	int16_t raw;
+
+	if (!dev->conversionPending || nowNs < dev->busyUntilNs) {
+		return;
+	}
+	raw = dev->temperature & ~((1 << (12 - deviceResolution(dev))) - 1);
+	dev->scratchpad[0] = raw & 0xFF;
+	dev->scratchpad[1] = (raw >> 8) & 0xFF;
+	dev->conversionPending = 0;
+	deviceUpdateCrc(dev);
+}
+
+static void deviceUpdateCrc(OwSimDevice *dev) {
+	dev->scratchpad[8] = owCrc8(dev->scratchpad, 8);
+}
+
+static uint8_t deviceResolution(const OwSimDevice *dev) {
+	return ((dev->scratchpad[4] >> 5) & 3) + 9;
+}
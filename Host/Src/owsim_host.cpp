@@ -0,0 +1,373 @@
+/**
+ ******************************************************************************
+ * @file           : owsim_host.cpp
+ * @brief          : DS18B20 driver against simulated devices
+ ******************************************************************************
+ * Runs DS18B20.c, onewire.c, onewiretim.c and onewirepar.c unmodified on
+ * the simulated lines, TIM3 and TIM4 of owsim.cpp: reset, Search ROM,
+ * resolution change and temperature reads with Match ROM, once with
+ * typical and once with worst-case device timing.
+ *
+ * The parallel pass does the same on PAR_LINES lines of one port with
+ * the group held, so every blocking call has to start the run itself,
+ * then reads one scratchpad per line with one run and checks that this
+ * takes about as long as on one line. A second group, released while
+ * the first one runs, has to start when that run ends.
+ *
+ * Prints the virtual duration of every operation and the timing check of
+ * every line.
+ *
+ * usage: owsim_host [devices [irq_latency_ns [access_ns]]]
+ *   devices: DS18B20 on the TIM3 line, 1..15, default 3. One device of
+ *            another family is always added, the search has to skip it.
+ *
+ * Exit status 1 on timing violations or wrong results.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "owsim.h"
+#include "onewiretim.h"
+#include "onewirepar.h"
+#include "DS18B20.h"
+
+/* Private define ------------------------------------------------------------*/
+#define OTHER_FAMILY	0x10		// DS18S20, not found by ds1820_search
+#define PAR_LINES		3			// lines of the parallel pass, GPIOE pins 2..
+#define PAR_DEVICES		2			// DS18B20 per parallel line
+
+#define SENSOR_BITS(i)	(((i) & 1) ? 9 : 12)
+
+/* Private variables ---------------------------------------------------------*/
+static OwSimDevice simDevices[OWSIM_MAX_DEVICES];
+static OwTimBus bus;
+static Ds1820 sensors[OWSIM_MAX_DEVICES];
+static int simLine;
+
+static OwSimDevice parSimDevices[PAR_LINES][PAR_DEVICES];
+static OwParGroup parGroup;
+static OwParLine parLines[PAR_LINES];
+static Ds1820 parSensors[PAR_LINES][OWSIM_MAX_DEVICES];
+static int parSimLines[PAR_LINES];
+
+static OwSimDevice otherSimDevice;		// second group, one line on GPIOF
+static OwParGroup otherGroup;
+static OwParLine otherLine;
+static Ds1820 otherSensor;
+static int otherSimLine;
+
+/* Private function prototypes -----------------------------------------------*/
+static int runPass(int numDevices, int worstCase);
+static int runParPass(int worstCase);
+static int runGroupPass(void);
+static int testSensor(Ds1820 *sensor, OwSimDevice *sims, int numSims, uint8_t bits, int index);
+static OwSimDevice *findSim(const Ds1820 *sensor, OwSimDevice *sims, int numSims);
+static void printOp(const char *name, uint64_t startNs);
+static uint32_t printReport(int line);
+
+int main(int argc, char *argv[]) {
+	int numDevices = (argc > 1) ? atoi(argv[1]) : 3;
+	int errors = 0;
+	uint32_t irqLatencyNs = (argc > 2) ? strtoul(argv[2], NULL, 0) : 200;
+	uint32_t accessNs = (argc > 3) ? strtoul(argv[3], NULL, 0) : 20;
+	int i, l;
+
+	if (numDevices < 1 || numDevices >= OWSIM_MAX_DEVICES) {
+		fprintf(stderr, "usage: %s [devices [irq_latency_ns [access_ns]]]\n", argv[0]);
+		return 1;
+	}
+
+	owSimInit(accessNs, irqLatencyNs);
+	simLine = owSimAddLine(GPIOG, GPIO_PIN_9);
+	for (i = 0; i < numDevices; i++) {
+		// 21.5 °C, then steps of -7.3125 °C down to negative values
+		owSimDeviceInit(&simDevices[i], DS1820_FAMILY, 0x1000 + i * 0x111, 344 - i * 117);
+		owSimAttach(simLine, &simDevices[i]);
+	}
+	owSimDeviceInit(&simDevices[numDevices], OTHER_FAMILY, 0x0BAD, 0);
+	owSimAttach(simLine, &simDevices[numDevices]);
+	owTimInit(&bus, GPIOG, GPIO_PIN_9);
+
+	owParInit(&parGroup, GPIOE);
+	for (l = 0; l < PAR_LINES; l++) {
+		parSimLines[l] = owSimAddLine(GPIOE, GPIO_PIN_2 << l);
+		for (i = 0; i < PAR_DEVICES; i++) {
+			// 25 °C, then steps of -10.0625 °C
+			owSimDeviceInit(&parSimDevices[l][i], DS1820_FAMILY, 0x2000 + l * 0x100 + i,
+					400 - (l * PAR_DEVICES + i) * 161);
+			owSimAttach(parSimLines[l], &parSimDevices[l][i]);
+		}
+		owParAddLine(&parGroup, &parLines[l], GPIO_PIN_2 << l);
+	}
+	owParInit(&otherGroup, GPIOF);
+	otherSimLine = owSimAddLine(GPIOF, GPIO_PIN_6);
+	owSimDeviceInit(&otherSimDevice, DS1820_FAMILY, 0x3000, -200);
+	owSimAttach(otherSimLine, &otherSimDevice);
+	owParAddLine(&otherGroup, &otherLine, GPIO_PIN_6);
+
+	printf("OWSIM devices %d irq_latency %luns access %luns, parallel lines %d devices %d\n",
+			numDevices, (unsigned long)irqLatencyNs, (unsigned long)accessNs,
+			PAR_LINES, PAR_DEVICES);
+	for (i = 0; i < 2; i++) {
+		errors += runPass(numDevices, i);
+		errors += runParPass(i);
+	}
+	errors += runGroupPass();
+	printf("OWSIM %s\n", errors ? "FAILED" : "OK");
+	return errors ? 1 : 0;
+}
+
+/**
+ * One pass of all operations on the TIM3 line
+ * @return number of errors
+ */
+static int runPass(int numDevices, int worstCase) {
+	uint64_t start;
+	int found, i, failed = 0;
+
+	for (i = 0; i <= numDevices; i++) {
+		owSimDeviceTiming(&simDevices[i], worstCase);
+	}
+	owSimClearReport();
+	printf("pass %s device timing\n", worstCase ? "worst-case" : "typical");
+
+	start = owSimTimeNs();
+	if (ds1820_init(&sensors[0], &bus.bus) != 0) {
+		printf("  reset: no presence\n");
+		failed++;
+	}
+	printOp("reset", start);
+
+	start = owSimTimeNs();
+	found = ds1820_search(&bus.bus, sensors, OWSIM_MAX_DEVICES);
+	printOp("search", start);
+	if (found != numDevices) {
+		printf("  search: %d of %d devices found\n", found, numDevices);
+		failed++;
+	}
+
+	for (i = 0; i < found; i++) {
+		failed += testSensor(&sensors[i], simDevices, numDevices, SENSOR_BITS(i), i);
+	}
+
+	failed += printReport(simLine);
+	return failed;
+}
+
+/**
+ * The operations on the parallel lines: search, resolution and reads
+ * with blocking calls on the held group, then one scratchpad read per
+ * line started together
+ * @return number of errors
+ */
+static int runParPass(int worstCase) {
+	int found[PAR_LINES];
+	uint64_t start, single;
+	int i, l, failed = 0;
+
+	for (l = 0; l < PAR_LINES; l++) {
+		for (i = 0; i < PAR_DEVICES; i++) {
+			owSimDeviceTiming(&parSimDevices[l][i], worstCase);
+		}
+	}
+	owSimClearReport();
+	printf("pass parallel, %s device timing\n", worstCase ? "worst-case" : "typical");
+
+	// blocking calls must not wait for owParRelease()
+	owParHold(&parGroup);
+	start = owSimTimeNs();
+	for (l = 0; l < PAR_LINES; l++) {
+		found[l] = ds1820_search(&parLines[l].bus, parSensors[l], OWSIM_MAX_DEVICES);
+		if (found[l] != PAR_DEVICES) {
+			printf("  line %d: search: %d of %d devices found\n", l, found[l], PAR_DEVICES);
+			failed++;
+		}
+	}
+	printOp("search held", start);
+	for (l = 0; l < PAR_LINES; l++) {
+		for (i = 0; i < found[l]; i++) {
+			failed += testSensor(&parSensors[l][i], parSimDevices[l], PAR_DEVICES,
+					SENSOR_BITS(i), l * PAR_DEVICES + i);
+		}
+	}
+	owParRelease(&parGroup);
+
+	// one line alone, then all lines in one run
+	start = owSimTimeNs();
+	if (found[0] > 0 && ds1820_start_read(&parSensors[0][0], NULL, NULL)) {
+		while (ds1820_status(&parSensors[0][0]) == OW_BUSY) {
+			parLines[0].bus.idle(&parLines[0].bus);
+		}
+	}
+	single = owSimTimeNs() - start;
+	printOp("read one line", start);
+
+	start = owSimTimeNs();
+	owParHold(&parGroup);
+	for (l = 0; l < PAR_LINES; l++) {
+		if (found[l] > 0 && !ds1820_start_read(&parSensors[l][0], NULL, NULL)) {
+			printf("  line %d: read not started\n", l);
+			failed++;
+		}
+	}
+	owParRelease(&parGroup);
+	for (l = 0; l < PAR_LINES; l++) {
+		while (found[l] > 0 && ds1820_status(&parSensors[l][0]) == OW_BUSY) {
+			parLines[l].bus.idle(&parLines[l].bus);
+		}
+	}
+	printOp("read all lines", start);
+	if (owSimTimeNs() - start > single + single / 2) {
+		printf("  lines not read in parallel\n");
+		failed++;
+	}
+	for (l = 0; l < PAR_LINES; l++) {
+		OwSimDevice *sim;
+		int16_t expected;
+
+		if (found[l] == 0 || (sim = findSim(&parSensors[l][0], parSimDevices[l], PAR_DEVICES)) == NULL) {
+			continue;
+		}
+		expected = sim->temperature & ~((1 << (12 - SENSOR_BITS(0))) - 1);
+		if (ds1820_status(&parSensors[l][0]) != OW_OK || !ds1820_scratchpad_valid(&parSensors[l][0])
+				|| ds1820_result_raw(&parSensors[l][0]) != expected) {
+			printf("  line %d: parallel read %.4f, expected %.4f\n", l,
+					ds1820_result_raw(&parSensors[l][0]) / 16.0, expected / 16.0);
+			failed++;
+		}
+	}
+
+	for (l = 0; l < PAR_LINES; l++) {
+		failed += printReport(parSimLines[l]);
+	}
+	return failed;
+}
+
+/**
+ * Two groups share TIM4: the second group is held with a queued read and
+ * released while the first one runs. Only __WFI() is called while
+ * waiting, so the end of the first run has to start the second one.
+ * @return number of errors
+ */
+static int runGroupPass(void) {
+	uint64_t start;
+	int failed = 0;
+
+	owSimClearReport();
+	printf("pass two groups\n");
+	if (ds1820_search(&otherLine.bus, &otherSensor, 1) != 1 || ds1820_set_resolution(&otherSensor, 12) != 0) {
+		printf("  second group: sensor not found\n");
+		return 1;
+	}
+	if (ds1820_read_temp(&otherSensor) == DS1820_TEMP_INVALID) {	// converts, the read below returns the result
+		printf("  second group: read temp failed\n");
+		return 1;
+	}
+
+	start = owSimTimeNs();
+	owParHold(&otherGroup);
+	if (!ds1820_start_read(&otherSensor, NULL, NULL) || !ds1820_start_read(&parSensors[0][0], NULL, NULL)) {
+		printf("  reads not started\n");
+		failed++;
+	}
+	owParRelease(&otherGroup);		// the first group runs
+	while ((ds1820_status(&otherSensor) == OW_BUSY || ds1820_status(&parSensors[0][0]) == OW_BUSY)
+			&& owSimTimeNs() - start < 1000000000ull) {
+		__WFI();
+	}
+	printOp("read both groups", start);
+	if (ds1820_status(&otherSensor) != OW_OK || ds1820_result_raw(&otherSensor) != otherSimDevice.temperature
+			|| ds1820_status(&parSensors[0][0]) != OW_OK) {
+		printf("  second group: read not run after the first group\n");
+		failed++;
+	}
+	failed += printReport(otherSimLine);
+	return failed;
+}
+
+/**
+ * Set the resolution of a sensor found by the search and read it
+ * @param sims simulated devices the sensor has to be one of
+ * @param index number of the sensor in the messages
+ * @return number of errors
+ */
+static int testSensor(Ds1820 *sensor, OwSimDevice *sims, int numSims, uint8_t bits, int index) {
+	OwSimDevice *sim = findSim(sensor, sims, numSims);
+	uint64_t start;
+	int16_t expected;
+	int16_t value;
+	int failed = 0;
+
+	if (sim == NULL) {
+		printf("  sensor %d: unknown ROM code\n", index);
+		return 1;
+	}
+
+	start = owSimTimeNs();
+	if (ds1820_set_resolution(sensor, bits) != 0) {
+		printf("  sensor %d: set resolution failed\n", index);
+		failed++;
+	}
+	printOp(bits == 9 ? "resolution 9 bit" : "resolution 12 bit", start);
+
+	start = owSimTimeNs();
+	value = ds1820_read_temp(sensor);
+	printOp(bits == 9 ? "read temp 9 bit" : "read temp 12 bit", start);
+
+	expected = sim->temperature & ~((1 << (12 - bits)) - 1);
+	if (value != expected) {
+		printf("  sensor %d: %.4f, expected %.4f\n", index, value / 16.0, expected / 16.0);
+		failed++;
+	}
+	return failed;
+}
+
+/**
+ * @return simulated device with the ROM code of a sensor, NULL if none
+ */
+static OwSimDevice *findSim(const Ds1820 *sensor, OwSimDevice *sims, int numSims) {
+	int i;
+
+	for (i = 0; i < numSims; i++) {
+		if (memcmp(sims[i].rom, sensor->rom, 8) == 0) {
+			return &sims[i];
+		}
+	}
+	return NULL;
+}
+
+static void printOp(const char *name, uint64_t startNs) {
+	printf("  op %-18s %10.1f us\n", name, (owSimTimeNs() - startNs) / 1000.0);
+}
+
+/**
+ * Counts and margins of the timing checks of one line
+ * @return number of violations
+ */
+static uint32_t printReport(int line) {
+	OwSimReport r;
+
+	owSimGetReport(line, &r);
+	printf("  timing line %d resets %lu slots %lu violations %lu\n", line, (unsigned long)r.resets,
+			(unsigned long)r.slots, (unsigned long)owSimViolations(&r));
+	printf("  margin reset %.2f us, low 1 %.2f us, low 0 %.2f us, slot %.2f us\n",
+			r.resetMarginNs / 1000.0, r.low1MarginNs / 1000.0, r.low0MarginNs / 1000.0,
+			r.slotMarginNs / 1000.0);
+	printf("  margin recovery %.2f us, read sample %.2f us, presence sample %.2f us\n",
+			r.recoveryMarginNs / 1000.0, r.sampleMarginNs / 1000.0, r.presenceMarginNs / 1000.0);
+	if (r.resetShort || r.lowTooShort || r.lowAmbiguous || r.low0TooLong) {
+		printf("  violations: reset short %lu, low < 1 us %lu, low 15..60 us %lu, low 0 > 120 us %lu\n",
+				(unsigned long)r.resetShort, (unsigned long)r.lowTooShort,
+				(unsigned long)r.lowAmbiguous, (unsigned long)r.low0TooLong);
+	}
+	if (r.slotTooShort || r.recoveryTooShort || r.sampleLate || r.presenceOutside) {
+		printf("  violations: slot short %lu, recovery short %lu, sample late %lu, presence outside %lu\n",
+				(unsigned long)r.slotTooShort, (unsigned long)r.recoveryTooShort,
+				(unsigned long)r.sampleLate, (unsigned long)r.presenceOutside);
+	}
+	return owSimViolations(&r);
+}
@@ -10,6 +10,8 @@
 
 #include <stdint.h>
 
+#include "can.h"
+
 class CanFrame {
 public:
 	CanFrame();
@@ -21,6 +23,7 @@ public:
 
 	bool txData(void);
 	bool rxData(void);
+	void setMsg(const CanMsg *msg);
 
 	void getData(uint8_t *data, unsigned int *len);
 	uint32_t getId(void);
@@ -0,0 +1,173 @@
+/*
+ * CanSignal.h
+ *
+ * Compile-time description of the signals in a CAN payload.
+ *
+ * A signal is a type, all layout parameters are template arguments:
+ *   START   start bit in DBC numbering (byte * 8 + bit, bit 0 = LSB of the byte)
+ *           INTEL: start bit is the LSB of the signal
+ *           MOTOROLA: start bit is the MSB of the signal
+ *   LEN     length in bits, 1..32
+ *   SIGNED  raw value is two's complement
+ *   SCALE_NUM / SCALE_DEN, OFFSET: physical = raw * SCALE_NUM / SCALE_DEN + OFFSET
+ *
+ * Shifts, masks and the touched bytes are computed by the compiler, pack()
+ * and unpack() are straight-line code without any layout interpretation at
+ * run time. Signals that do not fit into 8 bytes, overlap or exceed the DLC
+ * of their message fail to compile. image() is constexpr, so the byte order
+ * of a message can be checked with static_assert.
+ */
+
+#ifndef CANSIGNAL_H_
+#define CANSIGNAL_H_
+
+#include <stdint.h>
+#include <math.h>
+#include <type_traits>
+
+enum CanByteOrder { CAN_INTEL, CAN_MOTOROLA };
+
+/**
+ * Payload image of a field at bit position shift, byte i of the payload
+ * is bits 8i..8i+7 of the result
+ */
+constexpr uint64_t canSignalImage(CanByteOrder order, unsigned shift, uint32_t value) {
+	return (order == CAN_INTEL) ? (uint64_t)value << shift
+			: __builtin_bswap64((uint64_t)value << shift);
+}
+
+template <unsigned START, unsigned LEN, CanByteOrder ORDER, bool SIGNED = false,
+		int SCALE_NUM = 1, int SCALE_DEN = 1, int OFFSET = 0>
+struct CanSignal {
+	static_assert(LEN >= 1 && LEN <= 32, "signal length has to be 1..32 bits");
+	static_assert(START < 64, "start bit outside of the payload");
+	static_assert(ORDER == CAN_INTEL ? START + LEN <= 64
+			: (int)((7 - START / 8) * 8 + START % 8) >= (int)LEN - 1,
+			"signal does not fit into the payload");
+	static_assert(SCALE_NUM != 0 && SCALE_DEN > 0, "invalid scale");
+
+	typedef typename std::conditional<SIGNED, int32_t, uint32_t>::type Raw;
+
+	// value mask of the raw signal
+	static constexpr uint32_t RAW_MASK = (LEN == 32) ? 0xFFFFFFFFu : ((1u << LEN) - 1);
+	// position of the signal LSB, little endian numbering for INTEL,
+	// big endian numbering (bit 0 = LSB of byte 7) for MOTOROLA
+	static constexpr unsigned SHIFT = (ORDER == CAN_INTEL) ? START
+			: (7 - START / 8) * 8 + START % 8 - (LEN - 1);
+
+	static constexpr Raw RAW_MIN = SIGNED ? (Raw)(-(int64_t)(RAW_MASK >> 1) - 1) : 0;
+	static constexpr Raw RAW_MAX = SIGNED ? (Raw)(RAW_MASK >> 1) : (Raw)RAW_MASK;
+
+	// payload bits occupied by the signal
+	static constexpr uint64_t MASK = canSignalImage(ORDER, SHIFT, RAW_MASK);
+	static constexpr unsigned FIRST_BYTE = __builtin_ctzll(MASK) / 8;
+	static constexpr unsigned LAST_BYTE = (63 - __builtin_clzll(MASK)) / 8;
+
+	/**
+	 * Payload image of a raw value, byte i of the payload is bits 8i..8i+7
+	 */
+	static constexpr uint64_t image(uint32_t raw) {
+		return canSignalImage(ORDER, SHIFT, raw & RAW_MASK);
+	}
+
+	/**
+	 * Write a raw value, other signals in the touched bytes are kept
+	 */
+	static inline void pack(uint8_t *data, Raw raw) {
+		uint64_t v = image((uint32_t)raw);
+
+		for (unsigned i = FIRST_BYTE; i <= LAST_BYTE; i++) {
+			data[i] = (data[i] & ~(uint8_t)(MASK >> (8 * i))) | (uint8_t)(v >> (8 * i));
+		}
+	}
+
+	/**
+	 * Write a raw value, values outside of the signal range are saturated
+	 */
+	static inline void packSaturated(uint8_t *data, int64_t raw) {
+		raw = (raw < (int64_t)RAW_MIN) ? (int64_t)RAW_MIN : raw;
+		raw = (raw > (int64_t)RAW_MAX) ? (int64_t)RAW_MAX : raw;
+		pack(data, (Raw)raw);
+	}
+
+	/**
+	 * Read a raw value, signed values are sign extended
+	 */
+	static inline Raw unpack(const uint8_t *data) {
+		uint64_t v = 0;
+
+		for (unsigned i = FIRST_BYTE; i <= LAST_BYTE; i++) {
+			v |= (uint64_t)data[i] << (8 * i);
+		}
+		if (ORDER == CAN_MOTOROLA) {
+			v = __builtin_bswap64(v);
+		}
+		uint32_t raw = (uint32_t)(v >> SHIFT) & RAW_MASK;
+		if (SIGNED) {
+			return (Raw)((int32_t)(raw << (32 - LEN)) >> (32 - LEN));
+		}
+		return (Raw)raw;
+	}
+
+	/**
+	 * Physical value to raw value, rounded and saturated to the signal range
+	 */
+	static inline Raw toRaw(float value) {
+		float raw = roundf((value - OFFSET) * SCALE_DEN / SCALE_NUM);
+
+		raw = (raw < (float)RAW_MIN) ? (float)RAW_MIN : raw;
+		raw = (raw > (float)RAW_MAX) ? (float)RAW_MAX : raw;
+		return (Raw)raw;
+	}
+
+	static inline float toPhysical(Raw raw) {
+		return (float)raw * SCALE_NUM / SCALE_DEN + OFFSET;
+	}
+
+	static inline void encode(uint8_t *data, float value) {
+		pack(data, toRaw(value));
+	}
+
+	static inline float decode(const uint8_t *data) {
+		return toPhysical(unpack(data));
+	}
+};
+
+/**
+ * Combined layout of a list of signals
+ */
+template <class... SIGNALS>
+struct CanSignalLayout;
+
+template <>
+struct CanSignalLayout<> {
+	static constexpr uint64_t MASK = 0;
+	static constexpr bool DISJOINT = true;
+	static constexpr unsigned BYTES = 0;
+};
+
+template <class S, class... REST>
+struct CanSignalLayout<S, REST...> {
+	static constexpr uint64_t MASK = S::MASK | CanSignalLayout<REST...>::MASK;
+	static constexpr bool DISJOINT = (S::MASK & CanSignalLayout<REST...>::MASK) == 0
+			&& CanSignalLayout<REST...>::DISJOINT;
+	static constexpr unsigned BYTES = (S::LAST_BYTE + 1 > CanSignalLayout<REST...>::BYTES)
+			? S::LAST_BYTE + 1 : CanSignalLayout<REST...>::BYTES;
+};
+
+/**
+ * Message description: ID, DLC and its signals. As soon as a member is
+ * used, the compiler checks that the signals do not overlap and fit into
+ * the DLC.
+ */
+template <uint32_t MSG_ID, uint8_t MSG_DLC, class... SIGNALS>
+struct CanMessage {
+	static_assert(MSG_DLC <= 8, "DLC has to be 0..8");
+	static_assert(CanSignalLayout<SIGNALS...>::DISJOINT, "signals overlap");
+	static_assert(CanSignalLayout<SIGNALS...>::BYTES <= MSG_DLC, "signal exceeds the DLC");
+
+	static constexpr uint32_t ID = MSG_ID;
+	static constexpr uint8_t DLC = MSG_DLC;
+};
+
+#endif /* CANSIGNAL_H_ */
@@ -2,14 +2,42 @@
 #define __DS18B20_H
 
 #include "stm32f4xx.h"
+#include "onewire.h"
 
 /* Defines
 **********************************************************************/
+typedef struct {
+	OwBus        *bus;
+	OwTransaction t;
+	uint8_t       cmd[13];
+	uint8_t       poll;              // last byte read while converting, 0 = busy
+	uint8_t       scratchpad[9];
+	uint8_t       rom[8];            // ROM code, used with Match ROM if hasRom is set
+	uint8_t       hasRom;            // 0 = only device on the bus, Skip ROM
+	uint8_t       resolution;        // 9..12 bit
+} Ds1820;
+
+#define DS1820_FAMILY           0x28     // first ROM byte of a DS18B20
+#define DS1820_RESOLUTION_MIN   9
+#define DS1820_RESOLUTION_MAX   12       // power-on default
+#define DS1820_SCRATCHPAD_LEN   9        // 8 data bytes + CRC
+#define DS1820_READ_RETRIES     3        // attempts of ds1820_read_temp() on a bad scratchpad
+#define DS1820_TEMP_INVALID     INT16_MIN // result of a failed ds1820_read_temp()
 
 /* Prototypes
 **********************************************************************/
-uint8_t ds1820_reset(GPIO_TypeDef * port, uint16_t used_pin);                    //reset device
-float   ds1820_read_temp(GPIO_TypeDef * port, uint16_t used_pin);                //read temperature from device
-void    ds1820_init(GPIO_TypeDef * port, uint16_t used_pin);                     //initialize device
+uint8_t  ds1820_init(Ds1820 * dev, OwBus * bus);                                   //initialize device
+uint8_t  ds1820_reset(Ds1820 * dev);                                               //reset device
+int16_t  ds1820_read_temp(Ds1820 * dev);                                           //read temperature from device in 1/16 °C
+int      ds1820_start_conversion(Ds1820 * dev, OwCallback done, void * ctx);       //start temperature conversion
+int      ds1820_start_poll(Ds1820 * dev, OwCallback done, void * ctx);             //check if the conversion is finished
+uint8_t  ds1820_conversion_done(Ds1820 * dev);                                     //result of ds1820_start_poll
+int      ds1820_start_read(Ds1820 * dev, OwCallback done, void * ctx);             //read scratchpad
+uint8_t  ds1820_scratchpad_valid(Ds1820 * dev);                                    //CRC check of the last read
+int16_t  ds1820_result_raw(Ds1820 * dev);                                          //temperature of the last read in 1/16 °C
+OwStatus ds1820_status(Ds1820 * dev);                                              //result of the last transaction
+uint8_t  ds1820_set_resolution(Ds1820 * dev, uint8_t bits);                        //write the configuration register
+uint32_t ds1820_conversion_time(Ds1820 * dev);                                     //max. conversion time in ms
+int      ds1820_search(OwBus * bus, Ds1820 * devs, int max);                      //find all devices on the bus
 
 #endif // __DS18B20_H
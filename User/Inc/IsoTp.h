@@ -0,0 +1,91 @@
+/*
+ * IsoTp.h
+ *
+ * ISO 15765-2 (ISO-TP) transport protocol on top of CanFrame.
+ * Payloads up to 4095 bytes are split into single/first/consecutive
+ * frames, the receiver paces the sender with flow control frames.
+ * Several sessions run at the same time, each is bound to a TX/RX ID
+ * pair. Received data is assembled in buffers supplied by the caller,
+ * data to send is read directly from the caller's buffer.
+ */
+
+#ifndef ISOTP_H_
+#define ISOTP_H_
+
+#include <stdint.h>
+
+#include "CanFrame.h"
+
+class IsoTp {
+public:
+	static const int MAX_SESSIONS = 4;
+	static const uint16_t MAX_LENGTH = 4095;
+
+	enum Result { OK, BUSY, INVALID, TIMEOUT, OVERFLOW };
+
+	typedef void (*RxHandler)(int session, const uint8_t *data, uint16_t len, void *ctx);
+	typedef void (*TxHandler)(int session, Result result, void *ctx);
+
+	IsoTp();
+	virtual ~IsoTp();
+
+	int open(uint32_t txId, uint32_t rxId, uint8_t *rxBuffer, uint16_t rxSize,
+			RxHandler rxHandler, TxHandler txHandler, void *ctx,
+			uint8_t blockSize = 0, uint8_t stMin = 0);
+	void close(int session);
+
+	Result send(int session, const uint8_t *data, uint16_t len);
+	bool isSending(int session);
+
+	bool onFrame(CanFrame &frame);
+	void poll(void);
+
+	static void dispatchHandler(const CanMsg *msg, void *ctx);
+
+private:
+	enum TxState { TX_IDLE, TX_SINGLE, TX_WAIT_FC, TX_CONSECUTIVE };
+	enum RxState { RX_IDLE, RX_CONSECUTIVE };
+
+	struct Session {
+		IsoTp *owner;
+		bool used;
+		uint32_t txId;
+		uint32_t rxId;
+		uint8_t blockSize;			// flow control parameters sent to the peer
+		uint8_t stMin;
+		RxHandler rxHandler;
+		TxHandler txHandler;
+		void *ctx;
+
+		TxState txState;
+		const uint8_t *txData;
+		uint16_t txLen;
+		uint16_t txPos;
+		uint8_t txSn;
+		uint8_t txBlockLeft;		// consecutive frames until the next flow control, 0 = unlimited
+		bool txBlockLimited;
+		uint32_t txStMinUs;
+		uint32_t txLastUs;			// time of the last frame sent / flow control timeout start
+
+		RxState rxState;
+		uint8_t *rxBuf;
+		uint16_t rxSize;
+		uint16_t rxLen;
+		uint16_t rxPos;
+		uint8_t rxSn;
+		uint8_t rxBlockLeft;
+		uint32_t rxLastUs;
+		int8_t fcPending;			// flow status of a flow control frame still to send, -1 = none
+	};
+
+	Session mSessions[MAX_SESSIONS];
+
+	void receive(Session &s, const uint8_t *data, unsigned int len);
+	void pumpTx(Session &s, uint32_t now);
+	bool sendFlowControl(Session &s, uint8_t status);
+	bool sendFrame(uint32_t id, const uint8_t *data, unsigned int len);
+	void finishTx(Session &s, Result result);
+	static uint32_t stMinToUs(uint8_t stMin);
+};
+
+#endif /* ISOTP_H_ */
@@ -1,15 +1,81 @@
 #ifndef CAN_H
 #define CAN_H
 
+#include <stdint.h>
+
+#include "canfilter.h"
+#include "canbittiming.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * CAN frame as it is passed between ISR and main loop
+ */
+typedef struct {
+	uint32_t id;			// 11 bit standard or 29 bit extended identifier
+	uint8_t  ide;			// 0 = standard, 1 = extended identifier
+	uint8_t  rtr;			// 1 = remote frame
+	uint8_t  dlc;
+	uint8_t  data[8];
+	uint32_t timestamp;		// reception (RX) or enqueue (TX) time in us, see canGetTimeUs
+} CanMsg;
+
+/**
+ * Operating modes, loopback modes receive their own frames
+ */
+typedef enum {
+	CAN_OPMODE_NORMAL = 0,
+	CAN_OPMODE_LOOPBACK,
+	CAN_OPMODE_SILENT,
+	CAN_OPMODE_SILENT_LOOPBACK
+} CanOpMode;
+
+typedef void (*CanTxCallback)(const CanMsg *msg, uint32_t timeUs);
+
+/**
+ * Receive statistics
+ */
+typedef struct {
+	uint32_t received;		// frames taken out of the hardware FIFO
+	uint32_t fifoOverruns;	// hardware FIFO0/FIFO1 overruns (frames lost in bxCAN)
+	uint32_t ringOverruns;	// frames dropped because the software ring was full
+	uint32_t ringHighWater;	// maximum fill level of the software ring
+} CanRxStats;
+
+/**
+ * Transmit statistics
+ */
+typedef struct {
+	uint32_t queued;		// frames accepted by canTransmit
+	uint32_t sent;			// frames confirmed by a TX mailbox complete interrupt
+	uint32_t rejected;		// frames refused because the TX queue was full
+	uint32_t queueHighWater;	// maximum fill level of the TX queue
+} CanTxStats;
+
+typedef struct CanTransport CanTransport;
+
 void canInitHardware(void);
+CanTransport *canBxcanTransport(void);
 void canInit(void);
 void canSendTask(void);
+void canPublishTask(void);
 void canReceiveTask(void);
 
+int canReceive(CanMsg *msg);
+void canGetRxStats(CanRxStats *stats);
+int canSetBitrate(uint32_t bitrate, uint32_t samplePointPermille, CanBitTiming *timing);
+void canGetBitTiming(CanBitTiming *timing);
+int canSetMode(CanOpMode mode);
+CanOpMode canGetMode(void);
+int canConfigureFilters(const CanFilterSet *set);
+int canTransmit(const CanMsg *msg);
+uint32_t canTxFree(void);
+void canGetTxStats(CanTxStats *stats);
+void canSetTxCompleteCallback(CanTxCallback callback);
+uint32_t canGetTimeUs(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,49 @@
+#ifndef CANBENCH_H
+#define CANBENCH_H
+
+#include <stdint.h>
+
+#include "can.h"
+#include "cantransport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_BENCH_ID		0x7F0	// identifier of the benchmark frames
+#define CAN_BENCH_SAMPLES	512		// latency samples kept per direction
+
+/**
+ * Latency percentiles in us
+ */
+typedef struct {
+	uint32_t samples;
+	uint32_t p50;
+	uint32_t p90;
+	uint32_t p99;
+	uint32_t max;
+} CanBenchLatency;
+
+/**
+ * Result of one benchmark run
+ */
+typedef struct {
+	CanOpMode mode;
+	uint32_t bitrate;
+	uint32_t durationUs;
+	uint32_t sent;				// frames confirmed by TX complete
+	uint32_t received;			// frames received back
+	uint32_t framesPerSecond;	// received frames per second
+	uint32_t busLoadPermille;	// bus time used by the sent frames
+	CanBenchLatency txLatency;	// canTransmit() to TX complete
+	CanBenchLatency rxLatency;	// TX complete to RX interrupt
+} CanBenchResult;
+
+int canBenchRun(CanTransport *t, CanOpMode mode, uint32_t durationMs, CanBenchResult *result);
+int canBenchFormat(const CanBenchResult *result, char *buf, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANBENCH_H
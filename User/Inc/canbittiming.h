@@ -0,0 +1,31 @@
+#ifndef CANBITTIMING_H
+#define CANBITTIMING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * bxCAN bit timing, all segment lengths in time quanta
+ */
+typedef struct {
+	uint32_t prescaler;		// 1..1024
+	uint32_t bs1;			// 1..16, propagation + phase segment 1
+	uint32_t bs2;			// 1..8, phase segment 2
+	uint32_t sjw;			// 1..4, resynchronization jump width
+	uint32_t bitrate;		// resulting bitrate in bit/s
+	int32_t  errorPpm;		// (bitrate - requested) / requested in ppm
+	uint32_t samplePointPermille;	// resulting sample point
+} CanBitTiming;
+
+int canBitTimingSolve(uint32_t clock, uint32_t bitrate, uint32_t samplePointPermille, CanBitTiming *timing);
+uint32_t canFrameBits(uint32_t id, uint8_t ide, uint8_t rtr, uint8_t dlc, const uint8_t *data);
+uint32_t canFrameBitsMax(uint8_t ide, uint8_t dlc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANBITTIMING_H
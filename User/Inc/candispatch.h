@@ -0,0 +1,42 @@
+#ifndef CANDISPATCH_H
+#define CANDISPATCH_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_DISPATCH_SLOTS		64	// max. number of subscribed IDs (<= 255)
+#define CAN_DISPATCH_EXT_SIZE	128	// hash table size for 29 bit IDs, power of two
+
+typedef void (*CanHandler)(const CanMsg *msg, void *ctx);
+
+/**
+ * Per ID handler statistics
+ */
+typedef struct {
+	uint32_t id;
+	uint8_t  ide;
+	uint32_t calls;			// number of handler runs
+	uint32_t maxUs;			// worst case handler run time
+	uint32_t totalUs;		// sum of handler run times
+} CanDispatchStats;
+
+void canDispatchInit(void);
+int canDispatchSubscribe(uint32_t id, uint8_t ide, CanHandler handler, void *ctx);
+void canDispatchUnsubscribe(uint32_t id, uint8_t ide);
+int canDispatchIsSubscribed(uint32_t id, uint8_t ide);
+int canDispatch(const CanMsg *msg);
+uint32_t canDispatchCount(void);
+int canDispatchGetStats(uint32_t index, CanDispatchStats *stats);
+void canDispatchGetRetiredStats(CanDispatchStats *stats);
+uint32_t canDispatchUnhandled(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANDISPATCH_H
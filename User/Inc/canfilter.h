@@ -0,0 +1,53 @@
+#ifndef CANFILTER_H
+#define CANFILTER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_FILTER_BANKS		28	// filter banks shared by CAN1 and CAN2
+#define CAN_FILTER_MAX_BANKS	(CAN_FILTER_BANKS - 1)	// CAN1 can own at most banks 0..26 (SlaveStartFilterBank <= 27)
+#define CAN_FILTER_MAX_ENTRIES	64	// ID/mask entries after splitting ranges
+
+/**
+ * One subscription: a single ID (first == last) or an ID range
+ */
+typedef struct {
+	uint32_t first;
+	uint32_t last;
+	uint8_t  ide;		// 0 = standard, 1 = extended identifier
+	uint8_t  fifo;		// 0 = FIFO0, 1 = FIFO1
+} CanFilterRule;
+
+/**
+ * Content of one bxCAN filter bank, fr1/fr2 are the raw register values
+ */
+typedef struct {
+	uint8_t  listMode;	// 1 = ID list, 0 = ID mask
+	uint8_t  scale16;	// 1 = 16 bit scale, 0 = 32 bit scale
+	uint8_t  fifo;
+	uint32_t fr1;
+	uint32_t fr2;
+} CanFilterBank;
+
+/**
+ * Result of canFilterCompile
+ */
+typedef struct {
+	CanFilterBank bank[CAN_FILTER_MAX_BANKS];
+	uint8_t  numBanks;
+	uint8_t  slaveStartBank;	// first bank left to CAN2
+	uint32_t wantedIds;			// number of IDs covered by the rules, overlaps counted once
+	uint32_t acceptedIds;		// number of IDs the hardware lets through, overlaps counted once
+	uint32_t falsePositivePermille;	// share of accepted IDs nobody subscribed to
+} CanFilterSet;
+
+int canFilterCompile(const CanFilterRule *rules, uint32_t numRules, uint32_t maxBanks, CanFilterSet *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANFILTER_H
@@ -0,0 +1,105 @@
+#ifndef CANMESSAGES_H
+#define CANMESSAGES_H
+
+#include <stdint.h>
+
+#include "can.h"
+#include "canstats.h"
+
+#ifdef __cplusplus
+
+#include "CanSignal.h"
+
+/**
+ * Temperature frame sent by canSendTask, ID 0x3
+ *   byte 0..1: temperature in 1/16 °C, signed, big endian, 0x8000 = no value
+ * The raw value is the DS18B20 register, it is sent without conversion.
+ */
+struct TemperatureMsg {
+	typedef CanSignal<7, 16, CAN_MOTOROLA, true, 1, 16> Temperature;
+
+	typedef CanMessage<0x003, 2, Temperature> Layout;
+	static const uint32_t ID = Layout::ID;
+	static const uint8_t DLC = Layout::DLC;
+};
+
+/**
+ * Status frame sent by cancppSendTask, ID 0x0F5
+ *   byte 0: marker 0xAF
+ *   byte 1: send counter
+ *   byte 2..3: temperature in 1/16 °C, signed, big endian, 0x8000 = no value
+ */
+struct StatusMsg {
+	typedef CanSignal<0, 8, CAN_INTEL> Marker;
+	typedef CanSignal<8, 8, CAN_INTEL> Counter;
+	typedef CanSignal<23, 16, CAN_MOTOROLA, true, 1, 16> Temperature;
+
+	typedef CanMessage<0x0F5, 4, Marker, Counter, Temperature> Layout;
+	static const uint32_t ID = Layout::ID;
+	static const uint8_t DLC = Layout::DLC;
+	static const uint8_t MARKER = 0xAF;
+};
+
+/**
+ * Statistics request, ID CAN_STATS_REQUEST_ID
+ *   byte 0: ID index, 0xFF = bus
+ *   byte 1: page
+ */
+struct StatsRequestMsg {
+	typedef CanSignal<0, 8, CAN_INTEL> Index;
+	typedef CanSignal<8, 8, CAN_INTEL> Page;
+
+	typedef CanMessage<CAN_STATS_REQUEST_ID, 2, Index, Page> Layout;
+	static const uint32_t ID = Layout::ID;
+	static const uint8_t DLC = Layout::DLC;
+};
+
+/**
+ * Statistics reply, ID CAN_STATS_REPLY_ID, byte 0 and 1 repeat the request,
+ * values are saturated to their length. Bytes 2..7 depend on the page:
+ *   bus page 0: load, worst case load, peak load, 16 bit each, in 0.1 %
+ *   bus page 1: frames/s 16 bit, number of IDs 8 bit, untracked frames 16 bit
+ *   ID page 0:  ID 32 bit (bit 31 = extended), frames/s 16 bit
+ *   ID page 1:  min gap, max gap, jitter, 16 bit each, in 100 us
+ *   ID page 2:  frames 32 bit, payload changes 16 bit in 0.1 %
+ */
+struct StatsReplyMsg {
+	typedef CanSignal<0, 8, CAN_INTEL> Index;
+	typedef CanSignal<8, 8, CAN_INTEL> Page;
+	typedef CanSignal<16, 16, CAN_INTEL> Word0;
+	typedef CanSignal<32, 16, CAN_INTEL> Word1;
+	typedef CanSignal<48, 16, CAN_INTEL> Word2;
+	typedef CanSignal<16, 32, CAN_INTEL> Long0;
+	typedef CanSignal<32, 8, CAN_INTEL> Byte2;
+	typedef CanSignal<40, 16, CAN_INTEL> Word3;
+	typedef CanSignal<16, 16, CAN_INTEL, false, 100> Gap0;
+	typedef CanSignal<32, 16, CAN_INTEL, false, 100> Gap1;
+	typedef CanSignal<48, 16, CAN_INTEL, false, 100> Gap2;
+
+	// one layout per page
+	typedef CanMessage<CAN_STATS_REPLY_ID, 8, Index, Page, Word0, Word1, Word2> BusLoad;
+	typedef CanMessage<CAN_STATS_REPLY_ID, 8, Index, Page, Word0, Byte2, Word3> BusCount;
+	typedef CanMessage<CAN_STATS_REPLY_ID, 8, Index, Page, Long0, Word2> IdRate;
+	typedef CanMessage<CAN_STATS_REPLY_ID, 8, Index, Page, Gap0, Gap1, Gap2> IdTiming;
+	typedef CanMessage<CAN_STATS_REPLY_ID, 8, Index, Page, Long0, Word2> IdCount;
+	static const uint32_t ID = CAN_STATS_REPLY_ID;
+};
+
+// byte order checks, 0x1234 has to show up as 12 34 in the payload
+static_assert(TemperatureMsg::Temperature::image(0x1234) == 0x3412, "temperature has to be big endian");
+static_assert(StatusMsg::Temperature::image(0x1234) == 0x34120000, "temperature has to be big endian");
+
+extern "C" {
+#endif
+
+void canTemperatureMsgEncode(CanMsg *msg, int16_t temperature);
+int16_t canTemperatureMsgRaw(const CanMsg *msg);
+int canStatsRequestMsgDecode(const CanMsg *msg, uint8_t *index, uint8_t *page);
+int canStatsBusMsgEncode(CanMsg *msg, uint8_t page, const CanStatsBus *bus);
+int canStatsEntryMsgEncode(CanMsg *msg, uint8_t index, uint8_t page, const CanStatsEntry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANMESSAGES_H
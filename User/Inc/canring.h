@@ -0,0 +1,37 @@
+#ifndef CANRING_H
+#define CANRING_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// number of frames in the RX ring, has to be a power of two
+#define CAN_RX_RING_SIZE	64
+
+/**
+ * Single-producer/single-consumer ring of CAN frames.
+ * The producer (RX ISR) only writes head, the consumer (main loop) only
+ * writes tail, so no locking is needed between them.
+ */
+typedef struct {
+	volatile uint32_t head;		// free running write index
+	volatile uint32_t tail;		// free running read index
+	volatile uint32_t overruns;	// frames dropped because the ring was full
+	volatile uint32_t highWater;	// maximum fill level since init
+	CanMsg buf[CAN_RX_RING_SIZE];
+} CanRing;
+
+void canRingInit(CanRing *ring);
+int canRingPush(CanRing *ring, const CanMsg *msg);
+int canRingPop(CanRing *ring, CanMsg *msg);
+uint32_t canRingCount(const CanRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANRING_H
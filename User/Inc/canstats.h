@@ -0,0 +1,63 @@
+#ifndef CANSTATS_H
+#define CANSTATS_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_STATS_IDS			64			// max. number of tracked IDs
+#define CAN_STATS_HASH_SIZE		128			// hash table size, power of two
+#define CAN_STATS_WINDOW_US		1000000		// bus load averaging window
+
+#define CAN_STATS_REQUEST_ID	0x7E0		// statistics query
+#define CAN_STATS_REPLY_ID		0x7E8		// statistics answer
+
+#define CAN_STATS_RX			0
+#define CAN_STATS_TX			1
+
+/**
+ * Per ID statistics
+ */
+typedef struct {
+	uint32_t id;
+	uint8_t  ide;
+	uint32_t rxFrames;
+	uint32_t txFrames;
+	uint32_t changes;			// frames whose payload differs from the previous one
+	uint32_t minGapUs;			// inter-arrival time
+	uint32_t maxGapUs;
+	uint32_t meanGapUs;			// moving average over about 8 frames
+	uint32_t jitterUs;			// moving average of |gap - meanGap| over about 16 frames
+	uint32_t framesPerSecond;	// 1000000 / meanGapUs
+	uint32_t changePermille;	// changes / frames
+} CanStatsEntry;
+
+/**
+ * Bus statistics of the last complete window
+ */
+typedef struct {
+	uint32_t frames;			// since init
+	uint32_t untracked;			// frames of IDs that did not fit into the table
+	uint32_t numIds;
+	uint32_t framesPerSecond;
+	uint32_t loadPermille;		// from the exact frame length incl. stuff bits
+	uint32_t worstLoadPermille;	// assuming the maximum number of stuff bits per DLC
+	uint32_t peakLoadPermille;	// highest loadPermille since init
+} CanStatsBus;
+
+void canStatsInit(void);
+void canStatsFrame(const CanMsg *msg, uint8_t dir, uint32_t timeUs);
+void canStatsGetBus(CanStatsBus *bus);
+int canStatsGetEntry(uint32_t index, CanStatsEntry *entry);
+int canStatsTopTalker(CanStatsEntry *entry);
+void canStatsRequestHandler(const CanMsg *msg, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANSTATS_H
@@ -0,0 +1,35 @@
+#ifndef CANTRANSPORT_H
+#define CANTRANSPORT_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Interface between the CAN protocol code and a CAN controller.
+ * Backends: bxCAN (can.c) and the host virtual bus (Host/Src/canvbus.c).
+ */
+struct CanTransport {
+	int       (*transmit)(CanTransport *self, const CanMsg *msg);	// 1 = queued, 0 = queue full
+	int       (*receive)(CanTransport *self, CanMsg *msg);			// 1 = frame returned
+	uint32_t  (*txFree)(CanTransport *self);						// frames transmit can still accept
+	uint32_t  (*timeUs)(CanTransport *self);						// timebase of the timestamps
+	void      (*idle)(CanTransport *self);							// called by busy wait loops
+	uint32_t  (*bitrate)(CanTransport *self);
+	int       (*setMode)(CanTransport *self, CanOpMode mode);
+	CanOpMode (*getMode)(CanTransport *self);
+	void      (*setTxCallback)(CanTransport *self, CanTxCallback callback);
+};
+
+void canTransportSet(CanTransport *transport);
+CanTransport *canTransportGet(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANTRANSPORT_H
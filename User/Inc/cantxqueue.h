@@ -0,0 +1,42 @@
+#ifndef CANTXQUEUE_H
+#define CANTXQUEUE_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// number of frames waiting for a free TX mailbox
+#define CAN_TX_QUEUE_SIZE	32
+
+typedef struct {
+	uint32_t key;		// arbitration key, lower value wins
+	uint32_t seq;
+	CanMsg msg;
+} CanTxEntry;
+
+/**
+ * Software TX queue ordered by CAN arbitration priority.
+ * Frames with the same priority leave the queue in FIFO order.
+ * The queue itself is not interrupt safe, the caller has to lock.
+ */
+typedef struct {
+	uint32_t count;
+	uint32_t seq;			// insertion counter, keeps equal IDs in FIFO order
+	uint32_t highWater;		// maximum count since init
+	CanTxEntry heap[CAN_TX_QUEUE_SIZE];
+} CanTxQueue;
+
+void canTxQueueInit(CanTxQueue *q);
+int canTxQueuePush(CanTxQueue *q, const CanMsg *msg);
+int canTxQueuePop(CanTxQueue *q, CanMsg *msg);
+uint32_t canArbitrationKey(const CanMsg *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CANTXQUEUE_H
@@ -54,7 +54,7 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
-
+uint32_t APB1_TimerPrescaler(uint32_t tickHz);
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
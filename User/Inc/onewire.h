@@ -0,0 +1,96 @@
+#ifndef ONEWIRE_H
+#define ONEWIRE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	OW_OK,
+	OW_BUSY,			// transaction is running
+	OW_NO_PRESENCE,		// no device answered the reset pulse
+	OW_SHORT,			// line stays low after the reset
+	OW_SEARCH_FAILED,	// no device answered a search triplet
+	OW_BUS_ERROR		// the bus master failed, e.g. UART or DMA error
+} OwStatus;
+
+typedef struct OwTransaction OwTransaction;
+typedef struct OwBus OwBus;
+
+typedef void (*OwCallback)(OwTransaction *t, void *ctx);
+
+/**
+ * One 1-Wire transaction: optional reset, then txLen bytes written, then
+ * rxLen bytes read, LSB first. The buffers have to stay valid until the
+ * transaction has finished. done is called from interrupt context.
+ *
+ * With search set, 64 Search ROM triplets (read bit, read complement,
+ * write direction) follow instead of the read: rx[0..7] holds the
+ * preferred direction for positions where the devices differ and returns
+ * the ROM code, conflicts[0..7] returns where the devices differed.
+ */
+struct OwTransaction {
+	uint8_t reset;				// start with reset pulse and presence detect
+	const uint8_t *tx;
+	uint16_t txLen;
+	uint8_t *rx;
+	uint16_t rxLen;
+	uint8_t search;
+	uint8_t *conflicts;
+	volatile OwStatus status;
+	OwCallback done;			// may be NULL, may start the next transaction
+	void *ctx;
+};
+
+/**
+ * Interface between the device drivers and a 1-Wire bus master.
+ * Backends: GPIO + TIM3 compare interrupt (onewiretim.c),
+ * half-duplex UART + DMA (onewireuart.c), up to 16 lines of one GPIO
+ * port in parallel + TIM4 (onewirepar.c).
+ */
+struct OwBus {
+	int  (*start)(OwBus *self, OwTransaction *t);		// 1 = started, 0 = bus busy
+	int  (*busy)(OwBus *self);
+	void (*idle)(OwBus *self);							// called by busy wait loops
+};
+
+void owSetup(OwTransaction *t, uint8_t reset, const uint8_t *tx, uint16_t txLen,
+		uint8_t *rx, uint16_t rxLen, OwCallback done, void *ctx);
+OwStatus owRun(OwBus *bus, OwTransaction *t);
+
+#define OW_SEARCH_ROM	0xF0
+#define OW_MATCH_ROM	0x55
+#define OW_SKIP_ROM		0xCC
+
+// slot timing in us of the timer driven masters, onewiretim.c and onewirepar.c
+#define OW_Delay_A		6		// low time of a 1 / read slot
+#define OW_Delay_B		64		// rest of a 1 slot
+#define OW_Delay_C		61		// low time of a 0 slot, one more for the CNT truncation
+#define OW_Delay_D		9		// rest of a 0 slot
+#define OW_Delay_E		9		// release to sample point of a read slot
+#define OW_Delay_F		55		// rest of a read slot
+#define OW_Delay_H		481		// reset pulse, one more for the CNT truncation
+#define OW_Delay_I		70		// release to presence sample point
+#define OW_Delay_J		409		// rest of the reset
+
+/**
+ * State of a Search ROM enumeration
+ */
+typedef struct {
+	int8_t  lastConflict;		// position where the 0 branch was taken last, -1 = none
+	uint8_t done;
+	uint8_t rom[8];				// ROM code found last
+} OwSearch;
+
+void owSearchInit(OwSearch *s);
+int owSearchNext(OwBus *bus, OwSearch *s, uint8_t rom[8]);
+uint8_t owTripletDirection(OwTransaction *t, uint32_t index, uint8_t bit, uint8_t complement);
+uint8_t owCrc8(const uint8_t *data, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ONEWIRE_H
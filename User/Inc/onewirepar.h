@@ -0,0 +1,68 @@
+#ifndef ONEWIREPAR_H
+#define ONEWIREPAR_H
+
+#include <stdint.h>
+
+#include "stm32f4xx.h"
+#include "onewire.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// pins of one GPIO port
+#define OW_PAR_LINES	16
+
+typedef struct OwParGroup OwParGroup;
+
+/**
+ * One 1-Wire bus of a group, used like any other OwBus
+ */
+typedef struct {
+	OwBus          bus;			// has to be the first member
+	OwParGroup    *group;
+	uint16_t       pin;
+	OwTransaction *trans;		// queued or running transaction, NULL = idle
+	uint32_t       bitPos;		// slots done, tx bits first
+	uint8_t        tripletBits;	// bit and complement of the current search triplet
+	uint8_t        active;		// takes part in the running slot sequence
+	uint8_t        finished;	// done has to be called at the end of the run
+} OwParLine;
+
+/**
+ * Up to 16 1-Wire buses on pins of one GPIO port, timed by TIM4. The
+ * transactions of all lines run at the same time: every slot is one BSRR
+ * write pulling all lines low, one releasing the 1 / read lines, one IDR
+ * read sampling all of them and one releasing the 0 lines.
+ *
+ * A transaction started on an idle group starts a run at once. To run
+ * several lines together, start their transactions between owParHold()
+ * and owParRelease(). The done callbacks are called at the end of the
+ * run with the group held, so transactions started from them run
+ * together again. Only one run at a time, TIM4 is shared by all groups:
+ * a group released while another one runs starts when that run ends,
+ * groups with queued transactions take turns.
+ *
+ * Blocking calls (owRun() and the blocking DS18B20 functions) do not
+ * wait for owParRelease() on a held group: their busy wait starts the
+ * run with all transactions queued so far, the group stays held.
+ */
+struct OwParGroup {
+	GPIO_TypeDef *port;
+	OwParLine    *lines[OW_PAR_LINES];
+	uint8_t       numLines;
+	uint8_t       held;
+	OwParGroup   *next;			// list of all groups, see owParInit()
+};
+
+void owParInit(OwParGroup *group, GPIO_TypeDef *port);
+int owParAddLine(OwParGroup *group, OwParLine *line, uint16_t pin);
+void owParHold(OwParGroup *group);
+void owParRelease(OwParGroup *group);
+void TIM4_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ONEWIREPAR_H
@@ -0,0 +1,54 @@
+#ifndef ONEWIRETIM_H
+#define ONEWIRETIM_H
+
+#include <stdint.h>
+
+#include "stm32f4xx.h"
+#include "onewire.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 1-Wire master on a GPIO pin, timed by TIM3. Only one transaction can
+ * run at a time for all buses of this type, TIM3 is shared.
+ */
+typedef struct {
+	OwBus         bus;		// has to be the first member
+	GPIO_TypeDef *port;
+	uint16_t      pin;
+} OwTimBus;
+
+#define OW_TIM_MIN_AHEAD	2		// compare value has to be this far ahead of CNT
+
+void owTimInit(OwTimBus *bus, GPIO_TypeDef *port, uint16_t pin);
+void TIM3_IRQHandler(void);
+
+/**
+ * Set compare channel 1 of a 1 MHz timer, a time that has already passed
+ * is moved to right now, the 16 bit compare would otherwise only match
+ * after 65 ms. Also used by onewirepar.c with TIM4.
+ */
+static inline void owTimSchedule(TIM_TypeDef *tim, uint16_t at) {
+	uint16_t now = tim->CNT;
+
+	if ((int16_t)(at - now) < OW_TIM_MIN_AHEAD) {
+		at = now + OW_TIM_MIN_AHEAD;
+	}
+	tim->CCR1 = at;
+}
+
+/**
+ * Busy wait until the 16 bit counter of a 1 MHz timer reaches at
+ */
+static inline void owTimWaitUntil(TIM_TypeDef *tim, uint16_t at) {
+	while ((int16_t)(tim->CNT - at) < 0) {
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ONEWIRETIM_H
@@ -0,0 +1,44 @@
+#ifndef ONEWIREUART_H
+#define ONEWIREUART_H
+
+#include <stdint.h>
+
+#include "stm32f4xx.h"
+#include "onewire.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// time slots per DMA transfer, one UART byte each
+#define OW_UART_SLOTS	128
+
+/**
+ * 1-Wire master on UART5 in half-duplex mode (TX pin PC12, open drain).
+ * Reset is one 0xF0 byte at 9600 baud, every time slot one byte at
+ * 115200 baud, moved by DMA in both directions.
+ */
+typedef struct {
+	OwBus              bus;		// has to be the first member
+	UART_HandleTypeDef huart;
+	DMA_HandleTypeDef  dmaTx;
+	DMA_HandleTypeDef  dmaRx;
+	OwTransaction     *trans;
+	uint32_t           bitPos;		// slots done, tx bits first
+	uint32_t           chunk;		// slots in the running DMA transfer
+	uint8_t            resetting;
+	uint8_t            tripletBits;	// bit and complement of the current search triplet
+	uint8_t            txBuf[OW_UART_SLOTS];
+	uint8_t            rxBuf[OW_UART_SLOTS];
+} OwUartBus;
+
+void owUartInit(OwUartBus *bus);
+void UART5_IRQHandler(void);
+void DMA1_Stream0_IRQHandler(void);
+void DMA1_Stream7_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ONEWIREUART_H
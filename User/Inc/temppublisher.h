@@ -0,0 +1,56 @@
+#ifndef TEMPPUBLISHER_H
+#define TEMPPUBLISHER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TEMP_PUBLISHER_MEDIAN_SIZE	5		// samples of the median filter, odd
+
+typedef enum {
+	TEMP_PUBLISHER_FILTER_NONE,
+	TEMP_PUBLISHER_FILTER_EWMA,		// exponentially weighted moving average
+	TEMP_PUBLISHER_FILTER_MEDIAN	// median of the last TEMP_PUBLISHER_MEDIAN_SIZE samples
+} TempPublisherFilter;
+
+/**
+ * Publishing rules, temperatures in 1/16 °C
+ */
+typedef struct {
+	int16_t  deadband;			// send when the filtered value moved at least this far
+	uint32_t minPeriodMs;		// never send faster
+	uint32_t maxPeriodMs;		// send at least this often, 0 = only on change
+	uint32_t fixedPeriodMs;		// period of fixed-rate sending, reference for the report
+	TempPublisherFilter filter;
+	uint8_t  ewmaShift;			// EWMA weight of a new sample is 1 / 2^ewmaShift
+} TempPublisherConfig;
+
+/**
+ * Frames sent compared with fixed-rate sending, since init
+ */
+typedef struct {
+	uint32_t samples;			// values passed to tempPublisherSample()
+	uint32_t sent;				// frames sent
+	uint32_t sentOnChange;		// because of the deadband
+	uint32_t sentOnTimeout;		// because of maxPeriodMs
+	uint32_t fixedRateFrames;	// frames fixed-rate sending would have sent
+	uint32_t savedFrames;		// fixedRateFrames - sent, 0 if more have been sent
+	uint32_t savedPermille;		// savedFrames / fixedRateFrames
+} TempPublisherStats;
+
+// transmit one value, return 1 on success, 0 to retry on the next task call
+typedef int (*TempPublisherSend)(int16_t temperature, void *ctx);
+
+void tempPublisherInit(const TempPublisherConfig *config, TempPublisherSend send, void *ctx, uint32_t nowMs);
+void tempPublisherSample(int16_t temperature);
+void tempPublisherTask(uint32_t nowMs);
+int16_t tempPublisherFiltered(void);
+void tempPublisherGetStats(TempPublisherStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TEMPPUBLISHER_H
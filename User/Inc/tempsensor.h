@@ -1,14 +1,54 @@
 #ifndef __TEMPSENSOR_H
 #define __TEMPSENSOR_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void tempSensorInit(void);
-float tempSensorGetTemperature(void);
+typedef enum {
+	TEMP_SENSOR_IDLE,			// no conversion running
+	TEMP_SENSOR_CONVERTING,		// conversion started, result not ready yet
+	TEMP_SENSOR_READING,		// conversion finished, the scratchpads are being read
+	TEMP_SENSOR_READY,			// conversion finished, result can be read
+	TEMP_SENSOR_ERROR			// no device answered or the conversion timed out
+} TempSensorState;
+
+#define TEMP_SENSOR_MAX		20		// sensors on the bus
+#define TEMP_SENSOR_RESOLUTION	12		// default resolution in bit, 9 = 94 ms, 12 = 750 ms conversion
+
+#define TEMP_SENSOR_INVALID	INT16_MIN	// temperature before the first valid read
+#define TEMP_SENSOR_RETRIES	2		// extra reads per sensor and sweep on a bad scratchpad
+
+/**
+ * Error counters of one sensor, since init
+ */
+typedef struct {
+	uint32_t reads;				// scratchpad reads incl. retries
+	uint32_t crcErrors;			// CRC mismatch or invalid scratchpad
+	uint32_t busErrors;			// no presence pulse, line shorted or bus master error
+	uint32_t failedSweeps;		// sweeps without a valid value after all retries
+} TempSensorErrors;
+
+// temperatures are fixed point values in 1/16 °C, the DS18B20 register format
+typedef void (*TempSensorCallback)(int index, int16_t temperature, void *ctx);
+
+void tempSensorInit(uint8_t resolution);
+int16_t tempSensorGetTemperature(void);
+int tempSensorCount(void);
+int16_t tempSensorGetTemperatureOf(int index);
+int tempSensorGetRom(int index, uint8_t rom[8]);
+int tempSensorGetErrors(int index, TempSensorErrors *errors);
+
+int tempSensorStartConversion(void);
+TempSensorState tempSensorPoll(void);
+int16_t tempSensorReadResult(void);
+int tempSensorHasValue(void);
+void tempSensorSetCallback(TempSensorCallback callback, void *ctx);
+void tempSensorTask(void);
+int tempSensorFormat(char *buf, size_t size, int16_t temperature);
 
 #ifdef __cplusplus
 }
@@ -6,15 +6,13 @@
  */
 
 #include "CanFrame.h"
-#include "main.h"
+#include "cantransport.h"
 #include "stm32f429i_discovery_lcd.h"
 
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 
-extern CAN_HandleTypeDef canHandle;
-
 CanFrame::CanFrame() : mDataSize(0), mId(0xFFFFFFFF) {
 
 }
@@ -46,57 +44,42 @@ bool CanFrame::addData(uint8_t data) {
 }
 
 bool CanFrame::txData(void) {
-	uint32_t TxMailbox;
-	CAN_TxHeaderTypeDef txHeader;
+	CanMsg txMsg;
 
 	if(!isValid()) {
 		return false;
 	}
-	if (HAL_CAN_GetTxMailboxesFreeLevel(&canHandle) != 3 ) {
-		// only send message if none is in queue
-		return false;
-	}
 
 	// daten frame vorbereiten
-	txHeader.StdId = mId;
-	txHeader.ExtId = 0x00;
-	txHeader.RTR = CAN_RTR_DATA;
-	txHeader.IDE = CAN_ID_STD;
-	txHeader.DLC = mDataSize;
-
-	/* Start the Transmission process */
-	if (HAL_CAN_AddTxMessage(&canHandle, &txHeader, mData, &TxMailbox) != HAL_OK)
-	{
-		/* Transmission request Error */
-		Error_Handler();
-		return false;
-	}
-
-	return true;
+	txMsg.id = mId;
+	txMsg.ide = 0;
+	txMsg.rtr = 0;
+	txMsg.dlc = mDataSize;
+	memcpy(txMsg.data, mData, mDataSize);
+
+	/* Queue the frame, false tells the caller that the TX queue is full */
+	CanTransport *t = canTransportGet();
+	return t->transmit(t, &txMsg);
 }
 
 bool CanFrame::rxData(void) {
-	CAN_RxHeaderTypeDef rxHeader;
-	uint8_t rxData[8];
+	CanMsg rxMsg;
+	CanTransport *t = canTransportGet();
 
-	if (HAL_CAN_GetRxFifoFillLevel(&canHandle, CAN_RX_FIFO0) == 0) {
+	if (!t->receive(t, &rxMsg)) {
 		return false;
 	}
 
-	if (HAL_CAN_GetRxMessage(&canHandle, CAN_RX_FIFO0, &rxHeader, rxData) != HAL_OK)
-	{
-		/* Reception Error */
-		return false;
-	}
-
-
-
-	mId = rxHeader.StdId;
-	memcpy(mData, rxData, rxHeader.DLC);
-	mDataSize = rxHeader.DLC;
+	setMsg(&rxMsg);
 	return true;
 }
 
+void CanFrame::setMsg(const CanMsg *msg) {
+	mId = msg->id;
+	mDataSize = (msg->dlc > 8) ? 8 : msg->dlc;
+	memcpy(mData, msg->data, mDataSize);
+}
+
 void CanFrame::getData(uint8_t *data, unsigned int *len) {
 	memcpy(data, mData, mDataSize);
 	*len = mDataSize;
@@ -118,7 +101,7 @@ void CanFrame::printData(unsigned int ln, unsigned int col) {
 		return;
 	}
 	LCD_SetPrintPosition(ln, col);
-	printf ("%03lx", mId);
+	printf ("%03lx", (unsigned long)mId);
 	col += 5;
 	for (int i = 0; i < mDataSize; i++) {
 		LCD_SetPrintPosition(ln, col);
@@ -3,199 +3,243 @@
  **                           DS18B20.c
  ** Source: https://www.mikrocontroller.net/topic/378438
  **
+ ** The bus timing is done by the 1-Wire bus master (onewire.h), every
+ ** ds1820_start_* function only queues one transaction and returns.
+ ** done is called from interrupt context when it has finished.
+ **
+ ** Several devices on one bus are found with ds1820_search(), each one
+ ** is then addressed with Match ROM. Convert T always uses Skip ROM, so
+ ** all devices on the bus convert at the same time, and the poll answers
+ ** 0 as long as any of them is still converting.
+ **
  **********************************************************************/
 
 /* Includes
  **********************************************************************/
 #include "DS18B20.h"
-#include "math.h"
-
-#define OW_Delay_A          (uint32_t) 6
-#define OW_Delay_B          (uint32_t) 64
-#define OW_Delay_C          (uint32_t) 60
-#define OW_Delay_D          (uint32_t) 10
-#define OW_Delay_E          (uint32_t) 9
-#define OW_Delay_F          (uint32_t) 55
-#define OW_Delay_G          (uint32_t) 0
-#define OW_Delay_H          (uint32_t) 480
-#define OW_Delay_I          (uint32_t) 70
-#define OW_Delay_J          (uint32_t) 410
-
-static void    ds1820_wr_bit(uint8_t wrbit, GPIO_TypeDef * port, uint16_t used_pin);    //write one bit to device
-static void    ds1820_wr_byte(uint8_t wrbyte, GPIO_TypeDef * port, uint16_t used_pin);  //write one byte to device
-static uint8_t ds1820_re_bit(GPIO_TypeDef * port, uint16_t used_pin);                   //read one bit from device
-static uint8_t ds1820_re_byte(GPIO_TypeDef * port, uint16_t used_pin);                  //read one byte from device
+
+#include <string.h>
+
+#define DS1820_SKIP_ROM         OW_SKIP_ROM
+#define DS1820_MATCH_ROM        OW_MATCH_ROM
+#define DS1820_CONVERT_T        0x44
+#define DS1820_READ_SCRATCHPAD  0xBE
+#define DS1820_WRITE_SCRATCHPAD 0x4E
+#define DS1820_COPY_SCRATCHPAD  0x48
+#define DS1820_CONFIG_RESERVED  0x1F     //bits 0..4 of the configuration register read as 1
+#define DS1820_COPY_POLLS       100      //busy checks after Copy Scratchpad, 560 us each, 10 ms needed
+
+static void setup_conversion(Ds1820 * dev, OwCallback done, void * ctx);   //transaction for Convert T
+static void setup_poll(Ds1820 * dev, OwCallback done, void * ctx);         //transaction for the busy check
+static void setup_read(Ds1820 * dev, uint16_t len, OwCallback done, void * ctx);   //transaction for Read Scratchpad
+static uint16_t setup_address(Ds1820 * dev);                              //Match ROM or Skip ROM into dev->cmd
 
 /* Functions
  **********************************************************************/
 
-static void Delay_us(__IO uint16_t us){
-	volatile uint16_t usStart = (uint16_t)TIM3->CNT;
-	while((TIM3->CNT - usStart) < us){
-		__asm("nop");
-	}
+//initialize device, returns the reset error
+uint8_t ds1820_init(Ds1820 * dev, OwBus * bus){
+	dev->bus = bus;
+	dev->poll = 0;
+	dev->hasRom = 0;
+	dev->resolution = DS1820_RESOLUTION_MAX;
+	return ds1820_reset(dev);
 }
 
-//reset device
-uint8_t ds1820_reset(GPIO_TypeDef * port, uint16_t used_pin){
-	uint8_t err=100;
+//reset device, 0 = device present, 1 = no device, 2 = short circuit, 3 = bus master error
+uint8_t ds1820_reset(Ds1820 * dev){
+	owSetup(&dev->t, 1, 0, 0, 0, 0, 0, 0);
+	switch (owRun(dev->bus, &dev->t)){
+	case OW_OK:
+		return 0;
+	case OW_SHORT:
+		return 2;
+	case OW_BUS_ERROR:
+		return 3;
+	default:
+		return 1;
+	}
+}
 
-	Delay_us(OW_Delay_G);                             // 0us (standard)
-	port->ODR &= ~used_pin;                           // Pull low
-	Delay_us(OW_Delay_H);							    // 480us (standard)
-	port->ODR |= used_pin;                            // Pull high over extern pullup
-	Delay_us(OW_Delay_I-10);							    // 70us (standard)
-	if((port->IDR & used_pin) > 0){
-		err = 1;
-	}else{
-		err = 0;
+//start temperature conversion
+int ds1820_start_conversion(Ds1820 * dev, OwCallback done, void * ctx){
+	if (dev->bus->busy(dev->bus)){                           //dev->t may still be in use
+		return 0;
 	}
-	Delay_us(OW_Delay_J);							    // 410us (standard)
+	setup_conversion(dev, done, ctx);
+	return dev->bus->start(dev->bus, &dev->t);
+}
 
-	if((port->IDR & used_pin) == 0 ){			// short circuit --> err=2
-		err = 2;
+//read 8 time slots, the device answers with 0 while converting
+int ds1820_start_poll(Ds1820 * dev, OwCallback done, void * ctx){
+	if (dev->bus->busy(dev->bus)){                           //dev->t may still be in use
+		return 0;
 	}
+	setup_poll(dev, done, ctx);
+	return dev->bus->start(dev->bus, &dev->t);
+}
 
-	return err;
+//check if the conversion is finished
+uint8_t ds1820_conversion_done(Ds1820 * dev){
+	return dev->poll != 0;
 }
 
-//write one bit to device
-static void ds1820_wr_bit(uint8_t wrbit, GPIO_TypeDef * port, uint16_t used_pin){
-	if (wrbit == 0){
-		port->ODR &= ~used_pin;                         // Pull low
-		Delay_us(OW_Delay_C);                           // 60us (standard)
-		port->ODR |= used_pin;                          // Pull high over extern pullup
-		Delay_us(OW_Delay_D);                           // 10us (standard)
+//read the scratchpad
+int ds1820_start_read(Ds1820 * dev, OwCallback done, void * ctx){
+	if (dev->bus->busy(dev->bus)){                           //dev->t may still be in use
+		return 0;
 	}
-	if (wrbit == 1){
-		port->ODR &= ~used_pin;                         // Pull low
-		Delay_us(OW_Delay_A);                           // 6us (standard)
-		port->ODR |= used_pin;                          // Pull high over extern pullup
-		Delay_us(OW_Delay_B);                           // 64us (standard)
+	setup_read(dev, DS1820_SCRATCHPAD_LEN, done, ctx);
+	return dev->bus->start(dev->bus, &dev->t);
+}
+
+//result of the last transaction
+OwStatus ds1820_status(Ds1820 * dev){
+	return dev->t.status;
+}
+
+//find the DS18B20 on the bus, returns the number of devices stored in devs
+int ds1820_search(OwBus * bus, Ds1820 * devs, int max){
+	OwSearch search;
+	uint8_t rom[8];
+	int n = 0;
+
+	owSearchInit(&search);
+	while (n < max && owSearchNext(bus, &search, rom)){
+		if (rom[0] != DS1820_FAMILY || owCrc8(rom, 8) != 0){ //other 1-Wire devices or bit errors
+			continue;
+		}
+		devs[n].bus = bus;
+		devs[n].poll = 0;
+		memcpy(devs[n].rom, rom, 8);
+		devs[n].hasRom = 1;
+		devs[n].resolution = DS1820_RESOLUTION_MAX;
+		n++;
 	}
+	return n;
 }
 
-//write one byte to device
-static void ds1820_wr_byte(uint8_t wrbyte, GPIO_TypeDef * port, uint16_t used_pin){
-	uint8_t i;
-	for (i=0; i<8; i++){ // writes byte, one bit at a time
-		ds1820_wr_bit((wrbyte & 0x01), port, used_pin);
-		wrbyte = wrbyte >> 1;
+//set the resolution to 9..12 bit, returns 0 on success, 1 if the device did not answer
+//the configuration is only written and copied to the EEPROM if it differs
+uint8_t ds1820_set_resolution(Ds1820 * dev, uint8_t bits){
+	uint8_t config;
+	uint16_t len;
+	int i;
+
+	if (bits < DS1820_RESOLUTION_MIN) bits = DS1820_RESOLUTION_MIN;
+	if (bits > DS1820_RESOLUTION_MAX) bits = DS1820_RESOLUTION_MAX;
+	config = ((bits - DS1820_RESOLUTION_MIN) << 5) | DS1820_CONFIG_RESERVED;
+
+	setup_read(dev, DS1820_SCRATCHPAD_LEN, 0, 0);            //TH, TL and configuration are needed
+	if (owRun(dev->bus, &dev->t) != OW_OK || !ds1820_scratchpad_valid(dev)){
+		return 1;
 	}
-	Delay_us(5);
-}
-
-//read one bit from device
-static uint8_t ds1820_re_bit(GPIO_TypeDef * port, uint16_t used_pin){
-	uint8_t rebit;
-	port->ODR &= ~used_pin;                           // Pull low
-	Delay_us(OW_Delay_A);                             // 6us (standard)
-	port->ODR |= used_pin;                            // Pull high over extern pullup
-	Delay_us(OW_Delay_E);							    // 9us (standard)
-	if((port->IDR & used_pin) > 0){
-		rebit = 1;                     // Read bit
-	}else{
-		rebit = 0;
+	dev->resolution = bits;
+	if (dev->scratchpad[4] == config){
+		return 0;
 	}
-	Delay_us(OW_Delay_F);							    // 55us (standard)
-	return rebit;
-}
 
-//read one byte from device
-static uint8_t ds1820_re_byte(GPIO_TypeDef * port, uint16_t used_pin){
-	uint8_t rebyte =0x00;
-	uint8_t rebit;
-	uint8_t i;
+	len = setup_address(dev);
+	dev->cmd[len++] = DS1820_WRITE_SCRATCHPAD;               //TH and TL are kept
+	dev->cmd[len++] = dev->scratchpad[2];
+	dev->cmd[len++] = dev->scratchpad[3];
+	dev->cmd[len++] = config;
+	owSetup(&dev->t, 1, dev->cmd, len, 0, 0, 0, 0);
+	if (owRun(dev->bus, &dev->t) != OW_OK){
+		return 1;
+	}
 
-	for (i=0;i<8;i++){
-		rebit=ds1820_re_bit(port, used_pin);
-		Delay_us(2);									//be on the save side
-		if (rebit==1){
-			rebyte|=(1<<i);
-		}
+	len = setup_address(dev);
+	dev->cmd[len++] = DS1820_COPY_SCRATCHPAD;                //keep it over power cycles
+	owSetup(&dev->t, 1, dev->cmd, len, 0, 0, 0, 0);
+	if (owRun(dev->bus, &dev->t) != OW_OK){
+		return 1;
 	}
-	return(rebyte);
-}
-
-//read temperature from device
-float   ds1820_read_temp(GPIO_TypeDef * port, uint16_t used_pin){
-	uint8_t error,i;
-	uint16_t j = 0;
-	uint8_t scratchpad[9] = {0};
-	float temp = 0;
-	error=ds1820_reset(port, used_pin);               //1. Reset
-	if (error==0){
-		ds1820_wr_byte(0xCC, port, used_pin);  					//2. skip ROM
-		ds1820_wr_byte(0x44, port, used_pin);  					//3. ask for temperature conversion
-		while ((port->IDR & used_pin)==0){			        //4. wait until conversion is finished
-			j++;
+	for (i = 0; i < DS1820_COPY_POLLS; i++){                 //device answers 0 while copying
+		setup_poll(dev, 0, 0);
+		owRun(dev->bus, &dev->t);
+		if (ds1820_conversion_done(dev)){
+			break;
 		}
-		error=ds1820_reset(port, used_pin);							//5. Reset
-		ds1820_wr_byte(0xCC, port, used_pin);  					//6. skip ROM
-		ds1820_wr_byte(0xBE, port, used_pin);  					//7. Read entire scratchpad 9 bytes
+	}
+	return 0;
+}
 
-		for (i=0; i<2; i++){         									  //8. Get scratchpad byte by byte
-			scratchpad[i]=ds1820_re_byte(port, used_pin); //9. read one DS18S20 byte
-		}
+//max. conversion time in ms: 750 at 12 bit, halved per bit less (94 at 9 bit)
+uint32_t ds1820_conversion_time(Ds1820 * dev){
+	return (750 >> (DS1820_RESOLUTION_MAX - dev->resolution)) + 1;
+}
+
+//check the last scratchpad read, 1 = valid
+//a line stuck low reads as all zeros with a matching CRC, the reserved
+//configuration bits catch that
+uint8_t ds1820_scratchpad_valid(Ds1820 * dev){
+	uint8_t * scratchpad = dev->scratchpad;
+
+	return owCrc8(scratchpad, DS1820_SCRATCHPAD_LEN) == 0
+			&& (scratchpad[4] & DS1820_CONFIG_RESERVED) == DS1820_CONFIG_RESERVED;
+}
+
+//temperature of the last scratchpad read in 1/16 °C, the register value itself
+int16_t ds1820_result_raw(Ds1820 * dev){
+	uint8_t * scratchpad = dev->scratchpad;
+	int16_t raw;
+
+	raw = (int16_t)((scratchpad[1] << 8) | scratchpad[0]);  //Zweierkomplement
+	return raw & ~((1 << (DS1820_RESOLUTION_MAX - dev->resolution)) - 1);   //undefined bits below the resolution
+}
+
+//read temperature from device in 1/16 °C, waits until the conversion is finished
+//DS1820_TEMP_INVALID if there is no valid result
+int16_t ds1820_read_temp(Ds1820 * dev){
+	uint32_t polls = (750 + 1) * 2;                          //one poll takes 560 us, Convert T goes to all
+	                                                         //devices, one at 12 bit keeps the bus busy
+	int retry;
+
+	setup_conversion(dev, 0, 0);
+	if (owRun(dev->bus, &dev->t) != OW_OK){
+		return DS1820_TEMP_INVALID;
 	}
-	//Umrechnung von Scratchpad zu Temperatur
-	temp = ((scratchpad[0])>>4)+((scratchpad[1] & 0x07)<<4);
-	temp += ((scratchpad[0] & 0x08)>>3)*0.5;
-	temp += ((scratchpad[0] & 0x04)>>2)*0.25;
-	temp += ((scratchpad[0] & 0x02)>>1)*0.125;
-	temp += ((scratchpad[0] & 0x01)>>0)*0.0625;
-	if((scratchpad[1]&0xF8) > 0) {
-		temp *= -1;
+	do {                                                     //wait until conversion is finished
+		setup_poll(dev, 0, 0);
+		owRun(dev->bus, &dev->t);
+	} while (!ds1820_conversion_done(dev) && --polls > 0);
+	if (polls == 0){                                         //no result within the conversion time
+		return DS1820_TEMP_INVALID;
 	}
-	return temp;
-}
-
-//initialize device
-void ds1820_init(GPIO_TypeDef * port, uint16_t used_pin){
-	uint8_t error;
-	uint16_t i =0;
-	// configure timer
-	TIM_HandleTypeDef Tim3Handle;
-	/* TIM3 clock enable */
-	__HAL_RCC_TIM3_CLK_ENABLE();
-	/* Time base configuration */
-	Tim3Handle.Instance = TIM3;
-	Tim3Handle.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
-	Tim3Handle.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-	Tim3Handle.Init.CounterMode = TIM_COUNTERMODE_UP;
-	Tim3Handle.Init.Period = 0xFFFF;
-	Tim3Handle.Init.Prescaler = 90-1;
-	Tim3Handle.Init.RepetitionCounter = 0;
-	HAL_TIM_Base_Init(&Tim3Handle);
-	HAL_TIM_Base_Start(&Tim3Handle);
-
-	// Test delay function
-//	GPIO_InitTypeDef pg9;
-//	__HAL_RCC_GPIOG_CLK_ENABLE();
-//	pg9.Pin = GPIO_PIN_9;
-//	pg9.Mode = GPIO_MODE_OUTPUT_PP;
-//	pg9.Pull = GPIO_NOPULL;
-//	pg9.Speed = GPIO_SPEED_FAST;
-//	pg9.Alternate = 0;
-//	HAL_GPIO_Init(GPIOG, &pg9);
-//
-//	while (1) {
-//		Delay_us(1000);
-//		HAL_GPIO_TogglePin(GPIOG, GPIO_PIN_9);
-//	}
-
-	error=ds1820_reset(port, used_pin);									//1. Reset
-	if (error==0){
-		ds1820_wr_byte(0xCC, port, used_pin);  							//2. skip ROM
-		ds1820_wr_byte(0x44, port, used_pin);  							//3. ask for temperature conversion
-		while ((port->IDR & used_pin)==0){			//4. wait until conversion is finished
-			i++;
+
+	for (retry = 0; retry < DS1820_READ_RETRIES; retry++){   //the conversion result stays in the scratchpad
+		setup_read(dev, DS1820_SCRATCHPAD_LEN, 0, 0);
+		if (owRun(dev->bus, &dev->t) == OW_OK && ds1820_scratchpad_valid(dev)){
+			return ds1820_result_raw(dev);
 		}
-		Delay_us(20);
-		error=ds1820_reset(port, used_pin);								//5. Reset
-		ds1820_wr_byte(0xCC, port, used_pin);  							//6. skip ROM
-		ds1820_wr_byte(0xBE, port, used_pin);  							//7. Read entire scratchpad 9 bytes
 	}
+	return DS1820_TEMP_INVALID;
+}
+
+static void setup_conversion(Ds1820 * dev, OwCallback done, void * ctx){
+	dev->cmd[0] = DS1820_SKIP_ROM;                           //1. skip ROM
+	dev->cmd[1] = DS1820_CONVERT_T;                          //2. ask for temperature conversion
+	owSetup(&dev->t, 1, dev->cmd, 2, 0, 0, done, ctx);
+}
 
+static void setup_poll(Ds1820 * dev, OwCallback done, void * ctx){
+	owSetup(&dev->t, 0, 0, 0, &dev->poll, 1, done, ctx);
 }
 
+static void setup_read(Ds1820 * dev, uint16_t len, OwCallback done, void * ctx){
+	uint16_t cmdLen = setup_address(dev);                    //1. address the device
+
+	dev->cmd[cmdLen++] = DS1820_READ_SCRATCHPAD;             //2. read scratchpad
+	owSetup(&dev->t, 1, dev->cmd, cmdLen, dev->scratchpad, len, done, ctx);
+}
+
+static uint16_t setup_address(Ds1820 * dev){
+	if (dev->hasRom){
+		dev->cmd[0] = DS1820_MATCH_ROM;                      //this device only
+		memcpy(&dev->cmd[1], dev->rom, 8);
+		return 9;
+	}
+	dev->cmd[0] = DS1820_SKIP_ROM;                           //only device on the bus
+	return 1;
+}
@@ -0,0 +1,398 @@
+/*
+ * IsoTp.cpp
+ *
+ * Frame types (first byte, high nibble):
+ *   0 single frame       0L + up to 7 data bytes
+ *   1 first frame        1L LL + 6 data bytes, 12 bit length
+ *   2 consecutive frame  2N + 7 data bytes, sequence number N
+ *   3 flow control       3S BS STmin, S: 0 = continue, 1 = wait, 2 = overflow
+ *
+ * All frames are padded to 8 bytes. Consecutive frames are sent from
+ * poll() as fast as STmin and the TX queue allow, with STmin = 0 the
+ * queue is kept full and the bus is saturated.
+ */
+
+#include "IsoTp.h"
+#include "candispatch.h"
+
+#include <string.h>
+
+#define PCI_SINGLE		0x00
+#define PCI_FIRST		0x10
+#define PCI_CONSECUTIVE	0x20
+#define PCI_FLOW		0x30
+
+#define FC_CONTINUE		0
+#define FC_WAIT			1
+#define FC_OVERFLOW		2
+
+#define PADDING			0xCC
+#define TIMEOUT_US		1000000		// N_Bs and N_Cr
+
+IsoTp::IsoTp() {
+	memset(mSessions, 0, sizeof(mSessions));
+}
+
+IsoTp::~IsoTp() {
+
+}
+
+/**
+ * Open a session
+ * @param txId ID of frames sent to the peer
+ * @param rxId ID of frames received from the peer, has to be unique
+ * @param rxBuffer buffer for received payloads
+ * @param rxSize size of rxBuffer, longer payloads are refused
+ * @param rxHandler called when a payload has been received completely
+ * @param txHandler called when a send() has finished or failed
+ * @param ctx passed to the handlers
+ * @param blockSize consecutive frames the peer may send per flow control, 0 = all
+ * @param stMin minimum gap the peer has to keep between consecutive frames
+ * @return session number or -1 if no session is free, rxId is in use or
+ *         cannot be subscribed
+ */
+int IsoTp::open(uint32_t txId, uint32_t rxId, uint8_t *rxBuffer, uint16_t rxSize,
+		RxHandler rxHandler, TxHandler txHandler, void *ctx,
+		uint8_t blockSize, uint8_t stMin) {
+	int free = -1;
+
+	for (int i = 0; i < MAX_SESSIONS; i++) {
+		if (!mSessions[i].used) {
+			if (free < 0) {
+				free = i;
+			}
+		} else if (mSessions[i].rxId == rxId) {
+			return -1;
+		}
+	}
+	// subscribing would replace the handler of another user silently
+	if (free < 0 || canDispatchIsSubscribed(rxId, 0)) {
+		return -1;
+	}
+
+	Session &s = mSessions[free];
+	memset(&s, 0, sizeof(s));
+	s.owner = this;
+	s.used = true;
+	s.txId = txId;
+	s.rxId = rxId;
+	s.blockSize = blockSize;
+	s.stMin = stMin;
+	s.rxHandler = rxHandler;
+	s.txHandler = txHandler;
+	s.ctx = ctx;
+	s.rxBuf = rxBuffer;
+	s.rxSize = rxSize;
+	s.fcPending = -1;
+
+	if (!canDispatchSubscribe(rxId, 0, dispatchHandler, &s)) {
+		s.used = false;
+		return -1;
+	}
+	return free;
+}
+
+/**
+ * Close a session, transfers in progress are dropped
+ */
+void IsoTp::close(int session) {
+	if (session >= 0 && session < MAX_SESSIONS && mSessions[session].used) {
+		canDispatchUnsubscribe(mSessions[session].rxId, 0);
+		mSessions[session].used = false;
+	}
+}
+
+/**
+ * Start sending a payload. data has to stay valid until the TX handler
+ * has been called.
+ * @return OK if the transfer has been started, BUSY if the session is still
+ *         sending, INVALID for bad arguments
+ */
+IsoTp::Result IsoTp::send(int session, const uint8_t *data, uint16_t len) {
+	if (session < 0 || session >= MAX_SESSIONS || !mSessions[session].used
+			|| len == 0 || len > MAX_LENGTH) {
+		return INVALID;
+	}
+	Session &s = mSessions[session];
+	if (s.txState != TX_IDLE) {
+		return BUSY;
+	}
+
+	s.txData = data;
+	s.txLen = len;
+	s.txPos = 0;
+	s.txState = (len <= 7) ? TX_SINGLE : TX_WAIT_FC;
+	s.txLastUs = canGetTimeUs();
+
+	if (s.txState == TX_SINGLE) {
+		pumpTx(s, s.txLastUs);
+		return OK;
+	}
+
+	uint8_t buf[8];
+	buf[0] = PCI_FIRST | (len >> 8);
+	buf[1] = len & 0xFF;
+	memcpy(&buf[2], data, 6);
+	if (!sendFrame(s.txId, buf, 8)) {
+		s.txState = TX_IDLE;
+		return BUSY;
+	}
+	s.txPos = 6;
+	s.txSn = 1;
+	return OK;
+}
+
+/**
+ * Check if a transfer is in progress
+ */
+bool IsoTp::isSending(int session) {
+	return session >= 0 && session < MAX_SESSIONS && mSessions[session].txState != TX_IDLE;
+}
+
+/**
+ * Pass a received frame to the session bound to its ID
+ * @return true if the frame belongs to a session
+ */
+bool IsoTp::onFrame(CanFrame &frame) {
+	uint8_t data[8];
+	unsigned int len;
+
+	for (int i = 0; i < MAX_SESSIONS; i++) {
+		if (mSessions[i].used && mSessions[i].rxId == frame.getId()) {
+			frame.getData(data, &len);
+			receive(mSessions[i], data, len);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * CAN dispatch handler, ctx is the session
+ */
+void IsoTp::dispatchHandler(const CanMsg *msg, void *ctx) {
+	Session *s = (Session *)ctx;
+
+	// the slot may have been reopened for another ID
+	if (s->used && !msg->rtr && !msg->ide && msg->id == s->rxId) {
+		s->owner->receive(*s, msg->data, msg->dlc);
+	}
+}
+
+/**
+ * Send pending consecutive and flow control frames, check timeouts.
+ * Has to be called from the main loop.
+ */
+void IsoTp::poll(void) {
+	uint32_t now = canGetTimeUs();
+
+	for (int i = 0; i < MAX_SESSIONS; i++) {
+		Session &s = mSessions[i];
+
+		if (!s.used) {
+			continue;
+		}
+		if (s.fcPending >= 0 && sendFlowControl(s, s.fcPending)) {
+			s.fcPending = -1;
+		}
+		if (s.txState == TX_WAIT_FC && now - s.txLastUs > TIMEOUT_US) {
+			finishTx(s, TIMEOUT);
+		}
+		pumpTx(s, now);
+		if (s.rxState == RX_CONSECUTIVE && now - s.rxLastUs > TIMEOUT_US) {
+			s.rxState = RX_IDLE;
+		}
+	}
+}
+
+/**
+ * Handle one received frame of a session
+ */
+void IsoTp::receive(Session &s, const uint8_t *data, unsigned int len) {
+	uint16_t n;
+
+	if (len == 0) {
+		return;
+	}
+
+	switch (data[0] & 0xF0) {
+	case PCI_SINGLE:
+		n = data[0] & 0x0F;
+		if (n == 0 || n > 7 || n > len - 1 || n > s.rxSize) {
+			return;
+		}
+		s.rxState = RX_IDLE;		// a new transfer replaces an unfinished one
+		memcpy(s.rxBuf, &data[1], n);
+		if (s.rxHandler != NULL) {
+			s.rxHandler(&s - mSessions, s.rxBuf, n, s.ctx);
+		}
+		break;
+
+	case PCI_FIRST:
+		if (len < 8) {
+			return;
+		}
+		n = (data[0] & 0x0F) << 8 | data[1];
+		if (n < 8) {
+			return;
+		}
+		if (n > s.rxSize) {
+			s.rxState = RX_IDLE;
+			if (!sendFlowControl(s, FC_OVERFLOW)) {
+				s.fcPending = FC_OVERFLOW;
+			}
+			return;
+		}
+		memcpy(s.rxBuf, &data[2], 6);
+		s.rxLen = n;
+		s.rxPos = 6;
+		s.rxSn = 1;
+		s.rxBlockLeft = s.blockSize;
+		s.rxLastUs = canGetTimeUs();
+		s.rxState = RX_CONSECUTIVE;
+		if (!sendFlowControl(s, FC_CONTINUE)) {
+			s.fcPending = FC_CONTINUE;
+		}
+		break;
+
+	case PCI_CONSECUTIVE:
+		if (s.rxState != RX_CONSECUTIVE) {
+			return;
+		}
+		if ((data[0] & 0x0F) != s.rxSn) {
+			s.rxState = RX_IDLE;		// frame lost, drop the transfer
+			return;
+		}
+		n = s.rxLen - s.rxPos;
+		if (n > 7) {
+			n = 7;
+		}
+		if (n > len - 1) {
+			s.rxState = RX_IDLE;
+			return;
+		}
+		memcpy(&s.rxBuf[s.rxPos], &data[1], n);
+		s.rxPos += n;
+		s.rxSn = (s.rxSn + 1) & 0x0F;
+		s.rxLastUs = canGetTimeUs();
+
+		if (s.rxPos >= s.rxLen) {
+			s.rxState = RX_IDLE;
+			if (s.rxHandler != NULL) {
+				s.rxHandler(&s - mSessions, s.rxBuf, s.rxLen, s.ctx);
+			}
+		} else if (s.blockSize != 0 && --s.rxBlockLeft == 0) {
+			s.rxBlockLeft = s.blockSize;
+			if (!sendFlowControl(s, FC_CONTINUE)) {
+				s.fcPending = FC_CONTINUE;
+			}
+		}
+		break;
+
+	case PCI_FLOW:
+		if (s.txState != TX_WAIT_FC || len < 3) {
+			return;
+		}
+		switch (data[0] & 0x0F) {
+		case FC_CONTINUE:
+			s.txBlockLimited = data[1] != 0;
+			s.txBlockLeft = data[1];
+			s.txStMinUs = stMinToUs(data[2]);
+			s.txState = TX_CONSECUTIVE;
+			s.txLastUs = canGetTimeUs() - s.txStMinUs;		// first frame may go at once
+			pumpTx(s, canGetTimeUs());
+			break;
+		case FC_WAIT:
+			s.txLastUs = canGetTimeUs();		// restart N_Bs
+			break;
+		default:
+			finishTx(s, OVERFLOW);
+			break;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+/**
+ * Send as many frames as STmin, block size and TX queue allow
+ */
+void IsoTp::pumpTx(Session &s, uint32_t now) {
+	uint8_t buf[8];
+
+	if (s.txState == TX_SINGLE) {
+		buf[0] = PCI_SINGLE | s.txLen;
+		memcpy(&buf[1], s.txData, s.txLen);
+		memset(&buf[1 + s.txLen], PADDING, 7 - s.txLen);
+		if (sendFrame(s.txId, buf, 8)) {
+			finishTx(s, OK);
+		}
+		return;
+	}
+
+	while (s.txState == TX_CONSECUTIVE) {
+		uint16_t n = s.txLen - s.txPos;
+
+		if (s.txStMinUs != 0 && now - s.txLastUs < s.txStMinUs) {
+			return;
+		}
+		if (n > 7) {
+			n = 7;
+		}
+		buf[0] = PCI_CONSECUTIVE | s.txSn;
+		memcpy(&buf[1], &s.txData[s.txPos], n);
+		memset(&buf[1 + n], PADDING, 7 - n);
+		if (!sendFrame(s.txId, buf, 8)) {
+			return;		// TX queue full, continue on next poll
+		}
+		s.txPos += n;
+		s.txSn = (s.txSn + 1) & 0x0F;
+		s.txLastUs = now;
+
+		if (s.txPos >= s.txLen) {
+			finishTx(s, OK);
+		} else if (s.txBlockLimited && --s.txBlockLeft == 0) {
+			s.txState = TX_WAIT_FC;
+		}
+		if (s.txStMinUs != 0) {
+			return;
+		}
+	}
+}
+
+bool IsoTp::sendFlowControl(Session &s, uint8_t status) {
+	uint8_t buf[8] = { (uint8_t)(PCI_FLOW | status), s.blockSize, s.stMin,
+			PADDING, PADDING, PADDING, PADDING, PADDING };
+
+	return sendFrame(s.txId, buf, 8);
+}
+
+bool IsoTp::sendFrame(uint32_t id, const uint8_t *data, unsigned int len) {
+	CanFrame tx;
+
+	tx.setId(id);
+	tx.setData((uint8_t *)data, len);
+	return tx.txData();
+}
+
+void IsoTp::finishTx(Session &s, Result result) {
+	s.txState = TX_IDLE;
+	if (s.txHandler != NULL) {
+		s.txHandler(&s - mSessions, result, s.ctx);
+	}
+}
+
+/**
+ * STmin encoding: 0x00..0x7F ms, 0xF1..0xF9 100..900 us, reserved = 127 ms
+ */
+uint32_t IsoTp::stMinToUs(uint8_t stMin) {
+	if (stMin <= 0x7F) {
+		return stMin * 1000u;
+	}
+	if (stMin >= 0xF1 && stMin <= 0xF9) {
+		return (stMin - 0xF0) * 100u;
+	}
+	return 127000;
+}
@@ -15,30 +15,299 @@
 #include "main.h"
 #include "stm32f429i_discovery_lcd.h"
 #include "tempsensor.h"
+#include "canmessages.h"
+#include "can.h"
+#include "canring.h"
+#include "cantxqueue.h"
+#include "canfilter.h"
+#include "candispatch.h"
+#include "canbittiming.h"
+#include "cantransport.h"
+#include "canstats.h"
+#include "temppublisher.h"
 
 /* Private typedef -----------------------------------------------------------*/
 
 /* Private define ------------------------------------------------------------*/
 
-// ToDo: korrekte Prescaler-Einstellung
-#define   CAN1_CLOCK_PRESCALER    16 	// Berechnung siehe Angabe (nach Absprache mit Klassenkollegen nehmen wir einfach alle diesen Wert)
+// bit timing is calculated from the APB1 clock, see canBitTimingSolve()
+#define   CAN1_BITRATE            500000	// bit/s
+#define   CAN1_SAMPLE_POINT       875		// 87.5%
+
+// automatic temperature frames, see temppublisher.h
+#define   PUBLISH_DEADBAND        8			// 0.5 °C in 1/16 °C
+#define   PUBLISH_MIN_PERIOD_MS   1000
+#define   PUBLISH_MAX_PERIOD_MS   10000		// heartbeat of a steady temperature
+#define   PUBLISH_FIXED_PERIOD_MS 1000		// fixed-rate sending the savings are compared with
 /* Private variables ---------------------------------------------------------*/
 
 CAN_HandleTypeDef     canHandle;
+static CanBitTiming   bitTiming;			// bit timing currently in use
+static CanOpMode      opMode = CAN_OPMODE_LOOPBACK;
+
+static CanRing        rxRing;				// filled by CAN1_RX0_IRQHandler, emptied by main loop
+static volatile uint32_t rxCount = 0;		// frames taken out of FIFO0/FIFO1
+static volatile uint32_t rxFifoOverruns = 0;	// FIFO0/FIFO1 overruns reported by bxCAN
 
+static CanTxQueue     txQueue;				// filled by canTransmit, emptied into the mailboxes
+static volatile uint32_t txQueued = 0;
+static volatile uint32_t txSent = 0;
+static volatile uint32_t txRejected = 0;
+static CanMsg         txPending[3];			// frames in TX mailbox 0..2
+static CanTxCallback  txCompleteCallback = NULL;
+static CanRing        txDoneRing;			// sent frames for the statistics, filled by the TX ISR
 
 
 /* Private function prototypes -----------------------------------------------*/
 static void initGpio(void);
 static void initCanPeripheral(void);
+static void initTimebase(void);
+static void applyBitTiming(const CanBitTiming *timing);
+static int restartController(void);
+static void txMailboxComplete(uint32_t mailbox);
+static int bxcanTransmit(CanTransport *self, const CanMsg *msg);
+static int bxcanReceive(CanTransport *self, CanMsg *msg);
+static uint32_t bxcanTxFree(CanTransport *self);
+static uint32_t bxcanTimeUs(CanTransport *self);
+static void bxcanIdle(CanTransport *self);
+static uint32_t bxcanBitrate(CanTransport *self);
+static int bxcanSetMode(CanTransport *self, CanOpMode mode);
+static CanOpMode bxcanGetMode(CanTransport *self);
+static void bxcanSetTxCallback(CanTransport *self, CanTxCallback callback);
+
+/* bxCAN backend of the transport interface */
+static CanTransport bxcanTransport = {
+		bxcanTransmit, bxcanReceive, bxcanTxFree, bxcanTimeUs, bxcanIdle,
+		bxcanBitrate, bxcanSetMode, bxcanGetMode, bxcanSetTxCallback
+};
+static void fillTxMailboxes(void);
+static void drainRxFifo(CAN_HandleTypeDef *hcan, uint32_t fifo);
+static void onTemperatureFrame(const CanMsg *msg, void *ctx);
+static void showBusStats(void);
+static void onTemperature(int index, int16_t temperature, void *ctx);
+static int publishTemperature(int16_t temperature, void *ctx);
 
 
 /**
  * Initialize hardware GPIO and CAN peripheral
  */
 void canInitHardware(void) {
+	canRingInit(&rxRing);
+	canRingInit(&txDoneRing);
+	canTxQueueInit(&txQueue);
+	canStatsInit();
+	initTimebase();
 	initGpio();
 	initCanPeripheral();
+	canTransportSet(&bxcanTransport);
+}
+
+/**
+ * Transport interface of CAN1
+ */
+CanTransport *canBxcanTransport(void) {
+	return &bxcanTransport;
+}
+
+/**
+ * Take the oldest received frame out of the RX ring.
+ * Frames sent and received since the last call are passed to the
+ * statistics on the way, so they are only updated from the main loop.
+ * @param msg destination for the frame
+ * @return 1 if a frame has been returned, 0 if nothing has been received
+ */
+int canReceive(CanMsg *msg) {
+	CanMsg sent;
+
+	while (canRingPop(&txDoneRing, &sent)) {
+		canStatsFrame(&sent, CAN_STATS_TX, sent.timestamp);
+	}
+	if (!canRingPop(&rxRing, msg)) {
+		return 0;
+	}
+	canStatsFrame(msg, CAN_STATS_RX, msg->timestamp);
+	return 1;
+}
+
+/**
+ * Get receive and overrun counters
+ * @param stats destination for the counters
+ */
+void canGetRxStats(CanRxStats *stats) {
+	stats->received = rxCount;
+	stats->fifoOverruns = rxFifoOverruns;
+	stats->ringOverruns = rxRing.overruns;
+	stats->ringHighWater = rxRing.highWater;
+}
+
+/**
+ * Change the bitrate at runtime. The bit timing is derived from the
+ * current APB1 clock. Filters and notifications are kept, frames that
+ * are pending in the TX mailboxes are lost.
+ * @param bitrate requested bitrate in bit/s, up to 1000000
+ * @param samplePointPermille requested sample point, e.g. 875 for 87.5%
+ * @param timing if not NULL, returns the bit timing that has been set
+ * @return 1 on success, 0 if there is no valid bit timing
+ */
+int canSetBitrate(uint32_t bitrate, uint32_t samplePointPermille, CanBitTiming *timing) {
+	CanBitTiming newTiming;
+
+	if (!canBitTimingSolve(HAL_RCC_GetPCLK1Freq(), bitrate, samplePointPermille, &newTiming)) {
+		return 0;
+	}
+
+	applyBitTiming(&newTiming);
+	if (!restartController()) {
+		return 0;
+	}
+
+	if (timing != NULL) {
+		*timing = bitTiming;
+	}
+	return 1;
+}
+
+/**
+ * Switch operating mode at runtime, e.g. to loopback for benchmarks
+ * @param mode CAN_OPMODE_NORMAL, _LOOPBACK, _SILENT or _SILENT_LOOPBACK
+ * @return 1 on success, 0 on error
+ */
+int canSetMode(CanOpMode mode) {
+	static const uint32_t halMode[] = {
+			CAN_MODE_NORMAL, CAN_MODE_LOOPBACK, CAN_MODE_SILENT, CAN_MODE_SILENT_LOOPBACK
+	};
+
+	if ((uint32_t)mode >= sizeof(halMode) / sizeof(halMode[0])) {
+		return 0;
+	}
+	canHandle.Init.Mode = halMode[mode];
+	opMode = mode;
+	return restartController();
+}
+
+/**
+ * Get the current operating mode
+ */
+CanOpMode canGetMode(void) {
+	return opMode;
+}
+
+/**
+ * Get the bit timing currently in use
+ * @param timing destination
+ */
+void canGetBitTiming(CanBitTiming *timing) {
+	*timing = bitTiming;
+}
+
+/**
+ * Load compiled acceptance filters into the filter banks.
+ * Banks not used by the set are deactivated, banks from
+ * set->slaveStartBank on are left to CAN2.
+ * @param set filter banks created by canFilterCompile
+ * @return 1 on success, 0 if the hardware rejected the configuration
+ */
+int canConfigureFilters(const CanFilterSet *set) {
+	CAN_FilterTypeDef canFilter;
+	uint32_t i;
+
+	for (i = 0; i < CAN_FILTER_MAX_BANKS; i++) {
+		canFilter.FilterBank = i;
+		canFilter.SlaveStartFilterBank = set->slaveStartBank;
+		canFilter.FilterActivation = (i < set->numBanks) ? ENABLE : DISABLE;
+		if (i < set->numBanks) {
+			const CanFilterBank *b = &set->bank[i];
+
+			canFilter.FilterMode = b->listMode ? CAN_FILTERMODE_IDLIST : CAN_FILTERMODE_IDMASK;
+			canFilter.FilterScale = b->scale16 ? CAN_FILTERSCALE_16BIT : CAN_FILTERSCALE_32BIT;
+			canFilter.FilterFIFOAssignment = b->fifo ? CAN_FILTER_FIFO1 : CAN_FILTER_FIFO0;
+			// HAL writes FR1/FR2 from different fields depending on the scale
+			if (b->scale16) {
+				canFilter.FilterIdLow = b->fr1 & 0xFFFF;
+				canFilter.FilterMaskIdLow = b->fr1 >> 16;
+				canFilter.FilterIdHigh = b->fr2 & 0xFFFF;
+				canFilter.FilterMaskIdHigh = b->fr2 >> 16;
+			} else {
+				canFilter.FilterIdHigh = b->fr1 >> 16;
+				canFilter.FilterIdLow = b->fr1 & 0xFFFF;
+				canFilter.FilterMaskIdHigh = b->fr2 >> 16;
+				canFilter.FilterMaskIdLow = b->fr2 & 0xFFFF;
+			}
+		} else {
+			canFilter.FilterMode = CAN_FILTERMODE_IDMASK;
+			canFilter.FilterScale = CAN_FILTERSCALE_32BIT;
+			canFilter.FilterFIFOAssignment = CAN_FILTER_FIFO0;
+			canFilter.FilterIdHigh = 0;
+			canFilter.FilterIdLow = 0;
+			canFilter.FilterMaskIdHigh = 0;
+			canFilter.FilterMaskIdLow = 0;
+		}
+		if (HAL_CAN_ConfigFilter(&canHandle, &canFilter) != HAL_OK) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Queue a frame for transmission. Frames are handed to the TX mailboxes
+ * in CAN priority order, as soon as a mailbox becomes free.
+ * @param msg frame to send
+ * @return 1 if the frame has been queued, 0 if the TX queue is full
+ */
+int canTransmit(const CanMsg *msg) {
+	int ok;
+	CanMsg txMsg = *msg;
+	uint32_t primask = __get_PRIMASK();
+
+	txMsg.timestamp = canGetTimeUs();		// enqueue time
+
+	__disable_irq();
+	ok = canTxQueuePush(&txQueue, &txMsg);
+	if (ok) {
+		txQueued++;
+		fillTxMailboxes();
+	} else {
+		txRejected++;
+	}
+	__set_PRIMASK(primask);
+
+	return ok;
+}
+
+/**
+ * Number of frames canTransmit can still accept without rejecting
+ */
+uint32_t canTxFree(void) {
+	return CAN_TX_QUEUE_SIZE - txQueue.count;
+}
+
+/**
+ * Register a function that is called from the TX interrupt for every
+ * frame that has been sent. The frame's timestamp is its enqueue time.
+ * @param callback function or NULL
+ */
+void canSetTxCompleteCallback(CanTxCallback callback) {
+	txCompleteCallback = callback;
+}
+
+/**
+ * Get transmit counters
+ * @param stats destination for the counters
+ */
+void canGetTxStats(CanTxStats *stats) {
+	stats->queued = txQueued;
+	stats->sent = txSent;
+	stats->rejected = txRejected;
+	stats->queueHighWater = txQueue.highWater;
+}
+
+/**
+ * Microsecond timebase used for frame timestamps
+ * @return free running time in us (TIM2, wraps after ~71 minutes)
+ */
+uint32_t canGetTimeUs(void) {
+	return TIM2->CNT;
 }
 
 /**
@@ -69,17 +338,30 @@ void canInit(void) {
 	LCD_SetPrintPosition(15,1);
 	printf("Recv-Data:");
 
+	LCD_SetPrintPosition(24,1);
+	printf("Bitrate: %lu bit/s (%ld ppm) ", bitTiming.bitrate, bitTiming.errorPpm);
 	LCD_SetPrintPosition(30,1);
 	printf("Bit-Timing-Register: 0x%lx", CAN1->BTR);
 
+	canDispatchInit();
+	canDispatchSubscribe(0x3, 0, onTemperatureFrame, NULL);
+	canDispatchSubscribe(CAN_STATS_REQUEST_ID, 0, canStatsRequestHandler, NULL);
+
 	// ToDo (2): set up DS18B20 (temperature sensor)
 
-	tempSensorInit(); // angeschlossen an PG9
+	tempSensorInit(TEMP_SENSOR_RESOLUTION); // angeschlossen an PG9
+
+	TempPublisherConfig publisher = {
+			PUBLISH_DEADBAND, PUBLISH_MIN_PERIOD_MS, PUBLISH_MAX_PERIOD_MS,
+			PUBLISH_FIXED_PERIOD_MS, TEMP_PUBLISHER_FILTER_EWMA, 2
+	};
+	tempPublisherInit(&publisher, publishTemperature, NULL, HAL_GetTick());
+	tempSensorSetCallback(onTemperature, NULL);
 
 }
 
 /**
- * sends a CAN frame, if mailbox is free
+ * sends a CAN frame, if there is space in the TX queue
  * @param none
  * @return none
  */
@@ -87,35 +369,23 @@ void canSendTask(void) {
 	// ToDo declare the required variables
 	static unsigned int sendCnt = 0;
 
-	CAN_TxHeaderTypeDef txHeader;
-
-	uint8_t txData[8];
-	uint32_t txMailbox;
+	CanMsg txMsg;
 
 
 	// ToDo (2): get temperature value
 
-	float temperature = tempSensorGetTemperature();
-	int16_t tempInt = (temperature * 10); // e.g. 23.4°C → 234
+	int16_t temperature = tempSensorGetTemperature();
+	char text[12];
 
 
 	// ToDo prepare send data
 
-	txHeader.StdId = 0x3;
-	txHeader.ExtId = 0;
-	txHeader.IDE   = CAN_ID_STD;
-	txHeader.RTR   = CAN_RTR_DATA;
-	txHeader.DLC   = 2;
-	txHeader.TransmitGlobalTime = DISABLE;
-
-
-	txData[0] = (tempInt >> 8) & 0xFF;
-	txData[1] = tempInt& 0xFF;
+	canTemperatureMsgEncode(&txMsg, temperature);
 
 
 	// ToDo send CAN frame
 
-	if (HAL_CAN_AddTxMessage(&canHandle, &txHeader, txData, &txMailbox) == HAL_OK) {
+	if (canTransmit(&txMsg)) {
 		sendCnt++;
 
 		// ToDo display send counter and send data
@@ -123,41 +393,131 @@ void canSendTask(void) {
 		LCD_SetPrintPosition(5,15);
 		printf("%5d", sendCnt);
 
+		tempSensorFormat(text, sizeof(text), temperature);
 		LCD_SetPrintPosition(11,1);
-		printf("Temp: %f   ",
-				temperature);
+		printf("Temp: %s   ", text);
 	}
 
 }
 
 /**
- * checks if a can frame has been received and shows content on display
+ * sends the temperature frame when the publisher rules say so and shows
+ * how many frames that saved, has to be called from the main loop
  * @param none
  * @return none
  */
-void canReceiveTask(void) {
-	static unsigned int recvCnt = 0;
+void canPublishTask(void) {
+	static uint32_t lastReportMs;
 
-	static CAN_RxHeaderTypeDef rxHeader;
-	static uint8_t  rxData[8];
+	TempPublisherStats stats;
+	uint32_t now = HAL_GetTick();
 
-	// ToDo: check if CAN frame has been received
-	/* Check for RX pending */
-	if (HAL_CAN_GetRxFifoFillLevel(&canHandle, CAN_RX_FIFO0) == 0)
+	tempPublisherTask(now);
+	if (now - lastReportMs < 1000) {
 		return;
+	}
+	lastReportMs = now;
+
+	tempPublisherGetStats(&stats);
+	LCD_SetColors(LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+	LCD_SetPrintPosition(12,1);
+	printf("Pub %lu/%lu saved %lu.%lu%% ", stats.sent, stats.fixedRateFrames,
+			stats.savedPermille / 10, stats.savedPermille % 10);
+}
 
+/**
+ * passes all received CAN frames to their subscribers and shows
+ * overrun counters on display
+ * @param none
+ * @return none
+ */
+void canReceiveTask(void) {
+	static CanRxStats lastStats;
+
+	CanMsg rxMsg;
+	CanRxStats stats;
+
+	// ToDo: check if CAN frame has been received
 	// ToDo: Get CAN frame from RX fifo
-	/* Read message */
-	if (HAL_CAN_GetRxMessage(&canHandle, CAN_RX_FIFO0, &rxHeader, rxData) != HAL_OK){
+	/* Drain everything the RX interrupt has collected since the last call */
+	while (canReceive(&rxMsg)) {
+		canDispatch(&rxMsg);
+	}
+
+	canGetRxStats(&stats);
+	if (stats.fifoOverruns != lastStats.fifoOverruns || stats.ringOverruns != lastStats.ringOverruns) {
+		lastStats = stats;
+		LCD_SetColors(LCD_COLOR_RED, LCD_COLOR_BLACK);
+		LCD_SetPrintPosition(17,1);
+		printf("Ovr fifo/ring: %lu/%lu ", stats.fifoOverruns, stats.ringOverruns);
+	}
+
+	showBusStats();
+}
+
+/**
+ * shows bus load and the ID with the highest frame rate, once per
+ * statistics window
+ */
+static void showBusStats(void) {
+	static uint32_t lastUs;
+
+	CanStatsBus bus;
+	CanStatsEntry top;
+	uint32_t now = canGetTimeUs();
+
+	if (now - lastUs < CAN_STATS_WINDOW_US) {
 		return;
 	}
+	lastUs = now;
+
+	canStatsGetBus(&bus);
+	LCD_SetColors(LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+	LCD_SetPrintPosition(13,1);
+	printf("Load %lu.%lu%% max %lu.%lu%% %lu/s ",
+			bus.loadPermille / 10, bus.loadPermille % 10,
+			bus.worstLoadPermille / 10, bus.worstLoadPermille % 10, bus.framesPerSecond);
+	if (canStatsTopTalker(&top)) {
+		LCD_SetPrintPosition(14,1);
+		printf("Top 0x%03lX %lu/s jit %luus ", top.id, top.framesPerSecond, top.jitterUs);
+	}
+}
+
+/**
+ * new value of a temperature sensor, the first one is published
+ */
+static void onTemperature(int index, int16_t temperature, void *ctx) {
+	if (index == 0) {
+		tempPublisherSample(temperature);
+	}
+}
+
+/**
+ * sends a temperature frame for the publisher
+ * @return 1 if the frame has been queued
+ */
+static int publishTemperature(int16_t temperature, void *ctx) {
+	CanMsg msg;
+
+	canTemperatureMsgEncode(&msg, temperature);
+	return canTransmit(&msg);
+}
+
+/**
+ * shows a received temperature frame on display
+ * @param msg received frame with ID 0x3
+ * @param ctx unused
+ */
+static void onTemperatureFrame(const CanMsg *msg, void *ctx) {
+	static unsigned int recvCnt = 0;
+	char text[12];
 
 	recvCnt++;
 
 	// ToDo: Process received CAN Frame (extract data)
 	/* Extract temperature */
-	int16_t temp = (rxData[0] << 8) | rxData[1];
-	int16_t Head = rxHeader.StdId;
+	int16_t temp = canTemperatureMsgRaw(msg);
+	int16_t Head = msg->id;
 
 	// ToDo display recv counter and recv data
 	/* Update LCD */
@@ -165,13 +525,50 @@ void canReceiveTask(void) {
 	LCD_SetPrintPosition(7,15);
 	printf("%5d", recvCnt);
 
+	tempSensorFormat(text, sizeof(text), temp);
 	LCD_SetPrintPosition(15,1);
-	printf("Recv-Data: %i ",temp);
+	printf("Recv-Data: %s   ", text);
 	LCD_SetPrintPosition(16,1);
 	printf("Recv-Head: 0x%04X ",Head);
+}
+
+/*
+ * Transport interface wrappers, CAN1 is the only instance
+ */
+static int bxcanTransmit(CanTransport *self, const CanMsg *msg) {
+	return canTransmit(msg);
+}
+
+static int bxcanReceive(CanTransport *self, CanMsg *msg) {
+	return canReceive(msg);
+}
+
+static uint32_t bxcanTxFree(CanTransport *self) {
+	return canTxFree();
+}
+
+static uint32_t bxcanTimeUs(CanTransport *self) {
+	return canGetTimeUs();
+}
+
+static void bxcanIdle(CanTransport *self) {
+	// interrupts do the work
+}
 
+static uint32_t bxcanBitrate(CanTransport *self) {
+	return bitTiming.bitrate;
+}
+
+static int bxcanSetMode(CanTransport *self, CanOpMode mode) {
+	return canSetMode(mode);
+}
 
+static CanOpMode bxcanGetMode(CanTransport *self) {
+	return canGetMode();
+}
 
+static void bxcanSetTxCallback(CanTransport *self, CanTxCallback callback) {
+	canSetTxCompleteCallback(callback);
 }
 
 /**
@@ -195,10 +592,10 @@ static void initGpio(void)
 }
 
 /**
- * Initialize CAN peripheral.
- * Note: CAN1_CLOCK_PRESCALER has to be set!
- * No Filters are applied.
- * IRQs are enabled
+ * Initialize CAN peripheral with CAN1_BITRATE.
+ * No Filters are applied, use canFilterCompile/canConfigureFilters to
+ * receive only subscribed IDs.
+ * FIFO0/FIFO1 message pending, overrun and TX mailbox empty IRQs are enabled
  */
 static void initCanPeripheral(void) {
 
@@ -216,12 +613,14 @@ static void initCanPeripheral(void) {
 	canHandle.Init.ReceiveFifoLocked = DISABLE;
 	canHandle.Init.TransmitFifoPriority = DISABLE;
 	canHandle.Init.Mode = CAN_MODE_LOOPBACK;
-	canHandle.Init.SyncJumpWidth = CAN_SJW_1TQ;
 
 	// CAN Baudrate
-	canHandle.Init.TimeSeg1 = CAN_BS1_15TQ;
-	canHandle.Init.TimeSeg2 = CAN_BS2_6TQ;
-	canHandle.Init.Prescaler = CAN1_CLOCK_PRESCALER;
+	if (!canBitTimingSolve(HAL_RCC_GetPCLK1Freq(), CAN1_BITRATE, CAN1_SAMPLE_POINT, &bitTiming))
+	{
+		/* No valid bit timing for this clock */
+		Error_Handler();
+	}
+	applyBitTiming(&bitTiming);
 
 	if (HAL_CAN_Init(&canHandle) != HAL_OK)
 	{
@@ -268,16 +667,144 @@ static void initCanPeripheral(void) {
 		Error_Handler();
 	}
 
-	/*##-4- Activate CAN RX notification #######################################*/
-	//	HAL_NVIC_EnableIRQ(CAN1_RX0_IRQn);
-	//	if (HAL_CAN_ActivateNotification(&canHandle, CAN_IT_RX_FIFO0_MSG_PENDING) != HAL_OK)
-	//	{
-	//		/* Notification Error */
-	//		Error_Handler();
-	//	}
+	/*##-4- Activate CAN RX and TX notification ##############################*/
+	// both RX IRQs have the same priority, they never preempt each other
+	// and together they are the single producer of the RX ring
+	HAL_NVIC_SetPriority(CAN1_RX0_IRQn, 1, 0);
+	HAL_NVIC_EnableIRQ(CAN1_RX0_IRQn);
+	HAL_NVIC_SetPriority(CAN1_RX1_IRQn, 1, 0);
+	HAL_NVIC_EnableIRQ(CAN1_RX1_IRQn);
+	HAL_NVIC_SetPriority(CAN1_TX_IRQn, 1, 0);
+	HAL_NVIC_EnableIRQ(CAN1_TX_IRQn);
+	if (HAL_CAN_ActivateNotification(&canHandle, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO0_OVERRUN
+			| CAN_IT_RX_FIFO1_MSG_PENDING | CAN_IT_RX_FIFO1_OVERRUN | CAN_IT_TX_MAILBOX_EMPTY) != HAL_OK)
+	{
+		/* Notification Error */
+		Error_Handler();
+	}
+
+}
+
+/**
+ * Copy bit timing into the CAN init structure, HAL_CAN_Init() has to be
+ * called afterwards
+ */
+static void applyBitTiming(const CanBitTiming *timing) {
+	bitTiming = *timing;
+	canHandle.Init.Prescaler = timing->prescaler;
+	canHandle.Init.TimeSeg1 = (timing->bs1 - 1) << CAN_BTR_TS1_Pos;
+	canHandle.Init.TimeSeg2 = (timing->bs2 - 1) << CAN_BTR_TS2_Pos;
+	canHandle.Init.SyncJumpWidth = (timing->sjw - 1) << CAN_BTR_SJW_Pos;
+}
+
+/**
+ * Start TIM2 as free running 32 bit counter with 1 MHz
+ */
+static void initTimebase(void) {
+	TIM_HandleTypeDef tim2Handle;
+
+	__HAL_RCC_TIM2_CLK_ENABLE();
+
+	tim2Handle.Instance = TIM2;
+	tim2Handle.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+	tim2Handle.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+	tim2Handle.Init.CounterMode = TIM_COUNTERMODE_UP;
+	tim2Handle.Init.Period = 0xFFFFFFFF;
+	tim2Handle.Init.Prescaler = APB1_TimerPrescaler(1000000);
+	tim2Handle.Init.RepetitionCounter = 0;
+	HAL_TIM_Base_Init(&tim2Handle);
+	HAL_TIM_Base_Start(&tim2Handle);
+}
+
+
+/**
+ * Move queued frames into free TX mailboxes.
+ * Must be called with interrupts disabled or from the CAN TX ISR.
+ */
+static void fillTxMailboxes(void) {
+	CAN_TxHeaderTypeDef txHeader;
+	CanMsg msg;
+	uint32_t txMailbox;
+
+	while (HAL_CAN_GetTxMailboxesFreeLevel(&canHandle) > 0 && canTxQueuePop(&txQueue, &msg)) {
+		txHeader.StdId = msg.ide ? 0 : msg.id;
+		txHeader.ExtId = msg.ide ? msg.id : 0;
+		txHeader.IDE   = msg.ide ? CAN_ID_EXT : CAN_ID_STD;
+		txHeader.RTR   = msg.rtr ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+		txHeader.DLC   = msg.dlc;
+		txHeader.TransmitGlobalTime = DISABLE;
+		if (HAL_CAN_AddTxMessage(&canHandle, &txHeader, msg.data, &txMailbox) == HAL_OK) {
+			// txMailbox is CAN_TX_MAILBOX0 (1), 1 (2) or 2 (4)
+			txPending[txMailbox >> 1] = msg;
+		}
+	}
+}
+
+/**
+ * Book keeping for a sent frame, then refill the mailboxes
+ */
+static void txMailboxComplete(uint32_t mailbox) {
+	uint32_t now = canGetTimeUs();
+
+	txSent++;
+	if (txCompleteCallback != NULL) {
+		txCompleteCallback(&txPending[mailbox], now);
+	}
+	// in loopback modes the frame is counted when it is received
+	if (opMode == CAN_OPMODE_NORMAL || opMode == CAN_OPMODE_SILENT) {
+		txPending[mailbox].timestamp = now;
+		canRingPush(&txDoneRing, &txPending[mailbox]);
+	}
+	fillTxMailboxes();
+}
+
+/**
+ * Re-initialize the controller after changing canHandle.Init.
+ * Filters and notifications are kept.
+ */
+static int restartController(void) {
+	uint32_t primask;
+
+	HAL_CAN_Stop(&canHandle);
+	if (HAL_CAN_Init(&canHandle) != HAL_OK || HAL_CAN_Start(&canHandle) != HAL_OK) {
+		return 0;
+	}
+	// the TX ISR pops the queue as well
+	primask = __get_PRIMASK();
+	__disable_irq();
+	fillTxMailboxes();
+	__set_PRIMASK(primask);
+	return 1;
+}
+
+/**
+ * CAN1-TX ISR
+ */
+void CAN1_TX_IRQHandler(void)
+{
+	HAL_CAN_IRQHandler(&canHandle);
+}
+
+/**
+ * @brief  Tx mailbox complete callbacks, refill the mailboxes from the queue
+ * @param  hcan: pointer to a CAN_HandleTypeDef structure that contains
+ *         the configuration information for the specified CAN.
+ * @retval None
+ */
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	txMailboxComplete(0);
+}
 
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	txMailboxComplete(1);
 }
 
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	txMailboxComplete(2);
+}
 
 /**
  * CAN1-RX ISR
@@ -295,8 +822,69 @@ void CAN1_RX0_IRQHandler(void)
  */
 void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan)
 {
-	// Receive is done in main loop
+	drainRxFifo(hcan, CAN_RX_FIFO0);
+}
+
+/**
+ * CAN1-RX1 ISR
+ */
+void CAN1_RX1_IRQHandler(void)
+{
+	HAL_CAN_IRQHandler(&canHandle);
+}
+
+/**
+ * @brief  Rx Fifo 1 message pending callback
+ * @param  hcan: pointer to a CAN_HandleTypeDef structure that contains
+ *         the configuration information for the specified CAN.
+ * @retval None
+ */
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+	drainRxFifo(hcan, CAN_RX_FIFO1);
+}
+
+/**
+ * Move all frames of a hardware RX FIFO into the RX ring
+ */
+static void drainRxFifo(CAN_HandleTypeDef *hcan, uint32_t fifo)
+{
+	CAN_RxHeaderTypeDef rxHeader;
+	CanMsg msg;
+
+	// empty the whole FIFO, it only holds 3 frames
+	while (HAL_CAN_GetRxFifoFillLevel(hcan, fifo) > 0) {
+		if (HAL_CAN_GetRxMessage(hcan, fifo, &rxHeader, msg.data) != HAL_OK) {
+			break;
+		}
+		msg.timestamp = canGetTimeUs();
+		msg.ide = (rxHeader.IDE == CAN_ID_EXT);
+		msg.id = msg.ide ? rxHeader.ExtId : rxHeader.StdId;
+		msg.rtr = (rxHeader.RTR == CAN_RTR_REMOTE);
+		msg.dlc = rxHeader.DLC;
+		rxCount++;
+		canRingPush(&rxRing, &msg);	// overruns are counted by the ring
+	}
+}
+
+/**
+ * @brief  Error callback, counts RX FIFO overruns
+ * @param  hcan: pointer to a CAN_HandleTypeDef structure that contains
+ *         the configuration information for the specified CAN.
+ * @retval None
+ */
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+{
+	if (HAL_CAN_GetError(hcan) & HAL_CAN_ERROR_RX_FOV0) {
+		rxFifoOverruns++;
+	}
+	if (HAL_CAN_GetError(hcan) & HAL_CAN_ERROR_RX_FOV1) {
+		rxFifoOverruns++;
+	}
+	HAL_CAN_ResetError(hcan);
 
+	// a mailbox may have been released by an arbitration loss or TX error
+	fillTxMailboxes();
 }
 
 
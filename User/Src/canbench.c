@@ -0,0 +1,217 @@
+/**
+ ******************************************************************************
+ * @file           : canbench.c
+ * @brief          : CAN throughput and latency benchmark
+ ******************************************************************************
+ * Switches the controller to a loopback mode and keeps the TX queue full
+ * for a given time. Every frame carries a sequence number, so the TX
+ * complete interrupt and the receive path can match it to its enqueue
+ * and transmit time. All times come from the transport's timebase, so the
+ * benchmark runs on the target and against the host virtual bus.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canbench.h"
+
+/* Private define ------------------------------------------------------------*/
+#define DRAIN_TIMEOUT_US	100000
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t txLatency[CAN_BENCH_SAMPLES];		// written by TX ISR
+static volatile uint32_t txSamples;
+static uint32_t txDoneUs[CAN_BENCH_SAMPLES];		// TX complete time by sequence number
+static uint32_t txDoneSeq[CAN_BENCH_SAMPLES];
+static uint32_t rxLatency[CAN_BENCH_SAMPLES];		// written by main loop
+static uint32_t rxSamples;
+static volatile uint32_t sentFrames;
+static volatile uint32_t lastTxUs;
+static volatile uint64_t busBits;
+
+/* Private function prototypes -----------------------------------------------*/
+static void onTxComplete(const CanMsg *msg, uint32_t timeUs);
+static void onReceive(const CanMsg *msg);
+static uint32_t getSeq(const CanMsg *msg);
+static void percentiles(uint32_t *samples, uint32_t count, CanBenchLatency *latency);
+static int compareU32(const void *a, const void *b);
+
+/**
+ * Saturate the bus in loopback mode and measure throughput and latency.
+ * Blocks for about durationMs, normal reception is suspended meanwhile.
+ * @param t transport to measure
+ * @param mode CAN_OPMODE_LOOPBACK or CAN_OPMODE_SILENT_LOOPBACK
+ * @param durationMs time frames are generated
+ * @param result measurement results
+ * @return 1 on success, 0 if the mode could not be set
+ */
+int canBenchRun(CanTransport *t, CanOpMode mode, uint32_t durationMs, CanBenchResult *result) {
+	CanOpMode oldMode = t->getMode(t);
+	CanMsg tx, rx;
+	uint32_t seq = 0;
+	uint32_t start, now;
+
+	memset(result, 0, sizeof(*result));
+	if (!t->setMode(t, mode)) {
+		return 0;
+	}
+
+	while (t->receive(t, &rx)) {
+		// drop frames received before the benchmark
+	}
+	txSamples = 0;
+	rxSamples = 0;
+	sentFrames = 0;
+	busBits = 0;
+	memset(txDoneSeq, 0xFF, sizeof(txDoneSeq));
+	t->setTxCallback(t, onTxComplete);
+
+	memset(&tx, 0, sizeof(tx));
+	tx.id = CAN_BENCH_ID;
+	tx.dlc = 8;
+
+	start = t->timeUs(t);
+	lastTxUs = start;
+	do {
+		now = t->timeUs(t);
+		while (t->txFree(t) > 0) {
+			tx.data[0] = seq;
+			tx.data[1] = seq >> 8;
+			tx.data[2] = seq >> 16;
+			tx.data[3] = seq >> 24;
+			t->transmit(t, &tx);
+			seq++;
+		}
+		while (t->receive(t, &rx)) {
+			onReceive(&rx);
+			result->received++;
+		}
+		t->idle(t);
+	} while (now - start < durationMs * 1000);
+
+	// wait for the queued frames to come back
+	while (sentFrames < seq && t->timeUs(t) - now < DRAIN_TIMEOUT_US) {
+		while (t->receive(t, &rx)) {
+			onReceive(&rx);
+			result->received++;
+		}
+		t->idle(t);
+	}
+	while (t->receive(t, &rx)) {
+		onReceive(&rx);
+		result->received++;
+	}
+
+	t->setTxCallback(t, NULL);
+	t->setMode(t, oldMode);
+
+	result->mode = mode;
+	result->bitrate = t->bitrate(t);
+	result->durationUs = lastTxUs - start;
+	result->sent = sentFrames;
+	if (result->durationUs > 0) {
+		result->framesPerSecond = (uint32_t)(((uint64_t)result->received * 1000000) / result->durationUs);
+		result->busLoadPermille = (uint32_t)((busBits * 1000000000ull)
+				/ ((uint64_t)result->durationUs * result->bitrate));
+	}
+	percentiles(txLatency, (txSamples < CAN_BENCH_SAMPLES) ? txSamples : CAN_BENCH_SAMPLES, &result->txLatency);
+	percentiles(rxLatency, (rxSamples < CAN_BENCH_SAMPLES) ? rxSamples : CAN_BENCH_SAMPLES, &result->rxLatency);
+	return 1;
+}
+
+/**
+ * One line key=value summary of a result, for logging and scripts. The
+ * rx percentiles are left out if there are no rx samples.
+ * @param result benchmark result
+ * @param buf destination
+ * @param size size of buf
+ * @return number of characters written (see snprintf)
+ */
+int canBenchFormat(const CanBenchResult *result, char *buf, uint32_t size) {
+	int len;
+
+	len = snprintf(buf, size,
+			"CANBENCH mode=%s bitrate=%lu duration_us=%lu sent=%lu received=%lu fps=%lu load_permille=%lu"
+			" tx_p50=%lu tx_p90=%lu tx_p99=%lu tx_max=%lu",
+			(result->mode == CAN_OPMODE_SILENT_LOOPBACK) ? "silent-loopback" : "loopback",
+			(unsigned long)result->bitrate, (unsigned long)result->durationUs,
+			(unsigned long)result->sent, (unsigned long)result->received,
+			(unsigned long)result->framesPerSecond, (unsigned long)result->busLoadPermille,
+			(unsigned long)result->txLatency.p50, (unsigned long)result->txLatency.p90,
+			(unsigned long)result->txLatency.p99, (unsigned long)result->txLatency.max);
+	if (result->rxLatency.samples == 0 || len < 0 || (uint32_t)len >= size) {
+		return len;
+	}
+	return len + snprintf(buf + len, size - len,
+			" rx_p50=%lu rx_p90=%lu rx_p99=%lu rx_max=%lu",
+			(unsigned long)result->rxLatency.p50, (unsigned long)result->rxLatency.p90,
+			(unsigned long)result->rxLatency.p99, (unsigned long)result->rxLatency.max);
+}
+
+/**
+ * Called from the TX interrupt for every sent frame
+ */
+static void onTxComplete(const CanMsg *msg, uint32_t timeUs) {
+	uint32_t seq;
+
+	if (msg->id != CAN_BENCH_ID || msg->ide) {
+		return;
+	}
+	seq = getSeq(msg);
+	txDoneUs[seq % CAN_BENCH_SAMPLES] = timeUs;
+	txDoneSeq[seq % CAN_BENCH_SAMPLES] = seq;
+	txLatency[txSamples % CAN_BENCH_SAMPLES] = timeUs - msg->timestamp;
+	txSamples++;
+	sentFrames++;
+	lastTxUs = timeUs;
+	busBits += canFrameBits(msg->id, msg->ide, msg->rtr, msg->dlc, msg->data);
+}
+
+/**
+ * Match a received frame with its TX complete time
+ */
+static void onReceive(const CanMsg *msg) {
+	uint32_t seq;
+	int32_t latency;
+
+	if (msg->id != CAN_BENCH_ID || msg->ide) {
+		return;
+	}
+	seq = getSeq(msg);
+	if (txDoneSeq[seq % CAN_BENCH_SAMPLES] != seq) {
+		return;		// TX complete not seen yet or already overwritten
+	}
+	// RX and TX interrupt are raised together, RX may be served first
+	latency = (int32_t)(msg->timestamp - txDoneUs[seq % CAN_BENCH_SAMPLES]);
+	rxLatency[rxSamples % CAN_BENCH_SAMPLES] = (latency > 0) ? latency : 0;
+	rxSamples++;
+}
+
+static uint32_t getSeq(const CanMsg *msg) {
+	return msg->data[0] | msg->data[1] << 8 | msg->data[2] << 16 | (uint32_t)msg->data[3] << 24;
+}
+
+/**
+ * Sort samples and pick percentiles
+ */
+static void percentiles(uint32_t *samples, uint32_t count, CanBenchLatency *latency) {
+	latency->samples = count;
+	if (count == 0) {
+		return;
+	}
+	qsort(samples, count, sizeof(samples[0]), compareU32);
+	latency->p50 = samples[(count * 50) / 100];
+	latency->p90 = samples[(count * 90) / 100];
+	latency->p99 = samples[(count * 99) / 100];
+	latency->max = samples[count - 1];
+}
+
+static int compareU32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
@@ -0,0 +1,180 @@
+/**
+ ******************************************************************************
+ * @file           : canbittiming.c
+ * @brief          : CAN bit timing solver
+ ******************************************************************************
+ * Finds prescaler and segment lengths for a bitrate and sample point.
+ * A bit is 1 + BS1 + BS2 time quanta long, a time quantum is
+ * prescaler / clock. Candidates are rated by bitrate error first, then by
+ * sample point error, then by the number of time quanta per bit (more
+ * quanta allow a finer resynchronization).
+ * Also calculates how many bit times a frame occupies on the bus.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stdlib.h>
+
+#include "canbittiming.h"
+
+/* Private define ------------------------------------------------------------*/
+#define TQ_MIN			8		// fewer quanta make the sample point too coarse
+#define TQ_MAX			25		// 1 + 16 + 8
+#define BS1_MAX			16
+#define BS2_MAX			8
+#define SJW_MAX			4
+#define PRESCALER_MAX	1024
+
+// bits after the CRC: CRC delimiter, ACK slot + delimiter, EOF, intermission
+#define FRAME_TAIL_BITS	(1 + 2 + 7 + 3)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct {
+	uint32_t bits;		// bits including stuff bits
+	uint32_t run;		// length of the current run of equal bits
+	uint8_t  last;		// value of the last bit on the bus
+	uint16_t crc;
+} BitStream;
+
+/* Private function prototypes -----------------------------------------------*/
+static void putBits(BitStream *bs, uint32_t value, uint32_t count, int crc);
+
+/**
+ * Calculate bit timing
+ * @param clock CAN peripheral clock (PCLK1) in Hz
+ * @param bitrate requested bitrate in bit/s
+ * @param samplePointPermille requested sample point, e.g. 875 for 87.5%
+ * @param timing result
+ * @return 1 on success, 0 if no valid setting exists
+ */
+int canBitTimingSolve(uint32_t clock, uint32_t bitrate, uint32_t samplePointPermille, CanBitTiming *timing) {
+	uint32_t tq;
+	uint32_t bestRateErr = 0xFFFFFFFF;
+	uint32_t bestSpErr = 0xFFFFFFFF;
+	int found = 0;
+
+	if (bitrate == 0 || samplePointPermille == 0 || samplePointPermille >= 1000) {
+		return 0;
+	}
+
+	for (tq = TQ_MAX; tq >= TQ_MIN; tq--) {
+		uint32_t prescaler = (clock + (bitrate * tq) / 2) / (bitrate * tq);
+		uint32_t bs1, bs2, actual, rateErr, sp, spErr;
+
+		if (prescaler < 1 || prescaler > PRESCALER_MAX) {
+			continue;
+		}
+
+		bs2 = (tq * (1000 - samplePointPermille) + 500) / 1000;
+		if (bs2 < 1) {
+			bs2 = 1;
+		}
+		if (bs2 > BS2_MAX) {
+			bs2 = BS2_MAX;
+		}
+		bs1 = tq - 1 - bs2;
+		if (bs1 < 1 || bs1 > BS1_MAX) {
+			continue;
+		}
+
+		actual = clock / (prescaler * tq);
+		rateErr = (uint32_t)(((uint64_t)abs((int32_t)(actual - bitrate)) * 1000000) / bitrate);
+		sp = ((1 + bs1) * 1000) / tq;
+		spErr = (uint32_t)abs((int32_t)(sp - samplePointPermille));
+
+		// tq counts down, so on a tie the setting with more quanta is kept
+		if (rateErr < bestRateErr || (rateErr == bestRateErr && spErr < bestSpErr)) {
+			bestRateErr = rateErr;
+			bestSpErr = spErr;
+			timing->prescaler = prescaler;
+			timing->bs1 = bs1;
+			timing->bs2 = bs2;
+			timing->sjw = (bs2 < SJW_MAX) ? bs2 : SJW_MAX;
+			timing->bitrate = actual;
+			timing->errorPpm = (actual >= bitrate) ? (int32_t)rateErr : -(int32_t)rateErr;
+			timing->samplePointPermille = sp;
+			found = 1;
+		}
+	}
+	return found;
+}
+
+/**
+ * Exact length of a frame on the bus, including stuff bits and
+ * the 3 bit intermission
+ * @param id 11 or 29 bit identifier
+ * @param ide 1 = extended identifier
+ * @param rtr 1 = remote frame (no data field)
+ * @param dlc data length code, 0..8
+ * @param data payload
+ * @return frame length in bit times
+ */
+uint32_t canFrameBits(uint32_t id, uint8_t ide, uint8_t rtr, uint8_t dlc, const uint8_t *data) {
+	BitStream bs = { 0, 0, 1, 0 };		// bus is recessive before SOF
+	uint32_t i;
+
+	if (dlc > 8) {
+		dlc = 8;
+	}
+
+	putBits(&bs, 0, 1, 1);								// SOF
+	if (ide) {
+		putBits(&bs, (id >> 18) & 0x7FF, 11, 1);		// base ID
+		putBits(&bs, 3, 2, 1);							// SRR, IDE
+		putBits(&bs, id & 0x3FFFF, 18, 1);				// ID extension
+		putBits(&bs, rtr ? 1 : 0, 1, 1);				// RTR
+		putBits(&bs, 0, 2, 1);							// r1, r0
+	} else {
+		putBits(&bs, id & 0x7FF, 11, 1);
+		putBits(&bs, rtr ? 1 : 0, 1, 1);				// RTR
+		putBits(&bs, 0, 2, 1);							// IDE, r0
+	}
+	putBits(&bs, dlc, 4, 1);
+	for (i = 0; !rtr && i < dlc; i++) {
+		putBits(&bs, data[i], 8, 1);
+	}
+	putBits(&bs, bs.crc, 15, 0);
+
+	return bs.bits + FRAME_TAIL_BITS;
+}
+
+/**
+ * Worst case length of a frame on the bus, assuming a stuff bit after
+ * every 4 bits of the stuffed region (SOF to CRC)
+ * @param ide 1 = extended identifier
+ * @param dlc data length code, 0..8
+ * @return frame length in bit times
+ */
+uint32_t canFrameBitsMax(uint8_t ide, uint8_t dlc) {
+	uint32_t stuffed = (ide ? 54 : 34) + 8 * ((dlc > 8) ? 8 : dlc);
+
+	return stuffed + (stuffed - 1) / 4 + FRAME_TAIL_BITS;
+}
+
+/**
+ * Append bits MSB first, insert stuff bits and optionally update the CRC15
+ */
+static void putBits(BitStream *bs, uint32_t value, uint32_t count, int crc) {
+	while (count-- > 0) {
+		uint8_t bit = (value >> count) & 1;
+
+		if (crc) {
+			uint8_t crcNext = bit ^ ((bs->crc >> 14) & 1);
+
+			bs->crc = (bs->crc << 1) & 0x7FFF;
+			if (crcNext) {
+				bs->crc ^= 0x4599;
+			}
+		}
+
+		bs->run = (bit == bs->last) ? bs->run + 1 : 1;
+		bs->last = bit;
+		bs->bits++;
+		if (bs->run == 5) {
+			// stuff bit of opposite value starts a new run
+			bs->last = !bit;
+			bs->run = 1;
+			bs->bits++;
+		}
+	}
+}
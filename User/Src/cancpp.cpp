@@ -10,9 +10,12 @@
 #include "stm32f429i_discovery_lcd.h"
 #include "tempsensor.h"
 #include "CanFrame.h"
+#include "candispatch.h"
+#include "canmessages.h"
+#include "canstats.h"
 
 // function declarations
-// ...
+static void onCanFrame(const CanMsg *msg, void *ctx);
 
 /**
  * canInit function
@@ -44,7 +47,11 @@ extern "C" void cancppInit(void) {
 	LCD_SetPrintPosition(30,1);
 	printf("Bit-Timing-Register: 0x%lx", CAN1->BTR);
 
-	tempSensorInit();
+	canDispatchInit();
+	canDispatchSubscribe(StatusMsg::ID, 0, onCanFrame, NULL);
+	canDispatchSubscribe(CAN_STATS_REQUEST_ID, 0, canStatsRequestHandler, NULL);
+
+	tempSensorInit(TEMP_SENSOR_RESOLUTION);
 } 
 
 /**
@@ -54,17 +61,21 @@ extern "C" void cancppSendTask(void) {
 	CanFrame tx;
 	static uint8_t sendCnt = 0;
 
-	float t = tempSensorGetTemperature();
+	int16_t t = tempSensorGetTemperature();
+	char text[12];
+
+	tempSensorFormat(text, sizeof(text), t);
 	LCD_SetColors(LCD_COLOR_GREEN, LCD_COLOR_BLACK);
 	LCD_SetPrintPosition(11,1);
-	printf("T: %3.2f", t);
-	uint16_t p = t * 10 ;
+	printf("T: %s  ", text);
+	uint8_t data[StatusMsg::DLC] = { 0 };
 
-	tx.setId(0x0F5);
-	tx.addData(0xAF);
-	tx.addData(sendCnt);
-	tx.addData(p);
-	tx.addData(p << 8);
+	StatusMsg::Marker::pack(data, StatusMsg::MARKER);
+	StatusMsg::Counter::pack(data, sendCnt);
+	StatusMsg::Temperature::pack(data, t);
+
+	tx.setId(StatusMsg::ID);
+	tx.setData(data, sizeof(data));
 
 	if (tx.txData()) {
 		sendCnt++;
@@ -75,19 +86,28 @@ extern "C" void cancppSendTask(void) {
 }
 
 /**
- * Receive message on CAN Bus and show content on the display
+ * Pass received messages to their subscribers
  */
 extern "C" void cancppReceiveTask(void) {
+	CanMsg msg;
+
+	while (canReceive(&msg)) {
+		canDispatch(&msg);
+	}
+}
+
+/**
+ * Show content of a received message on the display
+ */
+static void onCanFrame(const CanMsg *msg, void *ctx) {
 	CanFrame rx;
 	static uint8_t recvCnt = 0;
 
-	if (rx.rxData()) {
-		recvCnt++;
-		LCD_SetColors(LCD_COLOR_GREEN, LCD_COLOR_BLACK);
-		LCD_SetPrintPosition(7,15);
-		printf("%5d", recvCnt);
+	rx.setMsg(msg);
+	recvCnt++;
+	LCD_SetColors(LCD_COLOR_GREEN, LCD_COLOR_BLACK);
+	LCD_SetPrintPosition(7,15);
+	printf("%5d", recvCnt);
 
-		rx.printData(15, 13);
-	}
+	rx.printData(15, 13);
 }
-
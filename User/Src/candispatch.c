@@ -0,0 +1,274 @@
+/**
+ ******************************************************************************
+ * @file           : candispatch.c
+ * @brief          : Per ID dispatch of received CAN frames
+ ******************************************************************************
+ * Standard IDs are looked up in a direct indexed table with one byte per
+ * ID, extended IDs in an open addressing hash table that is kept at most
+ * half full. Both give the handler slot in constant time.
+ * Unsubscribing frees the slot and the hash entry again, the slots stay
+ * packed and the hash table needs no tombstones.
+ * Every handler run is timed with canGetTimeUs().
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+
+#include "candispatch.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct {
+	CanHandler handler;
+	void *ctx;
+	CanDispatchStats stats;
+} Slot;
+
+/* Private define ------------------------------------------------------------*/
+#define EXT_MASK	(CAN_DISPATCH_EXT_SIZE - 1)
+
+#if (CAN_DISPATCH_EXT_SIZE & EXT_MASK) != 0
+#error "CAN_DISPATCH_EXT_SIZE has to be a power of two"
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t  stdIndex[2048];					// slot + 1, 0 = not subscribed
+static uint32_t extId[CAN_DISPATCH_EXT_SIZE];
+static uint8_t  extIndex[CAN_DISPATCH_EXT_SIZE];	// slot + 1, 0 = empty
+static uint32_t numExt;
+static Slot     slots[CAN_DISPATCH_SLOTS];
+static uint32_t numSlots;
+static CanDispatchStats retired;				// sum of all unsubscribed IDs
+static uint32_t unhandled;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t extHash(uint32_t id);
+static uint8_t *findSlot(uint32_t id, uint8_t ide);
+static void extRemove(uint32_t h);
+
+/**
+ * Remove all subscriptions and statistics
+ */
+void canDispatchInit(void) {
+	memset(stdIndex, 0, sizeof(stdIndex));
+	memset(extIndex, 0, sizeof(extIndex));
+	numExt = 0;
+	numSlots = 0;
+	memset(&retired, 0, sizeof(retired));
+	unhandled = 0;
+}
+
+/**
+ * Register a handler for a CAN ID, an existing handler for the ID is replaced
+ * @param id 11 or 29 bit identifier
+ * @param ide 0 = standard, 1 = extended identifier
+ * @param handler function called for every received frame with this ID
+ * @param ctx passed to the handler
+ * @return 1 on success, 0 if the ID is invalid or the tables are full
+ */
+int canDispatchSubscribe(uint32_t id, uint8_t ide, CanHandler handler, void *ctx) {
+	uint8_t *index;
+	Slot *slot;
+
+	if (id > (ide ? 0x1FFFFFFFu : 0x7FFu)) {
+		return 0;
+	}
+
+	index = findSlot(id, ide);
+	if (*index == 0) {
+		if (numSlots >= CAN_DISPATCH_SLOTS) {
+			return 0;
+		}
+		if (ide) {
+			// keep the load factor <= 0.5, so probe sequences stay short
+			if (2 * (numExt + 1) > CAN_DISPATCH_EXT_SIZE) {
+				return 0;
+			}
+			numExt++;
+			extId[index - extIndex] = id;
+		}
+		*index = (uint8_t)++numSlots;
+		slot = &slots[*index - 1];
+		memset(&slot->stats, 0, sizeof(slot->stats));
+		slot->stats.id = id;
+		slot->stats.ide = ide;
+	}
+
+	slot = &slots[*index - 1];
+	slot->handler = handler;
+	slot->ctx = ctx;
+	return 1;
+}
+
+/**
+ * Remove the handler of a CAN ID and free its slot. The statistics of the
+ * ID are added to canDispatchGetRetiredStats(), the last slot moves into
+ * the freed one.
+ * @param id 11 or 29 bit identifier
+ * @param ide 0 = standard, 1 = extended identifier
+ */
+void canDispatchUnsubscribe(uint32_t id, uint8_t ide) {
+	uint8_t *index;
+	uint32_t n;
+	Slot *slot;
+
+	if (id > (ide ? 0x1FFFFFFFu : 0x7FFu)) {
+		return;
+	}
+	index = findSlot(id, ide);
+	if (*index == 0) {
+		return;
+	}
+	n = *index - 1u;
+	slot = &slots[n];
+	retired.calls += slot->stats.calls;
+	retired.totalUs += slot->stats.totalUs;
+	if (slot->stats.maxUs > retired.maxUs) {
+		retired.maxUs = slot->stats.maxUs;
+	}
+
+	if (ide) {
+		extRemove((uint32_t)(index - extIndex));
+	} else {
+		*index = 0;
+	}
+	numSlots--;
+	if (n != numSlots) {
+		*slot = slots[numSlots];
+		*findSlot(slot->stats.id, slot->stats.ide) = (uint8_t)(n + 1);
+	}
+}
+
+/**
+ * Check if a CAN ID has a handler
+ * @return 1 if subscribed, 0 if not
+ */
+int canDispatchIsSubscribed(uint32_t id, uint8_t ide) {
+	uint8_t index;
+
+	if (id > (ide ? 0x1FFFFFFFu : 0x7FFu)) {
+		return 0;
+	}
+	index = *findSlot(id, ide);
+	return index != 0 && slots[index - 1].handler != NULL;
+}
+
+/**
+ * Pass a received frame to its handler
+ * @param msg received frame
+ * @return 1 if a handler has been called, 0 if nobody subscribed to the ID
+ */
+int canDispatch(const CanMsg *msg) {
+	uint8_t index;
+	Slot *slot;
+	CanDispatchStats *stats;
+	uint32_t start, duration;
+
+	if (msg->ide) {
+		index = *findSlot(msg->id, 1);
+	} else {
+		index = stdIndex[msg->id & 0x7FF];
+	}
+	if (index == 0 || slots[index - 1].handler == NULL) {
+		unhandled++;
+		return 0;
+	}
+
+	slot = &slots[index - 1];
+	start = canGetTimeUs();
+	slot->handler(msg, slot->ctx);
+	duration = canGetTimeUs() - start;
+
+	// the handler may have unsubscribed and moved the slots around
+	index = *findSlot(msg->id, msg->ide);
+	stats = (index != 0) ? &slots[index - 1].stats : &retired;
+	stats->calls++;
+	stats->totalUs += duration;
+	if (duration > stats->maxUs) {
+		stats->maxUs = duration;
+	}
+	return 1;
+}
+
+/**
+ * Number of subscribed IDs
+ */
+uint32_t canDispatchCount(void) {
+	return numSlots;
+}
+
+/**
+ * Get handler statistics
+ * @param index 0 .. canDispatchCount()-1, unsubscribing changes the order
+ * @param stats destination
+ * @return 1 on success, 0 if index is out of range
+ */
+int canDispatchGetStats(uint32_t index, CanDispatchStats *stats) {
+	if (index >= numSlots) {
+		return 0;
+	}
+	*stats = slots[index].stats;
+	return 1;
+}
+
+/**
+ * Get the summed up statistics of all IDs unsubscribed since canDispatchInit(),
+ * id and ide are 0
+ */
+void canDispatchGetRetiredStats(CanDispatchStats *stats) {
+	*stats = retired;
+}
+
+/**
+ * Number of received frames without a subscriber
+ */
+uint32_t canDispatchUnhandled(void) {
+	return unhandled;
+}
+
+/**
+ * Multiplicative hash of a 29 bit ID
+ */
+static uint32_t extHash(uint32_t id) {
+	return (id * 2654435761u) >> 16;
+}
+
+/**
+ * Table entry of an ID, for extended IDs the free entry the ID would
+ * be inserted at if it is not in the table
+ */
+static uint8_t *findSlot(uint32_t id, uint8_t ide) {
+	uint32_t h;
+
+	if (!ide) {
+		return &stdIndex[id & 0x7FF];
+	}
+	// linear probing, the table is never full, so an empty entry is always found
+	for (h = extHash(id) & EXT_MASK; extIndex[h] != 0; h = (h + 1) & EXT_MASK) {
+		if (extId[h] == id) {
+			break;
+		}
+	}
+	return &extIndex[h];
+}
+
+/**
+ * Remove entry h of the hash table. Following entries of the probe
+ * sequence move back into the gap, so every remaining ID is still found
+ * before the first empty entry.
+ */
+static void extRemove(uint32_t h) {
+	uint32_t next, home;
+
+	for (next = (h + 1) & EXT_MASK; extIndex[next] != 0; next = (next + 1) & EXT_MASK) {
+		home = extHash(extId[next]) & EXT_MASK;
+		// the entry may move to h if h lies between its home and its position
+		if (((next - home) & EXT_MASK) >= ((next - h) & EXT_MASK)) {
+			extId[h] = extId[next];
+			extIndex[h] = extIndex[next];
+			h = next;
+		}
+	}
+	extIndex[h] = 0;
+	numExt--;
+}
@@ -0,0 +1,430 @@
+/**
+ ******************************************************************************
+ * @file           : canfilter.c
+ * @brief          : Acceptance filter compiler for the bxCAN filter banks
+ ******************************************************************************
+ * Turns a list of subscribed IDs and ID ranges into filter bank settings.
+ * Ranges are split into aligned ID/mask blocks, single IDs go into ID list
+ * banks. Per FIFO and ID type the number of banks is minimized:
+ *   16 bit list: 4 standard IDs     16 bit mask: 2 standard ID/mask pairs
+ *   32 bit list: 2 extended IDs     32 bit mask: 1 extended ID/mask pair
+ * If the result still needs more banks than available, the two entries
+ * whose union lets the fewest additional IDs through are merged until it
+ * fits. The share of accepted but unsubscribed IDs is reported, IDs
+ * covered by several rules or entries are counted once.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+
+#include "canfilter.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct {
+	uint32_t value;		// ID bits that have to match
+	uint32_t care;		// 1 = bit has to match, 0 = don't care
+	uint8_t  ide;
+	uint8_t  fifo;
+} Entry;
+
+/* Private define ------------------------------------------------------------*/
+#define STD_MASK	0x7FFu
+#define EXT_MASK	0x1FFFFFFFu
+
+#define IDMASK(ide)	((ide) ? EXT_MASK : STD_MASK)
+#define IDBITS(ide)	((ide) ? 29 : 11)
+
+#if CAN_FILTER_MAX_ENTRIES > 64
+#error "countUnion() keeps entry sets in a uint64_t"
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+static Entry entries[CAN_FILTER_MAX_ENTRIES];
+static uint32_t numEntries;
+
+/* Private function prototypes -----------------------------------------------*/
+static int addRange(const CanFilterRule *rule);
+static uint32_t entrySize(const Entry *e);
+static uint32_t countIds(void);
+static uint32_t countUnion(uint64_t set, int32_t bit);
+static int isExact(const Entry *e);
+static Entry merge(const Entry *a, const Entry *b);
+static void removeContained(void);
+static uint32_t groupBanks(uint8_t fifo, uint8_t ide, uint32_t *listToMask);
+static uint32_t totalBanks(void);
+static int mergeCheapestPair(void);
+static void emitGroup(uint8_t fifo, uint8_t ide, CanFilterSet *set);
+static uint32_t encode(uint32_t value, uint8_t ide, int scale16);
+static uint32_t encodeMask(uint32_t care, uint8_t ide, int scale16);
+
+/**
+ * Compile subscriptions into filter bank settings
+ * @param rules subscribed IDs and ID ranges
+ * @param numRules number of rules
+ * @param maxBanks number of banks CAN1 may use (1..CAN_FILTER_MAX_BANKS)
+ * @param set result, bank settings and false positive rate
+ * @return 1 on success, 0 if the rules are invalid or do not fit
+ */
+int canFilterCompile(const CanFilterRule *rules, uint32_t numRules, uint32_t maxBanks, CanFilterSet *set) {
+	uint32_t i;
+
+	memset(set, 0, sizeof(*set));
+	numEntries = 0;
+
+	if (numRules == 0 || maxBanks == 0 || maxBanks > CAN_FILTER_MAX_BANKS) {
+		return 0;
+	}
+
+	for (i = 0; i < numRules; i++) {
+		if (rules[i].first > rules[i].last || rules[i].last > IDMASK(rules[i].ide) || rules[i].fifo > 1) {
+			return 0;
+		}
+		if (!addRange(&rules[i])) {
+			return 0;
+		}
+	}
+	set->wantedIds = countIds();
+
+	removeContained();
+	while (totalBanks() > maxBanks) {
+		if (!mergeCheapestPair()) {
+			return 0;
+		}
+		// a merged entry may cover other entries now, they only cost banks
+		removeContained();
+	}
+
+	// FIFO0 banks first, then FIFO1
+	emitGroup(0, 0, set);
+	emitGroup(0, 1, set);
+	emitGroup(1, 0, set);
+	emitGroup(1, 1, set);
+	set->slaveStartBank = set->numBanks;
+
+	set->acceptedIds = countIds();
+	if (set->acceptedIds > set->wantedIds) {
+		set->falsePositivePermille = (uint32_t)(((uint64_t)(set->acceptedIds - set->wantedIds) * 1000)
+				/ set->acceptedIds);
+	}
+	return 1;
+}
+
+/**
+ * Split an ID range into aligned power of two blocks, each block is
+ * exactly one ID/mask entry
+ */
+static int addRange(const CanFilterRule *rule) {
+	uint32_t lo = rule->first;
+	uint32_t hi = rule->last;
+	uint32_t full = IDMASK(rule->ide);
+
+	for (;;) {
+		uint32_t k = 0;
+		Entry *e;
+
+		while (k < IDBITS(rule->ide)
+				&& (lo & ((2u << k) - 1)) == 0
+				&& lo + (2u << k) - 1 <= hi) {
+			k++;
+		}
+		if (numEntries >= CAN_FILTER_MAX_ENTRIES) {
+			return 0;
+		}
+		e = &entries[numEntries++];
+		e->care = full & ~((1u << k) - 1);
+		e->value = lo & e->care;
+		e->ide = rule->ide;
+		e->fifo = rule->fifo;
+
+		if (lo + (1u << k) - 1 >= hi) {
+			break;
+		}
+		lo += 1u << k;
+	}
+	return 1;
+}
+
+/**
+ * Number of IDs an entry lets through
+ */
+static uint32_t entrySize(const Entry *e) {
+	return (IDMASK(e->ide) & ~e->care) + 1;
+}
+
+/**
+ * Number of IDs at least one entry lets through, standard and extended
+ * IDs together. At most 2^29 + 2^11.
+ */
+static uint32_t countIds(void) {
+	uint64_t std = 0, ext = 0;
+	uint32_t i;
+
+	for (i = 0; i < numEntries; i++) {
+		if (entries[i].ide) {
+			ext |= 1ull << i;
+		} else {
+			std |= 1ull << i;
+		}
+	}
+	return countUnion(std, IDBITS(0) - 1) + countUnion(ext, IDBITS(1) - 1);
+}
+
+/**
+ * Size of the union of a set of entries of one ID type, within the IDs
+ * whose bits above bit agree with all of them. The ID space is split at
+ * the bits the entries care about, so overlapping entries are counted
+ * once. Bits no entry cares about only double the count.
+ * @param set bit i = entries[i]
+ * @param bit highest ID bit not split yet, -1 = a single ID is left
+ */
+static uint32_t countUnion(uint64_t set, int32_t bit) {
+	uint64_t zero = 0, one = 0;
+	uint32_t below, i;
+	int split = 0;
+
+	if (set == 0) {
+		return 0;
+	}
+	if (bit < 0) {
+		return 1;
+	}
+	below = (2u << bit) - 1;
+	for (i = 0; i < numEntries; i++) {
+		const Entry *e = &entries[i];
+
+		if (!((set >> i) & 1)) {
+			continue;
+		}
+		if ((e->care & below) == 0) {
+			return below + 1;		// covers all IDs left
+		}
+		if ((e->care >> bit) & 1) {
+			split = 1;
+			if ((e->value >> bit) & 1) {
+				one |= 1ull << i;
+			} else {
+				zero |= 1ull << i;
+			}
+		} else {
+			zero |= 1ull << i;
+			one |= 1ull << i;
+		}
+	}
+	if (!split) {
+		return 2 * countUnion(set, bit - 1);
+	}
+	return countUnion(zero, bit - 1) + countUnion(one, bit - 1);
+}
+
+static int isExact(const Entry *e) {
+	return e->care == IDMASK(e->ide);
+}
+
+/**
+ * Smallest ID/mask entry covering both entries
+ */
+static Entry merge(const Entry *a, const Entry *b) {
+	Entry m = *a;
+
+	m.care = a->care & b->care & ~(a->value ^ b->value);
+	m.value = a->value & m.care;
+	return m;
+}
+
+/**
+ * Drop entries that are completely covered by another entry
+ */
+static void removeContained(void) {
+	uint32_t i = 0, j;
+
+	while (i < numEntries) {
+		int covered = 0;
+
+		for (j = 0; j < numEntries && !covered; j++) {
+			const Entry *a = &entries[j];
+			const Entry *b = &entries[i];
+
+			// a contains b if a cares about a subset of b's bits and they agree there
+			covered = j != i && a->ide == b->ide && a->fifo == b->fifo
+					&& (a->care & b->care) == a->care && (b->value & a->care) == a->value;
+		}
+		if (covered) {
+			entries[i] = entries[--numEntries];
+		} else {
+			i++;
+		}
+	}
+}
+
+/**
+ * Minimum number of banks for one FIFO/ID type combination
+ * @param listToMask returns how many exact standard IDs should be placed in
+ *        16 bit mask banks to fill up a half used mask bank
+ */
+static uint32_t groupBanks(uint8_t fifo, uint8_t ide, uint32_t *listToMask) {
+	uint32_t exact = 0, mask = 0, x, best = 0xFFFFFFFF;
+	uint32_t i;
+
+	for (i = 0; i < numEntries; i++) {
+		if (entries[i].fifo == fifo && entries[i].ide == ide) {
+			if (isExact(&entries[i])) {
+				exact++;
+			} else {
+				mask++;
+			}
+		}
+	}
+
+	*listToMask = 0;
+	if (ide) {
+		return (exact + 1) / 2 + mask;
+	}
+	for (x = 0; x <= exact; x++) {
+		uint32_t banks = (exact - x + 3) / 4 + (mask + x + 1) / 2;
+
+		if (banks < best) {
+			best = banks;
+			*listToMask = x;
+		}
+	}
+	return best;
+}
+
+static uint32_t totalBanks(void) {
+	uint32_t x;
+
+	return groupBanks(0, 0, &x) + groupBanks(0, 1, &x) + groupBanks(1, 0, &x) + groupBanks(1, 1, &x);
+}
+
+/**
+ * Merge the two entries of the same group whose union adds the fewest IDs
+ * @return 0 if there is nothing left to merge
+ */
+static int mergeCheapestPair(void) {
+	uint32_t i, j, bestI = 0, bestJ = 0;
+	int64_t bestCost = INT64_MAX;
+
+	for (i = 0; i < numEntries; i++) {
+		for (j = i + 1; j < numEntries; j++) {
+			Entry m;
+			int64_t cost;
+
+			if (entries[i].ide != entries[j].ide || entries[i].fifo != entries[j].fifo) {
+				continue;
+			}
+			m = merge(&entries[i], &entries[j]);
+			cost = (int64_t)entrySize(&m) - entrySize(&entries[i]) - entrySize(&entries[j]);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestI = i;
+				bestJ = j;
+			}
+		}
+	}
+	if (bestCost == INT64_MAX) {
+		return 0;
+	}
+
+	entries[bestI] = merge(&entries[bestI], &entries[bestJ]);
+	entries[bestJ] = entries[--numEntries];
+	return 1;
+}
+
+/**
+ * Write the banks of one FIFO/ID type combination
+ */
+static void emitGroup(uint8_t fifo, uint8_t ide, CanFilterSet *set) {
+	uint32_t list[CAN_FILTER_MAX_ENTRIES], numList = 0;
+	const Entry *mask[CAN_FILTER_MAX_ENTRIES];
+	uint32_t numMask = 0;
+	uint32_t listToMask, i;
+	int scale16 = !ide;
+	uint32_t perListBank = ide ? 2 : 4;
+	uint32_t perMaskBank = ide ? 1 : 2;
+
+	groupBanks(fifo, ide, &listToMask);
+
+	for (i = 0; i < numEntries; i++) {
+		const Entry *e = &entries[i];
+
+		if (e->fifo != fifo || e->ide != ide) {
+			continue;
+		}
+		if (isExact(e) && listToMask == 0) {
+			list[numList++] = encode(e->value, ide, scale16);
+		} else {
+			if (isExact(e)) {
+				listToMask--;	// fills a free slot of a 16 bit mask bank
+			}
+			mask[numMask++] = e;
+		}
+	}
+
+	for (i = 0; i < numList; i += perListBank) {
+		CanFilterBank *b = &set->bank[set->numBanks++];
+		uint32_t id[4];
+		uint32_t k;
+
+		// unused slots repeat the last ID
+		for (k = 0; k < perListBank; k++) {
+			id[k] = list[(i + k < numList) ? i + k : numList - 1];
+		}
+		b->listMode = 1;
+		b->scale16 = scale16;
+		b->fifo = fifo;
+		if (scale16) {
+			b->fr1 = id[1] << 16 | id[0];
+			b->fr2 = id[3] << 16 | id[2];
+		} else {
+			b->fr1 = id[0];
+			b->fr2 = id[1];
+		}
+	}
+
+	for (i = 0; i < numMask; i += perMaskBank) {
+		CanFilterBank *b = &set->bank[set->numBanks++];
+		const Entry *e0 = mask[i];
+		const Entry *e1 = mask[(i + 1 < numMask) ? i + 1 : i];
+
+		b->listMode = 0;
+		b->scale16 = scale16;
+		b->fifo = fifo;
+		if (scale16) {
+			b->fr1 = encodeMask(e0->care, ide, 1) << 16 | encode(e0->value, ide, 1);
+			b->fr2 = encodeMask(e1->care, ide, 1) << 16 | encode(e1->value, ide, 1);
+		} else {
+			b->fr1 = encode(e0->value, ide, 0);
+			b->fr2 = encodeMask(e0->care, ide, 0);
+		}
+	}
+}
+
+/**
+ * Filter register layout of an ID (RTR = 0, data frames)
+ *   16 bit: STID[10:0] RTR IDE EXID[17:15]
+ *   32 bit: STID[10:0] EXID[17:0] IDE RTR 0
+ */
+static uint32_t encode(uint32_t value, uint8_t ide, int scale16) {
+	if (scale16) {
+		return (value & STD_MASK) << 5;
+	}
+	if (ide) {
+		return (value & EXT_MASK) << 3 | 0x4;
+	}
+	return (value & STD_MASK) << 21;
+}
+
+/**
+ * Filter register layout of a mask, the IDE bit always has to match,
+ * RTR is don't care
+ */
+static uint32_t encodeMask(uint32_t care, uint8_t ide, int scale16) {
+	if (scale16) {
+		return (care & STD_MASK) << 5 | 0x8;
+	}
+	if (ide) {
+		return (care & EXT_MASK) << 3 | 0x4;
+	}
+	return (care & STD_MASK) << 21 | 0x4;
+}
@@ -0,0 +1,107 @@
+/*
+ * canmessages.cpp
+ *
+ * C interface to the message descriptions in canmessages.h
+ */
+
+#include "canmessages.h"
+
+#include <string.h>
+
+/**
+ * Build the temperature frame
+ * @param msg frame to fill, ID, DLC and payload are set
+ * @param temperature temperature in 1/16 °C
+ */
+extern "C" void canTemperatureMsgEncode(CanMsg *msg, int16_t temperature) {
+	msg->id = TemperatureMsg::ID;
+	msg->ide = 0;
+	msg->rtr = 0;
+	msg->dlc = TemperatureMsg::DLC;
+	memset(msg->data, 0, sizeof(msg->data));
+	TemperatureMsg::Temperature::pack(msg->data, temperature);
+}
+
+/**
+ * Temperature of a received temperature frame
+ * @return temperature in 1/16 °C
+ */
+extern "C" int16_t canTemperatureMsgRaw(const CanMsg *msg) {
+	return TemperatureMsg::Temperature::unpack(msg->data);
+}
+
+/**
+ * Read a statistics request
+ * @return 1 if msg is a valid request
+ */
+extern "C" int canStatsRequestMsgDecode(const CanMsg *msg, uint8_t *index, uint8_t *page) {
+	if (msg->id != StatsRequestMsg::ID || msg->ide || msg->rtr || msg->dlc < StatsRequestMsg::DLC) {
+		return 0;
+	}
+	*index = StatsRequestMsg::Index::unpack(msg->data);
+	*page = StatsRequestMsg::Page::unpack(msg->data);
+	return 1;
+}
+
+/**
+ * Build a statistics reply for the bus
+ * @return 0 if the page does not exist
+ */
+extern "C" int canStatsBusMsgEncode(CanMsg *msg, uint8_t page, const CanStatsBus *bus) {
+	memset(msg, 0, sizeof(*msg));
+	switch (page) {
+	case 0:
+		msg->id = StatsReplyMsg::BusLoad::ID;
+		msg->dlc = StatsReplyMsg::BusLoad::DLC;
+		StatsReplyMsg::Word0::packSaturated(msg->data, bus->loadPermille);
+		StatsReplyMsg::Word1::packSaturated(msg->data, bus->worstLoadPermille);
+		StatsReplyMsg::Word2::packSaturated(msg->data, bus->peakLoadPermille);
+		break;
+	case 1:
+		msg->id = StatsReplyMsg::BusCount::ID;
+		msg->dlc = StatsReplyMsg::BusCount::DLC;
+		StatsReplyMsg::Word0::packSaturated(msg->data, bus->framesPerSecond);
+		StatsReplyMsg::Byte2::packSaturated(msg->data, bus->numIds);
+		StatsReplyMsg::Word3::packSaturated(msg->data, bus->untracked);
+		break;
+	default:
+		return 0;
+	}
+	StatsReplyMsg::Index::pack(msg->data, 0xFF);
+	StatsReplyMsg::Page::pack(msg->data, page);
+	return 1;
+}
+
+/**
+ * Build a statistics reply for one ID
+ * @return 0 if the page does not exist
+ */
+extern "C" int canStatsEntryMsgEncode(CanMsg *msg, uint8_t index, uint8_t page, const CanStatsEntry *entry) {
+	memset(msg, 0, sizeof(*msg));
+	switch (page) {
+	case 0:
+		msg->id = StatsReplyMsg::IdRate::ID;
+		msg->dlc = StatsReplyMsg::IdRate::DLC;
+		StatsReplyMsg::Long0::pack(msg->data, entry->id | (uint32_t)entry->ide << 31);
+		StatsReplyMsg::Word2::packSaturated(msg->data, entry->framesPerSecond);
+		break;
+	case 1:
+		msg->id = StatsReplyMsg::IdTiming::ID;
+		msg->dlc = StatsReplyMsg::IdTiming::DLC;
+		StatsReplyMsg::Gap0::encode(msg->data, entry->minGapUs);
+		StatsReplyMsg::Gap1::encode(msg->data, entry->maxGapUs);
+		StatsReplyMsg::Gap2::encode(msg->data, entry->jitterUs);
+		break;
+	case 2:
+		msg->id = StatsReplyMsg::IdCount::ID;
+		msg->dlc = StatsReplyMsg::IdCount::DLC;
+		StatsReplyMsg::Long0::pack(msg->data, entry->rxFrames + entry->txFrames);
+		StatsReplyMsg::Word2::packSaturated(msg->data, entry->changePermille);
+		break;
+	default:
+		return 0;
+	}
+	StatsReplyMsg::Index::pack(msg->data, index);
+	StatsReplyMsg::Page::pack(msg->data, page);
+	return 1;
+}
@@ -0,0 +1,81 @@
+/**
+ ******************************************************************************
+ * @file           : canring.c
+ * @brief          : Lock-free CAN frame ring
+ ******************************************************************************
+ * Single-producer/single-consumer ring buffer used between the CAN RX
+ * interrupt and the main loop. head and tail are free running counters,
+ * the fill level is always (head - tail).
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include "canring.h"
+
+/* Private define ------------------------------------------------------------*/
+#define RING_MASK	(CAN_RX_RING_SIZE - 1)
+
+#if (CAN_RX_RING_SIZE & RING_MASK) != 0
+#error "CAN_RX_RING_SIZE has to be a power of two"
+#endif
+
+/**
+ * Reset ring to empty state
+ * @param ring ring to initialize
+ */
+void canRingInit(CanRing *ring) {
+	ring->head = 0;
+	ring->tail = 0;
+	ring->overruns = 0;
+	ring->highWater = 0;
+}
+
+/**
+ * Store a frame in the ring, must only be called by the producer
+ * @param ring target ring
+ * @param msg frame to store
+ * @return 1 on success, 0 if the ring is full (frame is dropped and counted)
+ */
+int canRingPush(CanRing *ring, const CanMsg *msg) {
+	uint32_t head = ring->head;
+	uint32_t fill = head - ring->tail;
+
+	if (fill >= CAN_RX_RING_SIZE) {
+		ring->overruns++;
+		return 0;
+	}
+	if (fill + 1 > ring->highWater) {
+		ring->highWater = fill + 1;
+	}
+	ring->buf[head & RING_MASK] = *msg;
+	// frame has to be visible before the consumer sees the new head
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	ring->head = head + 1;
+	return 1;
+}
+
+/**
+ * Take the oldest frame out of the ring, must only be called by the consumer
+ * @param ring source ring
+ * @param msg destination for the frame
+ * @return 1 if a frame has been returned, 0 if the ring is empty
+ */
+int canRingPop(CanRing *ring, CanMsg *msg) {
+	uint32_t tail = ring->tail;
+
+	if (ring->head == tail) {
+		return 0;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	*msg = ring->buf[tail & RING_MASK];
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	ring->tail = tail + 1;
+	return 1;
+}
+
+/**
+ * Number of frames currently stored in the ring
+ */
+uint32_t canRingCount(const CanRing *ring) {
+	return ring->head - ring->tail;
+}
@@ -0,0 +1,309 @@
+/**
+ ******************************************************************************
+ * @file           : canstats.c
+ * @brief          : Bus load and per ID statistics
+ ******************************************************************************
+ * Every received and sent frame is passed to canStatsFrame(). The ID is
+ * looked up in an open addressing hash table with a bounded probe
+ * sequence, all per ID values are running values (counters, minimum,
+ * maximum, moving averages), so every update takes constant time and the
+ * memory is fixed. IDs that do not fit into the table are only counted.
+ *
+ * The bus load is the sum of the frame lengths in bit times divided by
+ * the window length, once with the exact number of stuff bits and once
+ * with the maximum number of stuff bits possible for the DLC.
+ *
+ * Queries over CAN (all values little endian):
+ *   request CAN_STATS_REQUEST_ID: byte 0 index (0xFF = bus), byte 1 page
+ *   reply   CAN_STATS_REPLY_ID:   byte 0 index, byte 1 page, see canmessages.h
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+
+#include "canstats.h"
+#include "canbittiming.h"
+#include "canmessages.h"
+#include "cantransport.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct {
+	CanStatsEntry stats;
+	uint32_t lastUs;
+	uint32_t meanGap16;		// meanGapUs * 16
+	uint32_t jitter16;		// jitterUs * 16
+	uint8_t  lastDlc;
+	uint8_t  lastData[8];
+} Slot;
+
+/* Private define ------------------------------------------------------------*/
+#define HASH_MASK		(CAN_STATS_HASH_SIZE - 1)
+#define MAX_PROBES		8		// bounds the lookup time, longer chains count as untracked
+#define MAX_AVG_GAP		0x0FFFFFFFu	// longer gaps are averaged as this, the mean * 16 fits in 32 bit
+
+#if (CAN_STATS_HASH_SIZE & HASH_MASK) != 0
+#error "CAN_STATS_HASH_SIZE has to be a power of two"
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+static Slot     slots[CAN_STATS_IDS];
+static uint32_t numSlots;
+static uint32_t hashKey[CAN_STATS_HASH_SIZE];
+static uint8_t  hashIndex[CAN_STATS_HASH_SIZE];	// slot + 1, 0 = empty
+
+static CanStatsBus bus;
+static uint32_t windowStartUs;
+static uint32_t windowFrames;
+static uint32_t windowBits;
+static uint32_t windowBitsMax;
+static uint8_t  windowStarted;
+
+/* Private function prototypes -----------------------------------------------*/
+static Slot *findSlot(uint32_t id, uint8_t ide);
+static void updateWindow(uint32_t timeUs);
+static void fillDerived(CanStatsEntry *entry, uint32_t idleUs);
+
+/**
+ * Clear all statistics
+ */
+void canStatsInit(void) {
+	memset(hashIndex, 0, sizeof(hashIndex));
+	memset(&bus, 0, sizeof(bus));
+	numSlots = 0;
+	windowFrames = 0;
+	windowBits = 0;
+	windowBitsMax = 0;
+	windowStarted = 0;
+}
+
+/**
+ * Account a frame that has been received or sent
+ * @param msg the frame
+ * @param dir CAN_STATS_RX or CAN_STATS_TX
+ * @param timeUs time the frame has been on the bus
+ */
+void canStatsFrame(const CanMsg *msg, uint8_t dir, uint32_t timeUs) {
+	uint8_t dlc = (msg->dlc > 8) ? 8 : msg->dlc;
+	CanStatsEntry *s;
+	Slot *slot;
+
+	updateWindow(timeUs);
+	windowFrames++;
+	windowBits += canFrameBits(msg->id, msg->ide, msg->rtr, dlc, msg->data);
+	windowBitsMax += canFrameBitsMax(msg->ide, msg->rtr ? 0 : dlc);
+	bus.frames++;
+
+	slot = findSlot(msg->id, msg->ide);
+	if (slot == NULL) {
+		bus.untracked++;
+		return;
+	}
+
+	s = &slot->stats;
+	if (s->rxFrames + s->txFrames > 0) {
+		// a looped back frame may be accounted after a later one
+		int32_t gap = (int32_t)(timeUs - slot->lastUs);
+		uint32_t g = (gap > 0) ? gap : 0;
+		int32_t dev;
+
+		if (g < s->minGapUs) {
+			s->minGapUs = g;
+		}
+		if (g > s->maxGapUs) {
+			s->maxGapUs = g;
+		}
+		if (g > MAX_AVG_GAP) {
+			g = MAX_AVG_GAP;
+		}
+		if (s->rxFrames + s->txFrames == 1) {
+			slot->meanGap16 = g << 4;
+		} else {
+			slot->meanGap16 += g * 2 - (slot->meanGap16 >> 3);	// 1/8 of (g - mean), scaled by 16
+		}
+		dev = (int32_t)g - (int32_t)(slot->meanGap16 >> 4);
+		dev = (dev < 0) ? -dev : dev;
+		slot->jitter16 += dev - (slot->jitter16 >> 4);		// 1/16 of (|dev| - jitter), scaled by 16
+	}
+	if (dlc != slot->lastDlc || memcmp(msg->data, slot->lastData, dlc) != 0) {
+		s->changes++;
+		slot->lastDlc = dlc;
+		memcpy(slot->lastData, msg->data, dlc);
+	}
+	if (dir == CAN_STATS_TX) {
+		s->txFrames++;
+	} else {
+		s->rxFrames++;
+	}
+	slot->lastUs = timeUs;
+}
+
+/**
+ * Bus statistics of the last complete window
+ */
+void canStatsGetBus(CanStatsBus *result) {
+	CanTransport *t = canTransportGet();
+
+	if (t != NULL) {
+		updateWindow(t->timeUs(t));
+	}
+	*result = bus;
+	result->numIds = numSlots;
+}
+
+/**
+ * Statistics of one ID
+ * @param index 0 .. number of tracked IDs - 1, in order of first appearance
+ * @return 1 on success, 0 if index is out of range
+ */
+int canStatsGetEntry(uint32_t index, CanStatsEntry *entry) {
+	CanTransport *t = canTransportGet();
+	uint32_t now;
+
+	if (index >= numSlots) {
+		return 0;
+	}
+	now = (t != NULL) ? t->timeUs(t) : slots[index].lastUs;
+
+	*entry = slots[index].stats;
+	entry->meanGapUs = slots[index].meanGap16 >> 4;
+	entry->jitterUs = slots[index].jitter16 >> 4;
+	fillDerived(entry, now - slots[index].lastUs);
+	return 1;
+}
+
+/**
+ * ID with the highest frame rate, to spot babbling nodes
+ * @return 0 if no frame has been seen yet
+ */
+int canStatsTopTalker(CanStatsEntry *entry) {
+	CanStatsEntry e;
+	uint32_t i;
+	int found = 0;
+
+	for (i = 0; i < numSlots; i++) {
+		canStatsGetEntry(i, &e);
+		if (!found || e.framesPerSecond > entry->framesPerSecond) {
+			*entry = e;
+			found = 1;
+		}
+	}
+	return found;
+}
+
+/**
+ * Dispatch handler for CAN_STATS_REQUEST_ID, answers with CAN_STATS_REPLY_ID
+ */
+void canStatsRequestHandler(const CanMsg *msg, void *ctx) {
+	CanTransport *t = canTransportGet();
+	CanStatsBus b;
+	CanStatsEntry e;
+	CanMsg reply;
+	uint8_t index, page;
+
+	if (!canStatsRequestMsgDecode(msg, &index, &page)) {
+		return;
+	}
+	if (index == 0xFF) {
+		canStatsGetBus(&b);
+		if (!canStatsBusMsgEncode(&reply, page, &b)) {
+			return;
+		}
+	} else {
+		if (!canStatsGetEntry(index, &e) || !canStatsEntryMsgEncode(&reply, index, page, &e)) {
+			return;
+		}
+	}
+	t->transmit(t, &reply);
+}
+
+/**
+ * Slot of an ID, a new slot is taken for an unknown ID
+ * @return NULL if the ID is unknown and there is no room for it
+ */
+static Slot *findSlot(uint32_t id, uint8_t ide) {
+	uint32_t key = id | (uint32_t)ide << 31;
+	uint32_t h = (key * 2654435761u) >> 16;		// Fibonacci hashing
+	uint32_t i;
+
+	for (i = 0; i < MAX_PROBES; i++) {
+		uint32_t pos = (h + i) & HASH_MASK;
+
+		if (hashIndex[pos] == 0) {
+			Slot *slot;
+
+			if (numSlots >= CAN_STATS_IDS) {
+				return NULL;
+			}
+			slot = &slots[numSlots];
+			memset(slot, 0, sizeof(*slot));
+			slot->stats.id = id;
+			slot->stats.ide = ide;
+			slot->stats.minGapUs = 0xFFFFFFFF;
+			slot->lastDlc = 0xFF;		// first frame always counts as change
+			hashKey[pos] = key;
+			hashIndex[pos] = ++numSlots;
+			return slot;
+		}
+		if (hashKey[pos] == key) {
+			return &slots[hashIndex[pos] - 1];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Close the current window if it is over. Windows without any frame
+ * report zero load.
+ */
+static void updateWindow(uint32_t timeUs) {
+	uint32_t elapsed, bitrate;
+	CanTransport *t;
+
+	if (!windowStarted) {
+		windowStarted = 1;
+		windowStartUs = timeUs;
+		return;
+	}
+	elapsed = timeUs - windowStartUs;
+	if ((int32_t)elapsed < CAN_STATS_WINDOW_US) {
+		return;
+	}
+
+	t = canTransportGet();
+	bitrate = (t != NULL) ? t->bitrate(t) : 0;
+	if (bitrate != 0) {
+		uint64_t capacity = (uint64_t)bitrate * elapsed;		// bit times * 1000000
+
+		bus.loadPermille = (uint32_t)((uint64_t)windowBits * 1000000000u / capacity);
+		bus.worstLoadPermille = (uint32_t)((uint64_t)windowBitsMax * 1000000000u / capacity);
+		if (bus.loadPermille > bus.peakLoadPermille) {
+			bus.peakLoadPermille = bus.loadPermille;
+		}
+	}
+	bus.framesPerSecond = (uint32_t)((uint64_t)windowFrames * 1000000 / elapsed);
+
+	windowStartUs = timeUs;
+	windowFrames = 0;
+	windowBits = 0;
+	windowBitsMax = 0;
+}
+
+/**
+ * Values calculated at query time
+ * @param idleUs time since the last frame of the ID, an ID that stopped
+ *        sending must not keep its old rate
+ */
+static void fillDerived(CanStatsEntry *entry, uint32_t idleUs) {
+	uint32_t frames = entry->rxFrames + entry->txFrames;
+	uint32_t gap = entry->meanGapUs;
+
+	if (frames < 2) {
+		entry->minGapUs = 0;
+	}
+	if ((int32_t)idleUs > (int32_t)gap) {
+		gap = idleUs;
+	}
+	entry->framesPerSecond = (frames >= 2 && gap > 0) ? 1000000 / gap : 0;
+	entry->changePermille = (frames > 0) ? (uint32_t)((uint64_t)entry->changes * 1000 / frames) : 0;
+}
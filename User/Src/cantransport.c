@@ -0,0 +1,34 @@
+/**
+ ******************************************************************************
+ * @file           : cantransport.c
+ * @brief          : Default CAN transport
+ ******************************************************************************
+ * Holds the transport used by CanFrame and the protocol modules. On the
+ * target canInitHardware() installs the bxCAN backend, host programs
+ * install a virtual bus node.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+
+#include "cantransport.h"
+
+/* Private variables ---------------------------------------------------------*/
+static CanTransport *defaultTransport = NULL;
+
+/**
+ * Set the default transport
+ * @param transport backend to use from now on
+ */
+void canTransportSet(CanTransport *transport) {
+	defaultTransport = transport;
+}
+
+/**
+ * Get the default transport
+ * @return backend or NULL if none has been set
+ */
+CanTransport *canTransportGet(void) {
+	return defaultTransport;
+}
@@ -0,0 +1,134 @@
+/**
+ ******************************************************************************
+ * @file           : cantxqueue.c
+ * @brief          : Priority ordered CAN TX queue
+ ******************************************************************************
+ * Binary min-heap of CAN frames. The frame that would win arbitration on
+ * the bus is always at the top, so the TX mailboxes are refilled in the
+ * same order the bus would transmit them.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include "cantxqueue.h"
+
+/* Private function prototypes -----------------------------------------------*/
+static int before(const CanTxQueue *q, uint32_t a, uint32_t b);
+static void swap(CanTxQueue *q, uint32_t a, uint32_t b);
+
+/**
+ * Reset queue to empty state
+ * @param q queue to initialize
+ */
+void canTxQueueInit(CanTxQueue *q) {
+	q->count = 0;
+	q->seq = 0;
+	q->highWater = 0;
+}
+
+/**
+ * Map a frame to its arbitration order on the bus.
+ * Bit layout follows the order the fields are sent on the wire:
+ * base ID (11), RTR/SRR (1), IDE (1), extended ID (18), extended RTR (1).
+ * @param msg frame
+ * @return key, the lowest key wins arbitration
+ */
+uint32_t canArbitrationKey(const CanMsg *msg) {
+	if (msg->ide) {
+		return ((msg->id >> 18) & 0x7FF) << 21
+				| 1u << 20							// SRR is recessive
+				| 1u << 19							// IDE is recessive
+				| (msg->id & 0x3FFFF) << 1
+				| (msg->rtr ? 1u : 0u);
+	}
+	return (msg->id & 0x7FF) << 21
+			| (msg->rtr ? 1u << 20 : 0u);
+}
+
+/**
+ * Insert a frame
+ * @param q target queue
+ * @param msg frame to insert
+ * @return 1 on success, 0 if the queue is full
+ */
+int canTxQueuePush(CanTxQueue *q, const CanMsg *msg) {
+	uint32_t i;
+
+	if (q->count >= CAN_TX_QUEUE_SIZE) {
+		return 0;
+	}
+
+	i = q->count++;
+	q->heap[i].key = canArbitrationKey(msg);
+	q->heap[i].seq = q->seq++;
+	q->heap[i].msg = *msg;
+
+	// sift up
+	while (i > 0 && before(q, i, (i - 1) / 2)) {
+		swap(q, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	if (q->count > q->highWater) {
+		q->highWater = q->count;
+	}
+	return 1;
+}
+
+/**
+ * Remove the frame with the highest bus priority
+ * @param q source queue
+ * @param msg destination for the frame
+ * @return 1 if a frame has been returned, 0 if the queue is empty
+ */
+int canTxQueuePop(CanTxQueue *q, CanMsg *msg) {
+	uint32_t i = 0;
+
+	if (q->count == 0) {
+		return 0;
+	}
+
+	*msg = q->heap[0].msg;
+	q->count--;
+	if (q->count == 0) {
+		return 1;
+	}
+	q->heap[0] = q->heap[q->count];
+
+	// sift down
+	for (;;) {
+		uint32_t l = 2 * i + 1;
+		uint32_t r = l + 1;
+		uint32_t m = i;
+
+		if (l < q->count && before(q, l, m)) {
+			m = l;
+		}
+		if (r < q->count && before(q, r, m)) {
+			m = r;
+		}
+		if (m == i) {
+			break;
+		}
+		swap(q, i, m);
+		i = m;
+	}
+	return 1;
+}
+
+/**
+ * Heap order: lower key first, on equal keys older entry first
+ */
+static int before(const CanTxQueue *q, uint32_t a, uint32_t b) {
+	if (q->heap[a].key != q->heap[b].key) {
+		return q->heap[a].key < q->heap[b].key;
+	}
+	return (int32_t)(q->heap[a].seq - q->heap[b].seq) < 0;
+}
+
+static void swap(CanTxQueue *q, uint32_t a, uint32_t b) {
+	CanTxEntry tmp = q->heap[a];
+
+	q->heap[a] = q->heap[b];
+	q->heap[b] = tmp;
+}
@@ -14,6 +14,10 @@
  * 1) Implement CAN communication with a counter value
  * 2) Add temperature value to CAN payload. ( Marked with ToDo (2) )
  *
+ * Keep the user button pressed during reset to run the CAN loopback
+ * benchmark. Results are shown on the display and sent as one line per
+ * mode over SWO (ITM port 0).
+ *
  ******************************************************************************
  */
 
@@ -27,18 +31,22 @@
 #include "ts_calibration.h"
 #include "can.h"
 #include "cancpp.h"
+#include "canbench.h"
+#include "tempsensor.h"
 
 /* Private includes ----------------------------------------------------------*/
 
 /* Private typedef -----------------------------------------------------------*/
 
 /* Private define ------------------------------------------------------------*/
+#define CAN_BENCH_DURATION_MS	2000
 
 /* Private variables ---------------------------------------------------------*/
 
 /* Private function prototypes -----------------------------------------------*/
 static int GetUserButtonPressed(void);
 static int GetTouchState (int *xCoord, int *yCoord);
+static void RunCanBenchmark(void);
 
 /**
  * @brief This function handles System tick timer.
@@ -78,9 +86,15 @@ int main(void)
 	LCD_SetColors(LCD_COLOR_MAGENTA, LCD_COLOR_BLACK); // TextColor, BackColor
 	LCD_DisplayStringAtLineMode(39, "Sophie Wallner", CENTER_MODE);
 
+	// draw into a second frame buffer, swapped in at vertical blanking
+	LCD_SetDoubleBuffer(0, LCD_BACK_BUFFER_LAYER0);
+
 	// ToDo: set up CAN peripherals
 	canInit();
 
+	if (GetUserButtonPressed()) {
+		RunCanBenchmark();
+	}
 
 	int flm = 0;
 
@@ -104,6 +118,12 @@ int main(void)
 		// ToDo: check if data has been received
 		canReceiveTask();
 
+		// keep the temperature conversion running, never blocks
+		tempSensorTask();
+
+		// temperature frames on change, at least every 10 s
+		canPublishTask();
+
 
 
 
@@ -114,6 +134,11 @@ int main(void)
 		LCD_SetPrintPosition(0, 18);
 		printf("   Timer: %.1f", cnt/1000.0);
 
+		// draw what has been printed since the last pass, changed characters only,
+		// and show it from the next vertical blanking on
+		LCD_FlushText();
+		LCD_Present();
+
 //		// test touch interface
 //		int x, y;
 //		if (GetTouchState(&x, &y)) {
@@ -136,6 +161,39 @@ static int GetUserButtonPressed(void) {
 	return (GPIOA->IDR & 0x0001);
 }
 
+/**
+ * Run CAN benchmark in loopback and silent loopback mode
+ * and report the results on display and SWO
+ */
+static void RunCanBenchmark(void) {
+	static const CanOpMode modes[] = { CAN_OPMODE_LOOPBACK, CAN_OPMODE_SILENT_LOOPBACK };
+	CanBenchResult result;
+	char summary[320];
+	unsigned int i, ln = 19;
+
+	LCD_SetFont(&Font12);
+	LCD_SetColors(LCD_COLOR_CYAN, LCD_COLOR_BLACK);
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		if (!canBenchRun(canBxcanTransport(), modes[i], CAN_BENCH_DURATION_MS, &result)) {
+			continue;
+		}
+		LCD_SetPrintPosition(ln++, 1);
+		printf("%s %lu fps %lu.%lu%%", (i == 0) ? "LB " : "SLB", result.framesPerSecond,
+				result.busLoadPermille / 10, result.busLoadPermille % 10);
+		LCD_SetPrintPosition(ln++, 1);
+		printf(" tx %lu/%lu rx %lu/%lu us", result.txLatency.p50, result.txLatency.p99,
+				result.rxLatency.p50, result.rxLatency.p99);
+		LCD_FlushText();
+		LCD_Present();
+
+		canBenchFormat(&result, summary, sizeof(summary));
+		for (char *c = summary; *c != '\0'; c++) {
+			ITM_SendChar(*c);
+		}
+		ITM_SendChar('\n');
+	}
+}
+
 /**
  * Check if touch interface has been used
  * @param xCoord x coordinate of touch event in pixels
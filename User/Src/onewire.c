@@ -0,0 +1,168 @@
+/**
+ ******************************************************************************
+ * @file           : onewire.c
+ * @brief          : Backend independent 1-Wire helpers
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <string.h>
+
+#include "onewire.h"
+
+/* Private define ------------------------------------------------------------*/
+#define ROM_BIT(rom, i)		(((rom)[(i) >> 3] >> ((i) & 7)) & 1)
+
+/* Private variables ---------------------------------------------------------*/
+// Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1, LSB first) of every byte value
+static const uint8_t crcTable[256] = {
+	0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83, 0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41,
+	0x9D, 0xC3, 0x21, 0x7F, 0xFC, 0xA2, 0x40, 0x1E, 0x5F, 0x01, 0xE3, 0xBD, 0x3E, 0x60, 0x82, 0xDC,
+	0x23, 0x7D, 0x9F, 0xC1, 0x42, 0x1C, 0xFE, 0xA0, 0xE1, 0xBF, 0x5D, 0x03, 0x80, 0xDE, 0x3C, 0x62,
+	0xBE, 0xE0, 0x02, 0x5C, 0xDF, 0x81, 0x63, 0x3D, 0x7C, 0x22, 0xC0, 0x9E, 0x1D, 0x43, 0xA1, 0xFF,
+	0x46, 0x18, 0xFA, 0xA4, 0x27, 0x79, 0x9B, 0xC5, 0x84, 0xDA, 0x38, 0x66, 0xE5, 0xBB, 0x59, 0x07,
+	0xDB, 0x85, 0x67, 0x39, 0xBA, 0xE4, 0x06, 0x58, 0x19, 0x47, 0xA5, 0xFB, 0x78, 0x26, 0xC4, 0x9A,
+	0x65, 0x3B, 0xD9, 0x87, 0x04, 0x5A, 0xB8, 0xE6, 0xA7, 0xF9, 0x1B, 0x45, 0xC6, 0x98, 0x7A, 0x24,
+	0xF8, 0xA6, 0x44, 0x1A, 0x99, 0xC7, 0x25, 0x7B, 0x3A, 0x64, 0x86, 0xD8, 0x5B, 0x05, 0xE7, 0xB9,
+	0x8C, 0xD2, 0x30, 0x6E, 0xED, 0xB3, 0x51, 0x0F, 0x4E, 0x10, 0xF2, 0xAC, 0x2F, 0x71, 0x93, 0xCD,
+	0x11, 0x4F, 0xAD, 0xF3, 0x70, 0x2E, 0xCC, 0x92, 0xD3, 0x8D, 0x6F, 0x31, 0xB2, 0xEC, 0x0E, 0x50,
+	0xAF, 0xF1, 0x13, 0x4D, 0xCE, 0x90, 0x72, 0x2C, 0x6D, 0x33, 0xD1, 0x8F, 0x0C, 0x52, 0xB0, 0xEE,
+	0x32, 0x6C, 0x8E, 0xD0, 0x53, 0x0D, 0xEF, 0xB1, 0xF0, 0xAE, 0x4C, 0x12, 0x91, 0xCF, 0x2D, 0x73,
+	0xCA, 0x94, 0x76, 0x28, 0xAB, 0xF5, 0x17, 0x49, 0x08, 0x56, 0xB4, 0xEA, 0x69, 0x37, 0xD5, 0x8B,
+	0x57, 0x09, 0xEB, 0xB5, 0x36, 0x68, 0x8A, 0xD4, 0x95, 0xCB, 0x29, 0x77, 0xF4, 0xAA, 0x48, 0x16,
+	0xE9, 0xB7, 0x55, 0x0B, 0x88, 0xD6, 0x34, 0x6A, 0x2B, 0x75, 0x97, 0xC9, 0x4A, 0x14, 0xF6, 0xA8,
+	0x74, 0x2A, 0xC8, 0x96, 0x15, 0x4B, 0xA9, 0xF7, 0xB6, 0xE8, 0x0A, 0x54, 0xD7, 0x89, 0x6B, 0x35
+};
+
+/**
+ * Fill in a transaction
+ * @param t transaction to set up
+ * @param reset 1 = start with a reset pulse
+ * @param tx bytes to write, may be NULL if txLen is 0
+ * @param rx buffer for the bytes read, may be NULL if rxLen is 0
+ * @param done called when the transaction has finished, may be NULL
+ * @param ctx passed to done
+ */
+void owSetup(OwTransaction *t, uint8_t reset, const uint8_t *tx, uint16_t txLen,
+		uint8_t *rx, uint16_t rxLen, OwCallback done, void *ctx) {
+	t->reset = reset;
+	t->tx = tx;
+	t->txLen = txLen;
+	t->rx = rx;
+	t->rxLen = rxLen;
+	t->search = 0;
+	t->conflicts = NULL;
+	t->status = OW_OK;
+	t->done = done;
+	t->ctx = ctx;
+}
+
+/**
+ * Run a transaction and wait until it has finished
+ * @return result of the transaction
+ */
+OwStatus owRun(OwBus *bus, OwTransaction *t) {
+	while (!bus->start(bus, t)) {
+		bus->idle(bus);
+	}
+	while (t->status == OW_BUSY) {
+		bus->idle(bus);
+	}
+	return t->status;
+}
+
+/**
+ * Start a new enumeration
+ */
+void owSearchInit(OwSearch *s) {
+	s->lastConflict = -1;
+	s->done = 0;
+	memset(s->rom, 0, sizeof(s->rom));
+}
+
+/**
+ * Find the next device with Search ROM. Every call walks the ROM code
+ * tree once: the path of the last device up to the last position where
+ * the 0 branch was taken, the 1 branch there and the 0 branch after it.
+ * @param rom returns the ROM code
+ * @return 1 if a device has been found, 0 if all devices have been found
+ */
+int owSearchNext(OwBus *bus, OwSearch *s, uint8_t rom[8]) {
+	OwTransaction t;
+	uint8_t cmd = OW_SEARCH_ROM;
+	uint8_t path[8] = { 0 };
+	uint8_t conflicts[8];
+	int i, last = -1;
+
+	if (s->done) {
+		return 0;
+	}
+
+	for (i = 0; i < 64; i++) {
+		if (i < s->lastConflict ? ROM_BIT(s->rom, i) : i == s->lastConflict) {
+			path[i >> 3] |= 1 << (i & 7);
+		}
+	}
+	owSetup(&t, 1, &cmd, 1, path, 8, NULL, NULL);
+	t.search = 1;
+	t.conflicts = conflicts;
+	if (owRun(bus, &t) != OW_OK) {
+		s->done = 1;
+		return 0;
+	}
+
+	for (i = 0; i < 64; i++) {
+		if (ROM_BIT(conflicts, i) && !ROM_BIT(path, i)) {
+			last = i;
+		}
+	}
+	s->lastConflict = last;
+	s->done = last < 0;
+	memcpy(s->rom, path, 8);
+	memcpy(rom, path, 8);
+	return 1;
+}
+
+/**
+ * Decide the direction of one search triplet, used by the bus masters
+ * @param t the search transaction
+ * @param index triplet 0..63
+ * @param bit first bit read: AND of the ROM bits of all devices still in the search
+ * @param complement second bit read: AND of the inverted ROM bits
+ * @return direction to write, 0xFF if no device answered
+ */
+uint8_t owTripletDirection(OwTransaction *t, uint32_t index, uint8_t bit, uint8_t complement) {
+	uint8_t mask = 1 << (index & 7);
+	uint8_t dir;
+
+	if (bit && complement) {
+		return 0xFF;
+	}
+	if (bit != complement) {
+		dir = bit;
+		t->conflicts[index >> 3] &= ~mask;
+	} else {
+		dir = (t->rx[index >> 3] & mask) != 0;
+		t->conflicts[index >> 3] |= mask;
+	}
+	if (dir) {
+		t->rx[index >> 3] |= mask;
+	} else {
+		t->rx[index >> 3] &= ~mask;
+	}
+	return dir;
+}
+
+/**
+ * Dallas/Maxim CRC8 as used for ROM codes and scratchpads, one table
+ * lookup per byte
+ * @return CRC, 0 if the last byte of data is the CRC of the bytes before
+ */
+uint8_t owCrc8(const uint8_t *data, uint16_t len) {
+	uint8_t crc = 0;
+
+	while (len-- > 0) {
+		crc = crcTable[crc ^ *data++];
+	}
+	return crc;
+}
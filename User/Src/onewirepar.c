@@ -0,0 +1,485 @@
+/**
+ ******************************************************************************
+ * @file           : onewirepar.c
+ * @brief          : Bit-parallel 1-Wire master for several buses on one port
+ ******************************************************************************
+ * All lines of a group share one slot sequence timed by TIM4 at 1 MHz,
+ * with the same timing as onewiretim.c. Per slot every line either
+ * writes 0, writes 1, reads or sits out because its transaction is
+ * shorter. A read slot is a 1 slot with a sample, so one slot is:
+ *
+ *   BSRR = all lines low | 6 us | BSRR = 1 and read lines released
+ *   | 9 us | one IDR read for all read lines
+ *   | 46 us | BSRR = 0 lines released | 9 us
+ *
+ * The reset pulse is shared as well, presence and short circuit are
+ * checked per line. Search ROM triplets are decided per line between the
+ * slots, so N buses are enumerated, converted and read in the time of
+ * the slowest one.
+ *
+ * Pins are open drain outputs, every line needs an external pull-up.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+
+#include "onewirepar.h"
+#include "onewiretim.h"
+#include "main.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum {
+	PH_RESET_LOW,
+	PH_RESET_RELEASE,
+	PH_PRESENCE,
+	PH_RESET_END,
+	PH_SLOT,
+	PH_WRITE0_RELEASE
+} Phase;
+
+typedef enum {
+	ACT_NONE,
+	ACT_WRITE0,
+	ACT_WRITE1,
+	ACT_READ
+} Action;
+
+/* Private variables ---------------------------------------------------------*/
+static OwParGroup * volatile active;	// group of the running slot sequence
+static OwParGroup *groups;				// all groups, linked by next
+static Phase    phase;
+static uint16_t slotStart;				// CNT at the falling edge of the current slot
+static uint16_t resetMask;				// lines starting with a reset pulse
+static uint16_t presenceMask;			// lines that answered the reset
+static uint16_t write0Mask;				// lines to release at the end of a 0 slot
+
+/* Private function prototypes -----------------------------------------------*/
+static int owParStart(OwBus *self, OwTransaction *t);
+static int owParBusy(OwBus *self);
+static void owParIdle(OwBus *self);
+static int hasQueued(const OwParGroup *group);
+static void startQueued(OwParGroup *after);
+static void startRun(OwParGroup *group);
+static void endRun(void);
+static void step(void);
+static void startSlot(void);
+static Action nextAction(OwParLine *line);
+static void storeBit(OwParLine *line, uint8_t bit);
+static void finishLine(OwParLine *line, OwStatus status);
+
+/**
+ * Set up a group and TIM4
+ * @param group group to initialize
+ * @param port GPIO port of all lines
+ */
+void owParInit(OwParGroup *group, GPIO_TypeDef *port) {
+	static uint8_t timerReady = 0;
+	OwParGroup *g;
+
+	group->port = port;
+	group->numLines = 0;
+	group->held = 0;
+	for (g = groups; g != NULL && g != group; g = g->next) {
+	}
+	if (g == NULL) {
+		group->next = groups;
+		groups = group;
+	}
+
+	if (!timerReady) {
+		TIM_HandleTypeDef tim4Handle;
+
+		__HAL_RCC_TIM4_CLK_ENABLE();
+		tim4Handle.Instance = TIM4;
+		tim4Handle.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+		tim4Handle.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+		tim4Handle.Init.CounterMode = TIM_COUNTERMODE_UP;
+		tim4Handle.Init.Period = 0xFFFF;
+		tim4Handle.Init.Prescaler = APB1_TimerPrescaler(1000000);
+		tim4Handle.Init.RepetitionCounter = 0;
+		HAL_TIM_Base_Init(&tim4Handle);
+		HAL_TIM_Base_Start(&tim4Handle);
+
+		TIM4->DIER &= ~TIM_DIER_CC1IE;
+		TIM4->SR = (uint32_t)~TIM_SR_CC1IF;
+		// slots are timed in microseconds, TIM4 goes before the CAN interrupts
+		HAL_NVIC_SetPriority(TIM4_IRQn, 0, 0);
+		HAL_NVIC_EnableIRQ(TIM4_IRQn);
+		timerReady = 1;
+	}
+}
+
+/**
+ * Add a line to a group, the line is an OwBus from now on
+ * @param pin one GPIO pin of the group port
+ * @return 1 on success, 0 if the group is full
+ */
+int owParAddLine(OwParGroup *group, OwParLine *line, uint16_t pin) {
+	GPIO_InitTypeDef gpio;
+
+	if (group->numLines >= OW_PAR_LINES) {
+		return 0;
+	}
+	line->bus.start = owParStart;
+	line->bus.busy = owParBusy;
+	line->bus.idle = owParIdle;
+	line->group = group;
+	line->pin = pin;
+	line->trans = NULL;
+	line->active = 0;
+	line->finished = 0;
+
+	group->port->BSRR = pin;		// released
+	gpio.Pin = pin;
+	gpio.Mode = GPIO_MODE_OUTPUT_OD;
+	gpio.Pull = GPIO_PULLUP;
+	gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	gpio.Alternate = 0;
+	HAL_GPIO_Init(group->port, &gpio);
+
+	group->lines[group->numLines++] = line;
+	return 1;
+}
+
+/**
+ * Queue transactions instead of starting them, until owParRelease()
+ */
+void owParHold(OwParGroup *group) {
+	group->held = 1;
+}
+
+/**
+ * Start all transactions queued since owParHold() together, at the end
+ * of the run of another group if one is running
+ */
+void owParRelease(OwParGroup *group) {
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	group->held = 0;
+	if (active == NULL && hasQueued(group)) {
+		startRun(group);
+	}
+	__set_PRIMASK(primask);
+}
+
+/**
+ * TIM4 ISR, one step of the running slot sequence
+ */
+void TIM4_IRQHandler(void) {
+	if ((TIM4->SR & TIM_SR_CC1IF) && (TIM4->DIER & TIM_DIER_CC1IE)) {
+		TIM4->SR = (uint32_t)~TIM_SR_CC1IF;
+		step();
+	}
+}
+
+static int owParStart(OwBus *self, OwTransaction *t) {
+	OwParLine *line = (OwParLine *)self;
+
+	if (line->trans != NULL || active != NULL) {
+		return 0;
+	}
+	line->trans = t;
+	t->status = OW_BUSY;
+	if (!line->group->held) {
+		startRun(line->group);
+	}
+	return 1;
+}
+
+static int owParBusy(OwBus *self) {
+	return ((OwParLine *)self)->trans != NULL || active != NULL;
+}
+
+/**
+ * Busy wait of owRun(). On a held group the transaction waited for is
+ * only queued and owParRelease() cannot come from the waiting caller:
+ * start the run with all transactions queued so far, the group stays
+ * held.
+ */
+static void owParIdle(OwBus *self) {
+	OwParLine *line = (OwParLine *)self;
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if (line->trans != NULL && active == NULL) {
+		startRun(line->group);
+	}
+	__set_PRIMASK(primask);
+	__WFI();
+}
+
+/**
+ * @return 1 if a line of the group has a transaction that waits for a run
+ */
+static int hasQueued(const OwParGroup *group) {
+	uint8_t i;
+
+	for (i = 0; i < group->numLines; i++) {
+		if (group->lines[i]->trans != NULL) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Start the run of the next group that is not held and has queued
+ * transactions, searching after the given group and ending with it
+ */
+static void startQueued(OwParGroup *after) {
+	OwParGroup *g = after;
+
+	do {
+		g = (g->next != NULL) ? g->next : groups;
+		if (!g->held && hasQueued(g)) {
+			startRun(g);
+			return;
+		}
+	} while (g != after);
+}
+
+/**
+ * Start the slot sequence for all lines with a queued transaction
+ */
+static void startRun(OwParGroup *group) {
+	uint8_t i;
+
+	resetMask = 0;
+	for (i = 0; i < group->numLines; i++) {
+		OwParLine *line = group->lines[i];
+
+		if (line->trans != NULL) {
+			line->active = 1;
+			line->bitPos = 0;
+			if (line->trans->reset) {
+				resetMask |= line->pin;
+			}
+		}
+	}
+	phase = resetMask ? PH_RESET_LOW : PH_SLOT;
+	active = group;
+
+	// the first step runs in the ISR as well
+	TIM4->SR = (uint32_t)~TIM_SR_CC1IF;
+	owTimSchedule(TIM4, TIM4->CNT + OW_TIM_MIN_AHEAD);
+	TIM4->DIER |= TIM_DIER_CC1IE;
+}
+
+/**
+ * All lines are done: stop the timer and call the done callbacks. The
+ * group is held meanwhile, transactions started by the callbacks are
+ * run together afterwards, after the groups released during the run.
+ */
+static void endRun(void) {
+	OwParGroup *group = active;
+	uint8_t held = group->held;
+	uint8_t i;
+
+	TIM4->DIER &= ~TIM_DIER_CC1IE;
+	active = NULL;
+
+	group->held = 1;
+	for (i = 0; i < group->numLines; i++) {
+		OwParLine *line = group->lines[i];
+
+		if (line->finished) {
+			OwTransaction *t = line->trans;
+
+			line->finished = 0;
+			line->trans = NULL;
+			if (t->done != NULL) {
+				t->done(t, t->ctx);
+			}
+		}
+	}
+	group->held = held;
+	// a callback may have started another group already
+	if (active == NULL) {
+		startQueued(group);
+	}
+}
+
+/**
+ * Advance the slot sequence, called at the compare time of the next step
+ */
+static void step(void) {
+	GPIO_TypeDef *port = active->port;
+	uint16_t idr;
+	uint8_t i;
+
+	switch (phase) {
+	case PH_RESET_LOW:
+		port->BSRR = (uint32_t)resetMask << 16;
+		slotStart = TIM4->CNT;
+		phase = PH_RESET_RELEASE;
+		owTimSchedule(TIM4, slotStart + OW_Delay_H);
+		break;
+
+	case PH_RESET_RELEASE:
+		port->BSRR = resetMask;
+		phase = PH_PRESENCE;
+		owTimSchedule(TIM4, slotStart + OW_Delay_H + OW_Delay_I);
+		break;
+
+	case PH_PRESENCE:
+		presenceMask = ~port->IDR & resetMask;
+		phase = PH_RESET_END;
+		owTimSchedule(TIM4, slotStart + OW_Delay_H + OW_Delay_I + OW_Delay_J);
+		break;
+
+	case PH_RESET_END:
+		idr = port->IDR;
+		for (i = 0; i < active->numLines; i++) {
+			OwParLine *line = active->lines[i];
+
+			if (!line->active || !(resetMask & line->pin)) {
+				continue;
+			}
+			if ((idr & line->pin) == 0) {
+				finishLine(line, OW_SHORT);
+			} else if (!(presenceMask & line->pin)) {
+				finishLine(line, OW_NO_PRESENCE);
+			}
+		}
+		startSlot();
+		break;
+
+	case PH_WRITE0_RELEASE:
+		port->BSRR = write0Mask;
+		phase = PH_SLOT;
+		owTimSchedule(TIM4, slotStart + OW_Delay_A + OW_Delay_B);
+		break;
+
+	case PH_SLOT:
+		startSlot();
+		break;
+	}
+}
+
+/**
+ * Start the next slot of all active lines, or end the run if all lines
+ * are done
+ */
+static void startSlot(void) {
+	GPIO_TypeDef *port = active->port;
+	Action actions[OW_PAR_LINES];
+	uint16_t low = 0, release = 0, read = 0, idr = 0;
+	uint32_t primask;
+	uint8_t i;
+
+	for (i = 0; i < active->numLines; i++) {
+		OwParLine *line = active->lines[i];
+
+		actions[i] = line->active ? nextAction(line) : ACT_NONE;
+		if (actions[i] == ACT_NONE) {
+			continue;
+		}
+		low |= line->pin;
+		if (actions[i] != ACT_WRITE0) {
+			release |= line->pin;
+		}
+		if (actions[i] == ACT_READ) {
+			read |= line->pin;
+		}
+	}
+	if (low == 0) {
+		endRun();
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	port->BSRR = (uint32_t)low << 16;
+	slotStart = TIM4->CNT;
+	owTimWaitUntil(TIM4, slotStart + OW_Delay_A);
+	port->BSRR = release;
+	if (read != 0) {
+		owTimWaitUntil(TIM4, slotStart + OW_Delay_A + OW_Delay_E);
+		idr = port->IDR;
+	}
+	__set_PRIMASK(primask);
+
+	for (i = 0; i < active->numLines; i++) {
+		OwParLine *line = active->lines[i];
+
+		if (actions[i] == ACT_NONE) {
+			continue;
+		}
+		if (actions[i] == ACT_READ) {
+			storeBit(line, (idr & line->pin) != 0);
+		}
+		line->bitPos++;
+	}
+
+	write0Mask = low & ~release;
+	if (write0Mask != 0) {
+		phase = PH_WRITE0_RELEASE;
+		owTimSchedule(TIM4, slotStart + OW_Delay_C);
+	} else {
+		phase = PH_SLOT;
+		owTimSchedule(TIM4, slotStart + OW_Delay_A + OW_Delay_B);
+	}
+}
+
+/**
+ * Slot type of a line for the next slot, finishes the line if its
+ * transaction is complete
+ */
+static Action nextAction(OwParLine *line) {
+	OwTransaction *t = line->trans;
+	uint32_t txBits = (uint32_t)t->txLen * 8;
+	uint32_t rxBits = t->search ? 64 * 3 : (uint32_t)t->rxLen * 8;
+	uint8_t dir;
+
+	if (line->bitPos >= txBits + rxBits) {
+		finishLine(line, OW_OK);
+		return ACT_NONE;
+	}
+	if (line->bitPos < txBits) {
+		return ((t->tx[line->bitPos >> 3] >> (line->bitPos & 7)) & 1) ? ACT_WRITE1 : ACT_WRITE0;
+	}
+	if (!t->search || (line->bitPos - txBits) % 3 != 2) {
+		return ACT_READ;
+	}
+	dir = owTripletDirection(t, (line->bitPos - txBits) / 3,
+			line->tripletBits & 1, line->tripletBits >> 1);
+	if (dir > 1) {
+		finishLine(line, OW_SEARCH_FAILED);
+		return ACT_NONE;
+	}
+	return dir ? ACT_WRITE1 : ACT_WRITE0;
+}
+
+/**
+ * Store the bit read in the current slot of a line
+ */
+static void storeBit(OwParLine *line, uint8_t bit) {
+	OwTransaction *t = line->trans;
+	uint32_t rxBit = line->bitPos - (uint32_t)t->txLen * 8;
+
+	if (t->search) {
+		if (rxBit % 3 == 0) {
+			line->tripletBits = bit;
+		} else {
+			line->tripletBits |= bit << 1;
+		}
+	} else if (bit) {
+		t->rx[rxBit >> 3] |= 1 << (rxBit & 7);
+	} else {
+		t->rx[rxBit >> 3] &= ~(1 << (rxBit & 7));
+	}
+}
+
+/**
+ * The status is set at once, done is called at the end of the run
+ */
+static void finishLine(OwParLine *line, OwStatus status) {
+	line->active = 0;
+	line->finished = 1;
+	line->trans->status = status;
+}
+
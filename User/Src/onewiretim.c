@@ -0,0 +1,296 @@
+/**
+ ******************************************************************************
+ * @file           : onewiretim.c
+ * @brief          : 1-Wire bit engine on a GPIO pin driven by TIM3 interrupts
+ ******************************************************************************
+ * TIM3 runs at 1 MHz, every step of a transaction is started by a TIM3
+ * channel 1 compare interrupt. Slots are 70 us long, reset takes 960 us:
+ *
+ *   reset:   low 481 | release, sample presence after 70 | check line after 409
+ *   write 0: low 61  | release 9
+ *   write 1: low 6, release | 64
+ *   read:    low 6, release, sample after 9 | 55
+ *
+ * The falling edge lies anywhere within the CNT tick read as slot start,
+ * so the minimum low times of reset and 0 slot get one tick more.
+ * Waits of 60 us and more are compare interrupts, the CPU is free in the
+ * meantime. The low pulse of a 1/read slot and the read sample point have
+ * to be within 15 us of the falling edge, interrupt latency could break
+ * that, so these few microseconds are timed inside the ISR with
+ * interrupts disabled.
+ * A search triplet is two read slots and one write slot, the direction
+ * is decided in the ISR between them.
+ * The pin is used as open drain output, an external pull-up is required.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+
+#include "onewiretim.h"
+#include "main.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum {
+	PH_RESET_LOW,
+	PH_RESET_RELEASE,
+	PH_PRESENCE,
+	PH_RESET_END,
+	PH_SLOT,
+	PH_WRITE0_RELEASE
+} Phase;
+
+/* Private variables ---------------------------------------------------------*/
+static OwTimBus * volatile active;		// bus of the running transaction
+static OwTransaction *trans;
+static Phase    phase;
+static uint16_t slotStart;				// CNT at the falling edge of the current slot
+static uint32_t bitPos;					// bits done, tx bits first
+static uint8_t  presence;
+static uint8_t  tripletBits;				// bit and complement read in the current search triplet
+
+/* Private function prototypes -----------------------------------------------*/
+static int owTimStart(OwBus *self, OwTransaction *t);
+static int owTimBusy(OwBus *self);
+static void owTimIdle(OwBus *self);
+static void step(void);
+static void startSlot(void);
+static void writeSlot(uint8_t bit);
+static uint8_t readSlot(void);
+static void finish(OwStatus status);
+
+/**
+ * Set up pin and TIM3
+ * @param bus bus to initialize
+ * @param port GPIO port of the data line
+ * @param pin GPIO pin of the data line
+ */
+void owTimInit(OwTimBus *bus, GPIO_TypeDef *port, uint16_t pin) {
+	static uint8_t timerReady = 0;
+	GPIO_InitTypeDef gpio;
+
+	bus->bus.start = owTimStart;
+	bus->bus.busy = owTimBusy;
+	bus->bus.idle = owTimIdle;
+	bus->port = port;
+	bus->pin = pin;
+
+	port->BSRR = pin;			// released
+	gpio.Pin = pin;
+	gpio.Mode = GPIO_MODE_OUTPUT_OD;
+	gpio.Pull = GPIO_PULLUP;
+	gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	gpio.Alternate = 0;
+	HAL_GPIO_Init(port, &gpio);
+
+	if (!timerReady) {
+		TIM_HandleTypeDef tim3Handle;
+
+		__HAL_RCC_TIM3_CLK_ENABLE();
+		tim3Handle.Instance = TIM3;
+		tim3Handle.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+		tim3Handle.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+		tim3Handle.Init.CounterMode = TIM_COUNTERMODE_UP;
+		tim3Handle.Init.Period = 0xFFFF;
+		tim3Handle.Init.Prescaler = APB1_TimerPrescaler(1000000);
+		tim3Handle.Init.RepetitionCounter = 0;
+		HAL_TIM_Base_Init(&tim3Handle);
+		HAL_TIM_Base_Start(&tim3Handle);
+
+		TIM3->DIER &= ~TIM_DIER_CC1IE;
+		TIM3->SR = (uint32_t)~TIM_SR_CC1IF;
+		// slots are timed in microseconds, TIM3 goes before the CAN interrupts
+		HAL_NVIC_SetPriority(TIM3_IRQn, 0, 0);
+		HAL_NVIC_EnableIRQ(TIM3_IRQn);
+		timerReady = 1;
+	}
+}
+
+/**
+ * TIM3 ISR, one step of the running transaction
+ */
+void TIM3_IRQHandler(void) {
+	if ((TIM3->SR & TIM_SR_CC1IF) && (TIM3->DIER & TIM_DIER_CC1IE)) {
+		TIM3->SR = (uint32_t)~TIM_SR_CC1IF;
+		step();
+	}
+}
+
+static int owTimStart(OwBus *self, OwTransaction *t) {
+	OwTimBus *bus = (OwTimBus *)self;
+
+	if (active != NULL) {
+		return 0;
+	}
+	trans = t;
+	t->status = OW_BUSY;
+	bitPos = 0;
+	phase = t->reset ? PH_RESET_LOW : PH_SLOT;
+	active = bus;
+
+	// the first step runs in the ISR as well
+	TIM3->SR = (uint32_t)~TIM_SR_CC1IF;
+	owTimSchedule(TIM3, TIM3->CNT + OW_TIM_MIN_AHEAD);
+	TIM3->DIER |= TIM_DIER_CC1IE;
+	return 1;
+}
+
+static int owTimBusy(OwBus *self) {
+	return active != NULL;
+}
+
+static void owTimIdle(OwBus *self) {
+	__WFI();
+}
+
+/**
+ * Advance the state machine, called at the compare time of the next step
+ */
+static void step(void) {
+	GPIO_TypeDef *port = active->port;
+	uint16_t pin = active->pin;
+
+	switch (phase) {
+	case PH_RESET_LOW:
+		port->BSRR = (uint32_t)pin << 16;
+		slotStart = TIM3->CNT;
+		phase = PH_RESET_RELEASE;
+		owTimSchedule(TIM3, slotStart + OW_Delay_H);
+		break;
+
+	case PH_RESET_RELEASE:
+		port->BSRR = pin;
+		phase = PH_PRESENCE;
+		owTimSchedule(TIM3, slotStart + OW_Delay_H + OW_Delay_I);
+		break;
+
+	case PH_PRESENCE:
+		presence = (port->IDR & pin) == 0;
+		phase = PH_RESET_END;
+		owTimSchedule(TIM3, slotStart + OW_Delay_H + OW_Delay_I + OW_Delay_J);
+		break;
+
+	case PH_RESET_END:
+		if ((port->IDR & pin) == 0) {
+			finish(OW_SHORT);
+		} else if (!presence) {
+			finish(OW_NO_PRESENCE);
+		} else {
+			startSlot();
+		}
+		break;
+
+	case PH_WRITE0_RELEASE:
+		port->BSRR = pin;
+		phase = PH_SLOT;
+		owTimSchedule(TIM3, slotStart + OW_Delay_C + OW_Delay_D);
+		break;
+
+	case PH_SLOT:
+		startSlot();
+		break;
+	}
+}
+
+/**
+ * Start the next bit slot, or finish the transaction if all bits are done
+ */
+static void startSlot(void) {
+	uint32_t txBits = (uint32_t)trans->txLen * 8;
+	uint32_t rxBits = trans->search ? 64 * 3 : (uint32_t)trans->rxLen * 8;
+
+	if (bitPos >= txBits + rxBits) {
+		finish(OW_OK);
+		return;
+	}
+
+	if (bitPos < txBits) {
+		writeSlot((trans->tx[bitPos >> 3] >> (bitPos & 7)) & 1);
+	} else if (trans->search) {
+		uint32_t triplet = (bitPos - txBits) / 3;
+
+		switch ((bitPos - txBits) % 3) {
+		case 0:
+			tripletBits = readSlot();
+			break;
+		case 1:
+			tripletBits |= readSlot() << 1;
+			break;
+		default: {
+			uint8_t dir = owTripletDirection(trans, triplet, tripletBits & 1, tripletBits >> 1);
+
+			if (dir > 1) {
+				finish(OW_SEARCH_FAILED);
+				return;
+			}
+			writeSlot(dir);
+			break;
+		}
+		}
+	} else {
+		uint32_t rxBit = bitPos - txBits;
+		uint8_t mask = 1 << (rxBit & 7);
+
+		if (readSlot()) {
+			trans->rx[rxBit >> 3] |= mask;
+		} else {
+			trans->rx[rxBit >> 3] &= ~mask;
+		}
+	}
+	bitPos++;
+}
+
+static void writeSlot(uint8_t bit) {
+	GPIO_TypeDef *port = active->port;
+	uint16_t pin = active->pin;
+	uint32_t primask;
+
+	if (bit == 0) {
+		port->BSRR = (uint32_t)pin << 16;
+		slotStart = TIM3->CNT;
+		phase = PH_WRITE0_RELEASE;
+		owTimSchedule(TIM3, slotStart + OW_Delay_C);
+	} else {
+		primask = __get_PRIMASK();
+		__disable_irq();
+		port->BSRR = (uint32_t)pin << 16;
+		slotStart = TIM3->CNT;
+		owTimWaitUntil(TIM3, slotStart + OW_Delay_A);
+		port->BSRR = pin;
+		__set_PRIMASK(primask);
+		phase = PH_SLOT;
+		owTimSchedule(TIM3, slotStart + OW_Delay_A + OW_Delay_B);
+	}
+}
+
+static uint8_t readSlot(void) {
+	GPIO_TypeDef *port = active->port;
+	uint16_t pin = active->pin;
+	uint32_t primask;
+	uint8_t bit;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	port->BSRR = (uint32_t)pin << 16;
+	slotStart = TIM3->CNT;
+	owTimWaitUntil(TIM3, slotStart + OW_Delay_A);
+	port->BSRR = pin;
+	owTimWaitUntil(TIM3, slotStart + OW_Delay_A + OW_Delay_E);
+	bit = (port->IDR & pin) != 0;
+	__set_PRIMASK(primask);
+	phase = PH_SLOT;
+	owTimSchedule(TIM3, slotStart + OW_Delay_A + OW_Delay_E + OW_Delay_F);
+	return bit;
+}
+
+static void finish(OwStatus status) {
+	OwTransaction *t = trans;
+
+	TIM3->DIER &= ~TIM_DIER_CC1IE;
+	active = NULL;
+	t->status = status;
+	if (t->done != NULL) {
+		t->done(t, t->ctx);
+	}
+}
+
@@ -0,0 +1,340 @@
+/**
+ ******************************************************************************
+ * @file           : onewireuart.c
+ * @brief          : 1-Wire bus master on a half-duplex UART with DMA
+ ******************************************************************************
+ * In half-duplex mode TX and RX share the pin, every byte sent is
+ * received back as the line level seen by the UART:
+ *
+ *   reset:   0xF0 at 9600 baud, the 520 us start/low bits are the reset
+ *            pulse. 0xF0 read back = no device, 0x00 with framing error =
+ *            short circuit, anything else = presence pulse.
+ *            Other UART errors, and all of them after the reset, end the
+ *            transaction with OW_BUS_ERROR.
+ *   write 0: 0x00 at 115200 baud, line low for 78 us
+ *   write 1: 0xFF, only the 8.7 us start bit is low
+ *   read:    0xFF, a device sending 0 stretches the low phase, so any
+ *            value other than 0xFF is read back as 0
+ *
+ * The slot bytes of a transaction are expanded into txBuf and sent with
+ * one DMA transfer, the echo is collected in rxBuf by a second one. The
+ * RX transfer complete interrupt finishes the transaction. Only
+ * transactions longer than OW_UART_SLOTS / 8 bytes need more than one.
+ * Search triplets take two transfers, the two read slots and then the
+ * write slot whose direction depends on them.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+
+#include "onewireuart.h"
+#include "main.h"
+
+/* Private define ------------------------------------------------------------*/
+#define RESET_BAUD		9600
+#define SLOT_BAUD		115200
+#define RESET_BYTE		0xF0
+
+/* Private variables ---------------------------------------------------------*/
+static OwUartBus *uartBus;		// UART5 exists once
+
+/* Private function prototypes -----------------------------------------------*/
+static int owUartStart(OwBus *self, OwTransaction *t);
+static int owUartBusy(OwBus *self);
+static void owUartIdle(OwBus *self);
+static void endTx(OwUartBus *bus);
+static void setBaud(OwUartBus *bus, uint32_t baud);
+static void startTransfer(OwUartBus *bus, uint32_t len);
+static void startChunk(OwUartBus *bus);
+static void startTriplet(OwUartBus *bus);
+static void finish(OwUartBus *bus, OwStatus status);
+
+/**
+ * Set up UART5, PC12 and the DMA streams
+ */
+void owUartInit(OwUartBus *bus) {
+	GPIO_InitTypeDef gpio;
+
+	bus->bus.start = owUartStart;
+	bus->bus.busy = owUartBusy;
+	bus->bus.idle = owUartIdle;
+	bus->trans = NULL;
+	uartBus = bus;
+
+	__HAL_RCC_GPIOC_CLK_ENABLE();
+	__HAL_RCC_UART5_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	gpio.Pin = GPIO_PIN_12;
+	gpio.Mode = GPIO_MODE_AF_OD;
+	gpio.Pull = GPIO_PULLUP;
+	gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+	gpio.Alternate = GPIO_AF8_UART5;
+	HAL_GPIO_Init(GPIOC, &gpio);
+
+	bus->dmaRx.Instance = DMA1_Stream0;
+	bus->dmaRx.Init.Channel = DMA_CHANNEL_4;
+	bus->dmaRx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+	bus->dmaRx.Init.PeriphInc = DMA_PINC_DISABLE;
+	bus->dmaRx.Init.MemInc = DMA_MINC_ENABLE;
+	bus->dmaRx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+	bus->dmaRx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+	bus->dmaRx.Init.Mode = DMA_NORMAL;
+	bus->dmaRx.Init.Priority = DMA_PRIORITY_HIGH;
+	bus->dmaRx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+	HAL_DMA_Init(&bus->dmaRx);
+	__HAL_LINKDMA(&bus->huart, hdmarx, bus->dmaRx);
+
+	bus->dmaTx.Instance = DMA1_Stream7;
+	bus->dmaTx.Init = bus->dmaRx.Init;
+	bus->dmaTx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+	HAL_DMA_Init(&bus->dmaTx);
+	__HAL_LINKDMA(&bus->huart, hdmatx, bus->dmaTx);
+
+	bus->huart.Instance = UART5;
+	bus->huart.Init.BaudRate = SLOT_BAUD;
+	bus->huart.Init.WordLength = UART_WORDLENGTH_8B;
+	bus->huart.Init.StopBits = UART_STOPBITS_1;
+	bus->huart.Init.Parity = UART_PARITY_NONE;
+	bus->huart.Init.Mode = UART_MODE_TX_RX;		// receiver stays on to read the echo
+	bus->huart.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+	bus->huart.Init.OverSampling = UART_OVERSAMPLING_16;
+	HAL_HalfDuplex_Init(&bus->huart);
+
+	HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 1, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+	HAL_NVIC_SetPriority(DMA1_Stream7_IRQn, 1, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream7_IRQn);
+	HAL_NVIC_SetPriority(UART5_IRQn, 1, 0);
+	HAL_NVIC_EnableIRQ(UART5_IRQn);
+}
+
+/**
+ * UART5 ISR, only errors, the data is moved by DMA
+ */
+void UART5_IRQHandler(void) {
+	HAL_UART_IRQHandler(&uartBus->huart);
+}
+
+/**
+ * DMA1 stream 0 ISR, UART5 RX
+ */
+void DMA1_Stream0_IRQHandler(void) {
+	HAL_DMA_IRQHandler(&uartBus->dmaRx);
+}
+
+/**
+ * DMA1 stream 7 ISR, UART5 TX
+ */
+void DMA1_Stream7_IRQHandler(void) {
+	HAL_DMA_IRQHandler(&uartBus->dmaTx);
+}
+
+/**
+ * All echo bytes of the running transfer have been received
+ */
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+	OwUartBus *bus = uartBus;
+	OwTransaction *t;
+	uint32_t txBits, i;
+
+	if (bus == NULL || huart != &bus->huart || bus->trans == NULL) {
+		return;
+	}
+	t = bus->trans;
+	endTx(bus);
+
+	if (bus->resetting) {
+		bus->resetting = 0;
+		setBaud(bus, SLOT_BAUD);
+		if (bus->rxBuf[0] == RESET_BYTE) {
+			finish(bus, OW_NO_PRESENCE);
+			return;
+		}
+		startChunk(bus);
+		return;
+	}
+
+	txBits = (uint32_t)t->txLen * 8;
+	for (i = 0; i < bus->chunk; i++) {
+		uint32_t bit = bus->bitPos + i;
+
+		if (bit >= txBits && t->search) {
+			uint8_t value = bus->rxBuf[i] == 0xFF;
+
+			if ((bit - txBits) % 3 == 0) {
+				bus->tripletBits = value;
+			} else if ((bit - txBits) % 3 == 1) {
+				bus->tripletBits |= value << 1;
+			}
+		} else if (bit >= txBits) {
+			uint32_t rxBit = bit - txBits;
+			uint8_t mask = 1 << (rxBit & 7);
+
+			if (bus->rxBuf[i] == 0xFF) {
+				t->rx[rxBit >> 3] |= mask;
+			} else {
+				t->rx[rxBit >> 3] &= ~mask;
+			}
+		}
+	}
+	bus->bitPos += bus->chunk;
+	startChunk(bus);
+}
+
+/**
+ * A framing error during the reset is a short circuit: the line did not
+ * go high again for the stop bit. Any other error lost echo bytes of the
+ * transfer, the bus master failed.
+ */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+	OwUartBus *bus = uartBus;
+	OwStatus status = OW_BUS_ERROR;
+
+	if (bus == NULL || huart != &bus->huart || bus->trans == NULL) {
+		return;
+	}
+	// HAL_UART_Abort() clears the error code
+	if (bus->resetting && (huart->ErrorCode & HAL_UART_ERROR_FE)) {
+		status = OW_SHORT;
+	}
+	HAL_UART_Abort(huart);
+	endTx(bus);
+	if (bus->resetting) {
+		bus->resetting = 0;
+		setBaud(bus, SLOT_BAUD);
+	}
+	finish(bus, status);
+}
+
+static int owUartStart(OwBus *self, OwTransaction *t) {
+	OwUartBus *bus = (OwUartBus *)self;
+
+	if (bus->trans != NULL) {
+		return 0;
+	}
+	bus->trans = t;
+	bus->bitPos = 0;
+	t->status = OW_BUSY;
+
+	if (t->reset) {
+		bus->resetting = 1;
+		setBaud(bus, RESET_BAUD);
+		bus->txBuf[0] = RESET_BYTE;
+		startTransfer(bus, 1);
+	} else {
+		startChunk(bus);
+	}
+	return 1;
+}
+
+static int owUartBusy(OwBus *self) {
+	return ((OwUartBus *)self)->trans != NULL;
+}
+
+static void owUartIdle(OwBus *self) {
+	__WFI();
+}
+
+/**
+ * The echo of the last byte arrives half a bit before the stop bit has
+ * been sent. Wait for it and end the transmission here, the TX complete
+ * interrupt would run too late for the next transfer or baud change.
+ */
+static void endTx(OwUartBus *bus) {
+	while (__HAL_UART_GET_FLAG(&bus->huart, UART_FLAG_TC) == RESET) {
+	}
+	__HAL_UART_DISABLE_IT(&bus->huart, UART_IT_TC);
+	bus->huart.gState = HAL_UART_STATE_READY;
+}
+
+/**
+ * Change the baud rate, only while the UART is idle
+ */
+static void setBaud(OwUartBus *bus, uint32_t baud) {
+	bus->huart.Init.BaudRate = baud;
+	bus->huart.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK1Freq(), baud);
+}
+
+/**
+ * Send len bytes of txBuf and receive the echo into rxBuf
+ */
+static void startTransfer(OwUartBus *bus, uint32_t len) {
+	bus->chunk = len;
+	__HAL_UART_CLEAR_OREFLAG(&bus->huart);
+	// receiver first, the echo of the first byte must not be missed
+	HAL_UART_Receive_DMA(&bus->huart, bus->rxBuf, len);
+	HAL_UART_Transmit_DMA(&bus->huart, bus->txBuf, len);
+}
+
+/**
+ * Expand the next slots into txBuf and start them, or finish the
+ * transaction if all slots are done
+ */
+static void startChunk(OwUartBus *bus) {
+	OwTransaction *t = bus->trans;
+	uint32_t txBits = (uint32_t)t->txLen * 8;
+	uint32_t rxBits = t->search ? 64 * 3 : (uint32_t)t->rxLen * 8;
+	uint32_t n = txBits + rxBits - bus->bitPos;
+	uint32_t i;
+
+	if (n == 0) {
+		finish(bus, OW_OK);
+		return;
+	}
+	if (t->search && bus->bitPos >= txBits) {
+		startTriplet(bus);
+		return;
+	}
+	if (t->search && n > txBits - bus->bitPos) {
+		n = txBits - bus->bitPos;
+	}
+	if (n > OW_UART_SLOTS) {
+		n = OW_UART_SLOTS;
+	}
+	for (i = 0; i < n; i++) {
+		uint32_t bit = bus->bitPos + i;
+
+		if (bit < txBits) {
+			bus->txBuf[i] = ((t->tx[bit >> 3] >> (bit & 7)) & 1) ? 0xFF : 0x00;
+		} else {
+			bus->txBuf[i] = 0xFF;		// read slot
+		}
+	}
+	startTransfer(bus, n);
+}
+
+/**
+ * Next part of a search triplet: the two read slots, or the write slot
+ * with the direction decided from them
+ */
+static void startTriplet(OwUartBus *bus) {
+	OwTransaction *t = bus->trans;
+	uint32_t j = bus->bitPos - (uint32_t)t->txLen * 8;
+	uint8_t dir;
+
+	if (j % 3 == 0) {
+		bus->txBuf[0] = 0xFF;
+		bus->txBuf[1] = 0xFF;
+		startTransfer(bus, 2);
+		return;
+	}
+	dir = owTripletDirection(t, j / 3, bus->tripletBits & 1, bus->tripletBits >> 1);
+	if (dir > 1) {
+		finish(bus, OW_SEARCH_FAILED);
+		return;
+	}
+	bus->txBuf[0] = dir ? 0xFF : 0x00;
+	startTransfer(bus, 1);
+}
+
+static void finish(OwUartBus *bus, OwStatus status) {
+	OwTransaction *t = bus->trans;
+
+	bus->trans = NULL;
+	t->status = status;
+	if (t->done != NULL) {
+		t->done(t, t->ctx);
+	}
+}
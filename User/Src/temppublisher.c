@@ -0,0 +1,184 @@
+/**
+ ******************************************************************************
+ * @file           : temppublisher.c
+ * @brief          : Deadband and rate limited publishing of a temperature
+ ******************************************************************************
+ * Every new sensor value is passed to tempPublisherSample() and goes
+ * through the pre-filter. tempPublisherTask() sends the filtered value
+ *
+ *   - when it differs from the last sent value by at least the deadband
+ *     and minPeriodMs has passed since the last frame, or
+ *   - when maxPeriodMs has passed since the last frame (heartbeat).
+ *
+ * A steady temperature therefore costs one frame per maxPeriodMs instead
+ * of one per fixedPeriodMs. The EWMA runs with 8 extra fraction bits so
+ * small steps are not lost, the median removes single outliers
+ * completely. Everything is integer arithmetic on 1/16 °C.
+ *
+ ******************************************************************************
+ */
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <string.h>
+
+#include "temppublisher.h"
+#include "tempsensor.h"
+
+/* Private define ------------------------------------------------------------*/
+#define EWMA_FRACTION	8		// extra fraction bits of the EWMA state
+
+/* Private variables ---------------------------------------------------------*/
+static TempPublisherConfig config;
+static TempPublisherSend sendFunction;
+static void *sendCtx;
+
+static int32_t  ewma;			// filtered value << EWMA_FRACTION
+static int16_t  window[TEMP_PUBLISHER_MEDIAN_SIZE];
+static uint8_t  windowCount;
+static uint8_t  windowPos;
+static int16_t  filtered;
+static uint8_t  hasValue;
+
+static int16_t  lastSent;
+static uint32_t lastSentMs;
+static uint8_t  hasSent;
+static uint32_t startMs;
+static uint32_t lastTaskMs;
+static TempPublisherStats stats;
+
+/* Private function prototypes -----------------------------------------------*/
+static int16_t median(void);
+
+/**
+ * Set the publishing rules and reset filter and statistics
+ * @param send transmits a value
+ * @param nowMs current time, start of the fixed-rate reference
+ */
+void tempPublisherInit(const TempPublisherConfig *cfg, TempPublisherSend send, void *ctx, uint32_t nowMs) {
+	config = *cfg;
+	if (config.minPeriodMs > config.maxPeriodMs && config.maxPeriodMs != 0) {
+		config.minPeriodMs = config.maxPeriodMs;
+	}
+	sendFunction = send;
+	sendCtx = ctx;
+	windowCount = 0;
+	windowPos = 0;
+	hasValue = 0;
+	hasSent = 0;
+	startMs = nowMs;
+	lastTaskMs = nowMs;
+	memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * Pass a new sensor value through the filter
+ * @param temperature 1/16 °C, TEMP_SENSOR_INVALID is ignored
+ */
+void tempPublisherSample(int16_t temperature) {
+	if (temperature == TEMP_SENSOR_INVALID) {
+		return;
+	}
+	stats.samples++;
+
+	switch (config.filter) {
+	case TEMP_PUBLISHER_FILTER_EWMA:
+		if (!hasValue) {
+			ewma = (int32_t)temperature << EWMA_FRACTION;
+		} else {
+			ewma += (((int32_t)temperature << EWMA_FRACTION) - ewma) >> config.ewmaShift;
+		}
+		filtered = (int16_t)((ewma + (1 << (EWMA_FRACTION - 1))) >> EWMA_FRACTION);
+		break;
+
+	case TEMP_PUBLISHER_FILTER_MEDIAN:
+		window[windowPos] = temperature;
+		windowPos = (windowPos + 1) % TEMP_PUBLISHER_MEDIAN_SIZE;
+		if (windowCount < TEMP_PUBLISHER_MEDIAN_SIZE) {
+			windowCount++;
+		}
+		filtered = median();
+		break;
+
+	default:
+		filtered = temperature;
+		break;
+	}
+	hasValue = 1;
+}
+
+/**
+ * Send the filtered value if the rules say so, has to be called from the
+ * main loop
+ * @param nowMs current time
+ */
+void tempPublisherTask(uint32_t nowMs) {
+	uint32_t elapsed = nowMs - lastSentMs;
+	int32_t change;
+	uint8_t onChange, onTimeout;
+
+	lastTaskMs = nowMs;
+	if (!hasValue || sendFunction == NULL) {
+		return;
+	}
+
+	change = (int32_t)filtered - lastSent;
+	change = (change < 0) ? -change : change;
+	onChange = !hasSent || (change >= config.deadband && elapsed >= config.minPeriodMs);
+	onTimeout = hasSent && config.maxPeriodMs != 0 && elapsed >= config.maxPeriodMs;
+	if (!onChange && !onTimeout) {
+		return;
+	}
+	if (!sendFunction(filtered, sendCtx)) {
+		return;
+	}
+
+	lastSent = filtered;
+	lastSentMs = nowMs;
+	hasSent = 1;
+	stats.sent++;
+	if (onChange) {
+		stats.sentOnChange++;
+	} else {
+		stats.sentOnTimeout++;
+	}
+}
+
+/**
+ * return current output of the filter in 1/16 °C, TEMP_SENSOR_INVALID
+ *        before the first sample
+ */
+int16_t tempPublisherFiltered(void) {
+	return hasValue ? filtered : TEMP_SENSOR_INVALID;
+}
+
+/**
+ * Frames sent and saved compared with fixed-rate sending up to the last
+ * tempPublisherTask() call
+ */
+void tempPublisherGetStats(TempPublisherStats *result) {
+	*result = stats;
+	result->fixedRateFrames = (config.fixedPeriodMs != 0)
+			? (lastTaskMs - startMs) / config.fixedPeriodMs : 0;
+	result->savedFrames = (result->fixedRateFrames > result->sent)
+			? result->fixedRateFrames - result->sent : 0;
+	result->savedPermille = (result->fixedRateFrames != 0)
+			? (uint32_t)((uint64_t)result->savedFrames * 1000 / result->fixedRateFrames) : 0;
+}
+
+/**
+ * Median of the samples in the window, insertion sort of a copy
+ */
+static int16_t median(void) {
+	int16_t sorted[TEMP_PUBLISHER_MEDIAN_SIZE];
+	uint8_t i, j;
+
+	for (i = 0; i < windowCount; i++) {
+		int16_t v = window[i];
+
+		for (j = i; j > 0 && sorted[j - 1] > v; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = v;
+	}
+	return sorted[windowCount / 2];
+}
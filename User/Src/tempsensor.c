@@ -1,42 +1,375 @@
 /**
  * Simplify usage of DS18B20 temperature sensor
  *
+ * A conversion takes up to 750 ms at 12 bit and 94 ms at 9 bit. It is
+ * started with tempSensorStartConversion(), tempSensorPoll() checks with
+ * a few read slots whether it has finished and then reads the scratchpad,
+ * tempSensorReadResult() returns the value. The bus transfers run in
+ * interrupts, the steps are chained by their completion callbacks.
+ * tempSensorTask() does all of this from the main loop and converts
+ * continuously, tempSensorGetTemperature() returns the last valid value
+ * without waiting.
+ *
+ * All DS18B20 on the bus are found by Search ROM at init. One Convert T
+ * with Skip ROM starts the conversion in all of them, so a sweep over N
+ * sensors takes one conversion time plus N short Match ROM reads instead
+ * of N conversions. The reads are chained in the completion callbacks.
+ * Without a search result a single sensor is addressed with Skip ROM.
+ *
+ * Every read fetches the whole scratchpad and checks its CRC. A bad read
+ * is repeated up to TEMP_SENSOR_RETRIES times within the sweep, the
+ * conversion result stays in the scratchpad meanwhile. Errors are counted
+ * per sensor, see tempSensorGetErrors().
+ *
+ * The conversion timeout ends with the conversion. The read sweep
+ * (TEMP_SENSOR_READING) always ends by itself, it is not restarted from
+ * the main loop while the interrupt chain runs.
  */
 
 
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "tempsensor.h"
 #include "DS18B20.h"
+#include "onewiretim.h"
+#include "onewireuart.h"
 #include "main.h"
 
-// function declarations
+// 1-Wire master: 0 = PG9 timed by TIM3, 1 = UART5 half-duplex on PC12
+#define TEMP_SENSOR_USE_UART	0
+
+#define CONVERSION_MARGIN_MS	250		// added to the conversion time for the timeout
+#define POLL_INTERVAL_MS		10		// read slots while converting
+
+#if TEMP_SENSOR_USE_UART
+static OwUartBus bus;
+#else
+static OwTimBus bus;
+#endif
+static Ds1820 sensors[TEMP_SENSOR_MAX];
+static int numSensors;
+static volatile int readIndex;			// sensor read by the running transaction
+static uint8_t readOk[TEMP_SENSOR_MAX];		// scratchpad of the last sweep is valid
+static uint8_t readRetries;				// retries left for the sensor being read
+static TempSensorErrors errorCounters[TEMP_SENSOR_MAX];
+static volatile TempSensorState state = TEMP_SENSOR_IDLE;
+static uint32_t startTick;
+static uint32_t pollTick;
+static uint32_t conversionTimeout;		// ms, depends on the resolution
+static int16_t temperatures[TEMP_SENSOR_MAX];
+static uint8_t hasValue = 0;
+static TempSensorCallback readyCallback = NULL;
+static void *readyCtx;
+
+static void onConversionStarted(OwTransaction *t, void *ctx);
+static void onPolled(OwTransaction *t, void *ctx);
+static void onRead(OwTransaction *t, void *ctx);
+static void startNextRead(void);
 
 /**
- * Initialize peripherals for DS18B20
- * return 1 if a device has been found
+ * Initialize peripherals for DS18B20, find the sensors on the bus and set
+ * their resolution
+ * @param resolution 9..12 bit, conversion time 94 ms at 9 bit, doubled per bit
  */
-void tempSensorInit(void)
+void tempSensorInit(uint8_t resolution)
 {
-	GPIO_InitTypeDef pg9;
+	int i;
 
+#if TEMP_SENSOR_USE_UART
+	owUartInit(&bus);
+#else
 	__HAL_RCC_GPIOG_CLK_ENABLE();
-	pg9.Pin = GPIO_PIN_9;
-	pg9.Mode = GPIO_MODE_OUTPUT_PP;
-	pg9.Pull = GPIO_PULLUP;
-	pg9.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-	pg9.Alternate = 0;
-	HAL_GPIO_Init(GPIOG, &pg9);
+	owTimInit(&bus, GPIOG, GPIO_PIN_9);
+#endif
+
+	for (i = 0; i < TEMP_SENSOR_MAX; i++) {
+		temperatures[i] = TEMP_SENSOR_INVALID;
+		readOk[i] = 0;
+	}
+	memset(errorCounters, 0, sizeof(errorCounters));
+	numSensors = ds1820_search(&bus.bus, sensors, TEMP_SENSOR_MAX);
+	if (numSensors == 0) {
+		ds1820_init(&sensors[0], &bus.bus);
+		numSensors = 1;
+	}
+	for (i = 0; i < numSensors; i++) {
+		ds1820_set_resolution(&sensors[i], resolution);
+	}
+	// all sensors convert at the same time, the slowest one counts
+	conversionTimeout = 0;
+	for (i = 0; i < numSensors; i++) {
+		if (ds1820_conversion_time(&sensors[i]) > conversionTimeout) {
+			conversionTimeout = ds1820_conversion_time(&sensors[i]);
+		}
+	}
+	conversionTimeout += CONVERSION_MARGIN_MS;
+	state = TEMP_SENSOR_IDLE;
+}
+
+/**
+ * Get the last valid temperature of the first sensor, does not wait for a conversion
+ * return temperature in 1/16 °C, TEMP_SENSOR_INVALID if there is no value yet
+ */
+int16_t tempSensorGetTemperature()
+{
+	return temperatures[0];
+}
+
+/**
+ * return number of sensors found at init, at least 1
+ */
+int tempSensorCount(void)
+{
+	return numSensors;
+}
+
+/**
+ * Get the last valid temperature of one sensor
+ * return temperature in 1/16 °C, TEMP_SENSOR_INVALID if there is no value yet
+ */
+int16_t tempSensorGetTemperatureOf(int index)
+{
+	if (index < 0 || index >= numSensors) {
+		return TEMP_SENSOR_INVALID;
+	}
+	return temperatures[index];
+}
+
+/**
+ * Get the ROM code of one sensor
+ * return 1 on success, 0 if the sensor is addressed with Skip ROM
+ */
+int tempSensorGetRom(int index, uint8_t rom[8])
+{
+	if (index < 0 || index >= numSensors || !sensors[index].hasRom) {
+		return 0;
+	}
+	memcpy(rom, sensors[index].rom, 8);
+	return 1;
+}
+
+/**
+ * Get the error counters of one sensor
+ * return 1 on success, 0 if index is out of range
+ */
+int tempSensorGetErrors(int index, TempSensorErrors *errors)
+{
+	if (index < 0 || index >= numSensors) {
+		return 0;
+	}
+	*errors = errorCounters[index];
+	return 1;
+}
+
+/**
+ * Start a conversion, a missing device is reported by tempSensorPoll()
+ * return 1 on success, 0 if the bus is busy
+ */
+int tempSensorStartConversion(void)
+{
+	startTick = HAL_GetTick();
+	pollTick = startTick;
+	state = TEMP_SENSOR_CONVERTING;
+	// Skip ROM: all sensors convert at once
+	if (!ds1820_start_conversion(&sensors[0], onConversionStarted, NULL)) {
+		state = TEMP_SENSOR_ERROR;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Check if the running conversion has finished. The bus is only
+ * accessed every POLL_INTERVAL_MS.
+ * return current state
+ */
+TempSensorState tempSensorPoll(void)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t primask;
+
+	if (state != TEMP_SENSOR_CONVERTING || now - pollTick < POLL_INTERVAL_MS) {
+		return state;
+	}
+	pollTick = now;
+
+	if (now - startTick > conversionTimeout) {
+		// onPolled() may just have started the reads
+		primask = __get_PRIMASK();
+		__disable_irq();
+		if (state == TEMP_SENSOR_CONVERTING) {
+			state = TEMP_SENSOR_ERROR;
+		}
+		__set_PRIMASK(primask);
+	} else {
+		// fails if a transfer is still running, then try again next time
+		ds1820_start_poll(&sensors[0], onPolled, NULL);
+	}
+	return state;
+}
+
+/**
+ * Read the results of a finished sweep, the values are cached for
+ * tempSensorGetTemperature() and passed to the callback. Sensors whose
+ * read failed keep their last value.
+ * return temperature of the first sensor in 1/16 °C
+ */
+int16_t tempSensorReadResult(void)
+{
+	int i;
+
+	for (i = 0; i < numSensors; i++) {
+		if (!readOk[i]) {
+			continue;
+		}
+		temperatures[i] = ds1820_result_raw(&sensors[i]);
+		hasValue = 1;
+		if (readyCallback != NULL) {
+			readyCallback(i, temperatures[i], readyCtx);
+		}
+	}
+	state = TEMP_SENSOR_IDLE;
+	return temperatures[0];
+}
+
+/**
+ * return 1 if at least one conversion has been read
+ */
+int tempSensorHasValue(void)
+{
+	return hasValue;
+}
+
+/**
+ * Set a function that is called with every new value
+ */
+void tempSensorSetCallback(TempSensorCallback callback, void *ctx)
+{
+	readyCtx = ctx;
+	readyCallback = callback;
+}
+
+/**
+ * Convert continuously, has to be called from the main loop
+ */
+void tempSensorTask(void)
+{
+	switch (tempSensorPoll()) {
+	case TEMP_SENSOR_READY:
+		tempSensorReadResult();
+		tempSensorStartConversion();
+		break;
+	case TEMP_SENSOR_IDLE:
+		tempSensorStartConversion();
+		break;
+	case TEMP_SENSOR_READING:
+		// the read sweep ends by itself
+		break;
+	case TEMP_SENSOR_ERROR:
+		// retry once per timeout, a missing sensor must not block the bus
+		if (HAL_GetTick() - startTick > conversionTimeout) {
+			tempSensorStartConversion();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Print a temperature with two decimals, without floating point
+ * return length as snprintf()
+ */
+int tempSensorFormat(char *buf, size_t size, int16_t temperature)
+{
+	const char *sign = "";
+	uint32_t value = temperature;
+
+	if (temperature == TEMP_SENSOR_INVALID) {
+		return snprintf(buf, size, "--.--");
+	}
+	if (temperature < 0) {
+		sign = "-";
+		value = -(int32_t)temperature;
+	}
+	// 1/16 to 1/100, rounded, at most 94
+	return snprintf(buf, size, "%s%lu.%02lu", sign, (unsigned long)(value >> 4),
+			(unsigned long)(((value & 15) * 100 + 8) >> 4));
+}
+
+/**
+ * Convert T has been sent, or no device answered
+ */
+static void onConversionStarted(OwTransaction *t, void *ctx)
+{
+	if (t->status != OW_OK) {
+		state = TEMP_SENSOR_ERROR;
+	}
+}
+
+/**
+ * Busy check done, read the scratchpads as soon as all conversions are finished
+ */
+static void onPolled(OwTransaction *t, void *ctx)
+{
+	if (state == TEMP_SENSOR_CONVERTING && ds1820_conversion_done(&sensors[0])) {
+		state = TEMP_SENSOR_READING;
+		memset(readOk, 0, sizeof(readOk));
+		readIndex = 0;
+		readRetries = TEMP_SENSOR_RETRIES;
+		startNextRead();
+	}
+}
+
+/**
+ * Scratchpad of sensor readIndex received, check it and go on with the
+ * same sensor while it has retries left, else with the next one
+ */
+static void onRead(OwTransaction *t, void *ctx)
+{
+	TempSensorErrors *errors = &errorCounters[readIndex];
+
+	errors->reads++;
+	if (t->status != OW_OK) {
+		errors->busErrors++;
+	} else if (!ds1820_scratchpad_valid(&sensors[readIndex])) {
+		errors->crcErrors++;
+	} else {
+		readOk[readIndex] = 1;
+	}
 
-	ds1820_init(GPIOG, GPIO_PIN_9);
+	if (!readOk[readIndex] && readRetries > 0) {
+		readRetries--;
+	} else {
+		if (!readOk[readIndex]) {
+			errors->failedSweeps++;
+		}
+		readIndex++;
+		readRetries = TEMP_SENSOR_RETRIES;
+	}
+	startNextRead();
 }
 
 /**
- * Get
- * return 1 if a device has been found
+ * Read the next sensor of the sweep, the sweep fails only if no sensor
+ * could be read
  */
-float tempSensorGetTemperature()
+static void startNextRead(void)
 {
-	float temperature = -1e3;
+	int i;
 
-	temperature = ds1820_read_temp(GPIOG, GPIO_PIN_9);
-	return temperature;
+	if (readIndex < numSensors) {
+		if (!ds1820_start_read(&sensors[readIndex], onRead, NULL)) {
+			state = TEMP_SENSOR_ERROR;
+		}
+		return;
+	}
+	state = TEMP_SENSOR_ERROR;
+	for (i = 0; i < numSensors; i++) {
+		if (readOk[i]) {
+			state = TEMP_SENSOR_READY;
+		}
+	}
 }